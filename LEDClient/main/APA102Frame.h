@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include "Types.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+// A column of S LEDs as the strip takes it over SPI, followed by a black
+// copy of itself for the background. The LED frames are loaded from
+// pixels in place, so the buffer can be handed to the SPI driver as is.
+template <size_t S>
+class APA102Frame {
+ public:
+  APA102Frame() : frame_(static_cast<SPIFrame*>(alloc(sizeof(SPIFrame)))) {
+    std::fill(*frame_, *frame_ + sizeof(SPIFrame) / 2, 0);
+    for (size_t i = 0; i < S; ++i) {
+      *(*frame_ + 4 + i * 4) = 0xff;  // 0xe0 + 5 bits brightness
+    }
+    // copy black pixels into 2nd slot for background
+    std::copy(*frame_, *frame_ + sizeof(SPIFrame) / 2,
+              *frame_ + sizeof(SPIFrame) / 2);
+  }
+
+  ~APA102Frame() { release(frame_); }
+
+  APA102Frame& IRAM_ATTR load(const RGB* data) {
+    auto w = *frame_ + 4 + 1;
+    for (auto p = data; p < data + S; ++p) {
+      std::copy(reinterpret_cast<const uint8_t*>(p),
+                reinterpret_cast<const uint8_t*>(p) + 3, w);
+      w += 4;
+    }
+    return *this;
+  }
+
+  // Pixels as little-endian 5:6:5 R,G,B words. Each channel's high bits are
+  // repeated into its low ones, so full scale stays full scale.
+  APA102Frame& IRAM_ATTR load_rgb565(const uint8_t* data) {
+    auto w = *frame_ + 4 + 1;
+    for (size_t i = 0; i < S; ++i, data += 2, w += 4) {
+      uint16_t v = data[0] | data[1] << 8;
+      uint8_t r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+      w[0] = b << 3 | b >> 2;
+      w[1] = g << 2 | g >> 4;
+      w[2] = r << 3 | r >> 2;
+    }
+    return *this;
+  }
+
+  // Pixels as indexes into lut, whose entries are whole LED frames,
+  // brightness byte included, so each is a single aligned store
+  APA102Frame& IRAM_ATTR load_indexed(const uint8_t* data,
+                                      const uint32_t* lut) {
+    auto w = reinterpret_cast<uint32_t*>(*frame_ + 4);
+    for (size_t i = 0; i < S; ++i) {
+      w[i] = lut[data[i]];
+    }
+    return *this;
+  }
+
+  constexpr size_t IRAM_ATTR size() const { return sizeof(SPIFrame); }
+  const uint8_t* IRAM_ATTR data() const { return *frame_; }
+
+ private:
+  // DMA-capable on the client, so frames are sent where they lie
+  static void* alloc(size_t size) {
+#ifdef ESP_PLATFORM
+    return heap_caps_malloc(size, MALLOC_CAP_DMA | MALLOC_CAP_32BIT);
+#else
+    return malloc(size);
+#endif
+  }
+
+  static void release(void* p) {
+#ifdef ESP_PLATFORM
+    heap_caps_free(p);
+#else
+    ::free(p);
+#endif
+  }
+
+  typedef uint8_t SPIFrame[2 * (4                            // start frame
+                                + (S * 4)                    // LED frames
+                                + ((((S + 1) / 2) + 7) / 8)  // end frame
+                                )];
+  SPIFrame* frame_;
+};
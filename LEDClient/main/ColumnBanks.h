@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+// Front and back banks of columns shared by the column sender, which sends
+// from the front one, and the frame loop, which fills the back one and
+// stages it. The sender flips to a staged bank only between revolutions, so
+// a revolution shows one frame throughout, and the frame loop can take most
+// of a revolution to fill the next one without the sender ever seeing it
+// half loaded.
+//
+// A bank is whatever T* the columns are read through: owned column buffers
+// filled by copying, or a frame received in the layout the strip takes,
+// staged by pointing the back bank at it. Both sides share one word, the
+// index of the front bank and whether the back one is staged. The frame
+// loop only sets the staged bit, when it is clear, and the sender only clears
+// it, flipping the index in the same store, so neither needs to retry.
+template <typename T>
+class ColumnBanks {
+ public:
+  ColumnBanks(T* front, T* back) : banks_{front, back}, state_(0) {}
+
+  ColumnBanks(const ColumnBanks&) = delete;
+  ColumnBanks& operator=(const ColumnBanks&) = delete;
+
+  // Column sender. The bank on display.
+  T* IRAM_ATTR front() const {
+    return banks_[state_.load(std::memory_order_relaxed) & FRONT];
+  }
+
+  // Column sender, between revolutions. Puts the staged bank on display, if
+  // there is one, and returns whether it did.
+  bool IRAM_ATTR flip() {
+    auto s = state_.load(std::memory_order_acquire);
+    if (!(s & STAGED)) {
+      return false;
+    }
+    state_.store((s ^ FRONT) & ~STAGED, std::memory_order_release);
+    return true;
+  }
+
+  // Frame loop. Whether the back bank is staged and waiting for the sender,
+  // which then owns it until it flips past it again.
+  bool staged() const {
+    return state_.load(std::memory_order_acquire) & STAGED;
+  }
+
+  // Frame loop, while nothing is staged. The sender does not read this bank
+  // until it is staged.
+  T*& back() {
+    return banks_[(state_.load(std::memory_order_acquire) & FRONT) ^ 1];
+  }
+
+  // Frame loop, while nothing is staged. Offers the back bank for the next
+  // revolution.
+  void stage() {
+    auto s = state_.load(std::memory_order_relaxed);
+    state_.store(s | STAGED, std::memory_order_release);
+  }
+
+ private:
+  static const uint32_t FRONT = 1;
+  static const uint32_t STAGED = 2;
+
+  T* banks_[2];
+  std::atomic<uint32_t> state_;
+};
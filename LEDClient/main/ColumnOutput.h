@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Where columns are sent: the SPI bus on the client, a recording on hosts.
+// Transfers go out in the order queued, without the caller waiting for
+// them, and are reaped once finished.
+class ColumnOutput {
+ public:
+  virtual ~ColumnOutput() {}
+
+  // Transfers that may be queued and not yet reaped
+  virtual size_t depth() const = 0;
+
+  // Queues size bytes at data, which must stay valid until the transfer is
+  // reaped. Callers keep no more than depth() outstanding.
+  virtual void queue(const uint8_t* data, size_t size) = 0;
+
+  // Reaps the transfers that have finished, without waiting, and returns
+  // how many
+  virtual size_t reap() = 0;
+};
+
+// The transfers making up one column
+struct ColumnTransfers {
+  static const int MAX = 2;
+
+  ColumnTransfers() : count(0) {}
+
+  void add(const uint8_t* d, size_t s) {
+    data[count] = d;
+    size[count] = s;
+    ++count;
+  }
+
+  const uint8_t* data[MAX];
+  size_t size[MAX];
+  int count;
+};
+
+// Paces columns onto a ColumnOutput, one per clock edge. The clock's
+// interrupt only counts edges and wakes whoever calls on_edges(), which
+// queues the column due and returns without waiting for the bus, so a
+// transfer never holds up the interrupt or the next edge. Each column is
+// queued whole or not at all: with depth() transfers still in flight the
+// bus has fallen behind, and the column is dropped as an overrun rather
+// than delaying every one after it. Edges that passed before a wakeup
+// are missed columns, skipped so the one sent is the one due now.
+//
+// Columns still queued when a revolution ends point into the bank it was
+// sent from, so that bank is not the caller's again at the wrap, but once
+// every transfer queued before it has been reaped, a few columns later.
+//
+// on_edges() must be called from one thread; the counters may be read
+// from any.
+template <int W>
+class ColumnSender {
+ public:
+  explicit ColumnSender(ColumnOutput& out)
+      : out_(out),
+        x_(0),
+        in_flight_(0),
+        draining_(0),
+        drained_(true),
+        sent_(0),
+        missed_(0),
+        overruns_(0) {}
+
+  ColumnSender(const ColumnSender&) = delete;
+  ColumnSender& operator=(const ColumnSender&) = delete;
+
+  // For edges clock edges since the last call. fill(x, transfers) adds the
+  // transfers for column x. on_wrap() is called at the end of each
+  // revolution, before the first column of the next is filled, and
+  // on_drained() once every transfer queued before it has been reaped.
+  // Wraps closer together than that share one on_drained().
+  template <typename Fill, typename OnWrap, typename OnDrained>
+  void on_edges(uint32_t edges, Fill&& fill, OnWrap&& on_wrap,
+                OnDrained&& on_drained) {
+    if (!edges) {
+      return;
+    }
+    for (uint32_t i = 1; i < edges; ++i) {
+      missed_.fetch_add(1, std::memory_order_relaxed);
+      advance(on_wrap, on_drained);
+    }
+    auto reaped = out_.reap();
+    in_flight_ -= reaped;
+    if (!drained_) {
+      draining_ -= std::min(reaped, draining_);
+      if (!draining_) {
+        drained_ = true;
+        on_drained();
+      }
+    }
+    ColumnTransfers t;
+    fill(x_, t);
+    if (in_flight_ + t.count > out_.depth()) {
+      overruns_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      for (int i = 0; i < t.count; ++i) {
+        out_.queue(t.data[i], t.size[i]);
+      }
+      in_flight_ += t.count;
+      sent_.fetch_add(1, std::memory_order_relaxed);
+    }
+    advance(on_wrap, on_drained);
+  }
+
+  // Column due at the next edge
+  int x() const { return x_; }
+  size_t in_flight() const { return in_flight_; }
+  uint32_t sent() const { return sent_.load(std::memory_order_relaxed); }
+  uint32_t missed() const { return missed_.load(std::memory_order_relaxed); }
+  uint32_t overruns() const {
+    return overruns_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  template <typename OnWrap, typename OnDrained>
+  void advance(OnWrap& on_wrap, OnDrained& on_drained) {
+    if (++x_ == W) {
+      x_ = 0;
+      on_wrap();
+      draining_ = in_flight_;
+      drained_ = !draining_;
+      if (drained_) {
+        on_drained();
+      }
+    }
+  }
+
+  ColumnOutput& out_;
+  int x_;
+  size_t in_flight_;
+  // Transfers queued before the last wrap still to be reaped, and whether
+  // on_drained() has been called since
+  size_t draining_;
+  bool drained_;
+  // Columns queued, edges that passed without a wakeup, and columns
+  // dropped with the bus behind
+  std::atomic<uint32_t> sent_;
+  std::atomic<uint32_t> missed_;
+  std::atomic<uint32_t> overruns_;
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#if defined(ASIO_STANDALONE) || defined(ESP_PLATFORM)
+#include "asio.hpp"
+#else
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+#endif
+
+#include "LEDCommon/Protocol.h"
+#include "LEDCommon/SliceCodec.h"
+#include "RingBuffer.h"
+
+// Streaming receive path into a jitter buffer ring. One read is kept
+// outstanding on the stream, and whatever it returns is parsed for as many
+// frames as it completes, each checked and published to the ring on the
+// spot, so frames cost a read completion between them rather than two
+// each.
+//
+// Uncoded slices arrive laid out exactly as a Slot, a FrameHeader followed
+// by the payload, so they are read straight into the ring's free slots, as
+// many at once as are free and contiguous. Coded ones are read into a
+// staging buffer, as many as fit, and decoded from there into their slots
+// against the one decoded before.
+//
+// All of the reader's work, and the Handler's, runs on the stream's
+// executor, which must be single threaded:
+//
+//   bool on_frame(Slot& slot, size_t wire_bytes)
+//     A frame passed its checks and is about to be published. Returning
+//     false drops it.
+//   void on_primed()
+//     The ring holds prime_level frames, once per start().
+//   void on_error(const std::string& what)
+//     The stream failed or fell out of sync. Reading stops.
+//
+// When the ring is full the reader parks, and the consumer calls wake()
+// after releasing slots, from any thread, which costs nothing unless the
+// reader is parked.
+template <typename Stream, typename Slot, int D, typename Handler>
+class FrameReader {
+ public:
+  typedef RingBuffer<Slot, D> Ring;
+
+  static const size_t PAYLOAD = sizeof(Slot::payload);
+  static_assert(sizeof(Slot) == sizeof(FrameHeader) + PAYLOAD,
+                "slots must be laid out as frames are sent");
+
+  FrameReader(Stream& stream, Handler& handler, WireFormat format,
+              WireCodec codec)
+      : stream_(stream),
+        handler_(handler),
+        format_(format),
+        staging_size_(codec == WireCodec::NONE
+                          ? 0
+                          : sizeof(FrameHeader) + max_coded_size(PAYLOAD)),
+        staging_(staging_size_ ? new uint8_t[staging_size_] : nullptr),
+        ring_(nullptr),
+        gen_(0),
+        active_(false),
+        reading_(false),
+        paused_(false),
+        parked_(false),
+        reads_(0),
+        frames_(0) {
+    reset();
+  }
+
+  FrameReader(const FrameReader&) = delete;
+  FrameReader& operator=(const FrameReader&) = delete;
+
+  // Reads into ring from the start of a frame, as on a new connection. On
+  // the executor.
+  void start(Ring& ring, size_t prime_level) {
+    ring_ = &ring;
+    prime_level_ = prime_level;
+    ++gen_;
+    reset();
+    active_ = true;
+    reading_ = false;
+    parked_ = false;
+    pump();
+  }
+
+  // Stops reading, leaving what is buffered unparsed. On the executor.
+  void stop() {
+    ++gen_;
+    active_ = false;
+    reading_ = false;
+  }
+
+  // Holds off further reads, as a client too busy to read would, and
+  // resumes them. On the executor.
+  void set_paused(bool paused) {
+    paused_ = paused;
+    if (!paused_ && active_ && !reading_) {
+      pump();
+    }
+  }
+
+  void wake() {
+    if (parked_.exchange(false, std::memory_order_acq_rel)) {
+      asio::post(stream_.get_executor(), [this]() {
+        if (active_ && !reading_) {
+          pump();
+        }
+      });
+    }
+  }
+
+  // Read completions and frames parsed, since construction
+  uint64_t reads() const { return reads_; }
+  uint64_t frames() const { return frames_; }
+
+ private:
+  enum Parse {
+    NEED_DATA,
+    NO_SLOT,
+    FAILED,
+  };
+
+  void reset() {
+    slot_ = nullptr;
+    filled_ = 0;
+    begin_ = 0;
+    end_ = 0;
+    ref_ = nullptr;
+    primed_ = false;
+  }
+
+  static uint8_t* payload(Slot* slot) {
+    return reinterpret_cast<uint8_t*>(slot->payload);
+  }
+
+  // Parses what has been read, then reads more, or parks if there is no
+  // slot to put it in
+  void pump() {
+    while (true) {
+      auto p = staging_ ? parse_staged() : parse_direct();
+      if (p == FAILED) {
+        return;
+      }
+      if (p == NEED_DATA && !paused_) {
+        read();
+        return;
+      }
+      reading_ = false;
+      if (p == NEED_DATA) {
+        return;
+      }
+      parked_.store(true, std::memory_order_release);
+      // The consumer may have released a slot before seeing parked_, in
+      // which case nobody will wake us
+      size_t count;
+      if (!ring_->reserve(count) ||
+          !parked_.exchange(false, std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+  }
+
+  void read() {
+    uint8_t* dst;
+    size_t len;
+    if (staging_) {
+      dst = staging_.get() + end_;
+      len = staging_size_ - end_;
+    } else {
+      size_t count;
+      slot_ = ring_->reserve(count);
+      dst = reinterpret_cast<uint8_t*>(slot_) + filled_;
+      len = count * sizeof(Slot) - filled_;
+    }
+    reading_ = true;
+    stream_.async_read_some(
+        asio::buffer(dst, len),
+        [this, gen = gen_](const auto& ec, size_t bytes) {
+          if (ec == asio::error::operation_aborted || gen != gen_) {
+            return;
+          }
+          if (ec) {
+            fail("read error: " + ec.message());
+            return;
+          }
+          ++reads_;
+          if (staging_) {
+            end_ += bytes;
+          } else {
+            filled_ += bytes;
+          }
+          pump();
+        });
+  }
+
+  // Frames read in place, from slot_ on, filled_ bytes of them
+  Parse parse_direct() {
+    while (slot_ && filled_ >= sizeof(FrameHeader)) {
+      auto& h = slot_->header;
+      if (!check_header(h, format_, PAYLOAD) || h.length != PAYLOAD) {
+        return fail("bad frame header, stream out of sync");
+      }
+      if (filled_ < sizeof(Slot)) {
+        break;
+      }
+      if (!check_payload(h, payload(slot_))) {
+        return fail("CRC mismatch on frame " + std::to_string(h.frame_num));
+      }
+      filled_ -= sizeof(Slot);
+      if (publish(*slot_, sizeof(Slot))) {
+        ++slot_;
+      } else {
+        memmove(slot_, slot_ + 1, filled_);
+      }
+    }
+    size_t count;
+    return ring_->reserve(count) ? NEED_DATA : NO_SLOT;
+  }
+
+  // Frames read into staging_, from begin_ to end_
+  Parse parse_staged() {
+    auto max_length = staging_size_ - sizeof(FrameHeader);
+    while (end_ - begin_ >= sizeof(FrameHeader)) {
+      FrameHeader h;
+      memcpy(&h, staging_.get() + begin_, sizeof(h));
+      if (!check_header(h, format_, max_length)) {
+        return fail("bad frame header, stream out of sync");
+      }
+      auto size = sizeof(h) + h.length;
+      if (end_ - begin_ < size) {
+        break;
+      }
+      auto slot = ring_->reserve();
+      if (!slot) {
+        return NO_SLOT;
+      }
+      auto coded = staging_.get() + begin_ + sizeof(h);
+      if (!check_payload(h, coded)) {
+        return fail("CRC mismatch on frame " + std::to_string(h.frame_num));
+      }
+      slot->header = h;
+      if (!slice_decode(coded, h.length, ref_, payload(slot), PAYLOAD)) {
+        return fail("can't decode frame " + std::to_string(h.frame_num));
+      }
+      slot->header.length = PAYLOAD;
+      ref_ = payload(slot);
+      begin_ += size;
+      publish(*slot, size);
+    }
+    // Make room for the rest of the frame started, moving it to the front
+    // only when it would not fit behind
+    if (begin_ == end_) {
+      begin_ = end_ = 0;
+    } else {
+      size_t need = sizeof(FrameHeader);
+      if (end_ - begin_ >= need) {
+        FrameHeader h;
+        memcpy(&h, staging_.get() + begin_, sizeof(h));
+        need += h.length;
+      }
+      if (begin_ + need > staging_size_) {
+        memmove(staging_.get(), staging_.get() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+      }
+    }
+    return NEED_DATA;
+  }
+
+  bool publish(Slot& slot, size_t wire_bytes) {
+    ++frames_;
+    if (!handler_.on_frame(slot, wire_bytes)) {
+      return false;
+    }
+    ring_->push();
+    if (!primed_ && ring_->level() >= prime_level_) {
+      primed_ = true;
+      handler_.on_primed();
+    }
+    return true;
+  }
+
+  Parse fail(const std::string& what) {
+    stop();
+    handler_.on_error(what);
+    return FAILED;
+  }
+
+  Stream& stream_;
+  Handler& handler_;
+  WireFormat format_;
+  size_t staging_size_;
+  std::unique_ptr<uint8_t[]> staging_;
+  Ring* ring_;
+  size_t prime_level_;
+  bool primed_;
+  // Bumped by start() and stop(), so completions of reads started before
+  // are ignored
+  uint32_t gen_;
+  bool active_;
+  bool reading_;
+  bool paused_;
+  std::atomic<bool> parked_;
+  // Uncoded: the slot being filled, the next to publish, and the bytes read
+  // from its start on, which may run into the slots after it
+  Slot* slot_;
+  size_t filled_;
+  // Coded: unparsed bytes in staging_, and the payload last decoded
+  size_t begin_;
+  size_t end_;
+  const uint8_t* ref_;
+  uint64_t reads_;
+  uint64_t frames_;
+};
@@ -1,12 +1,62 @@
 #pragma once
+#include <type_traits>
+
+#include "LEDCommon/APA102.h"
+#include "LEDCommon/Protocol.h"
 #include "RingBuffer.h"
-#include "SPI.h"
 #include "Types.h"
 
 
 const int JITTER_BUFFER_DEPTH = 16;
+// Frames buffered before playback starts, and the range the playout target
+// adapts within, see Playout.h. One slot is left for the frame on display.
+const int JITTER_START_LEVEL = 3;
+const int JITTER_MIN_DEPTH = 2;
+const int JITTER_MAX_DEPTH = JITTER_BUFFER_DEPTH - 1;
 const int W = 288;
 const int H = 144;
 const int STRIP_H = 48;
 
-typedef RingBuffer<RGB[W * STRIP_H], JITTER_BUFFER_DEPTH> JitterBuffer;
\ No newline at end of file
+// Slice encoding requested from the server. APA102 slices are transmitted to
+// the strip straight out of the jitter buffer; the others are expanded into
+// DMA column buffers each time the frame advances. RGB565 and PALETTE8 take
+// a half and a third of the bandwidth of RAW_BGR, for a little precision
+// and a pass through a lookup table on the client.
+const WireFormat WIRE_FORMAT = WireFormat::APA102;
+
+// Payload compression requested from the server. Coded payloads are read
+// into a staging buffer and decoded into their slot, against the slot
+// decoded before it; uncoded ones are read in place, see FrameReader.h.
+const WireCodec WIRE_CODEC = WireCodec::DELTA_RLE;
+
+const size_t PALETTE_SIZE = 256;
+
+typedef APA102Column<STRIP_H> Column;
+
+// Payload layout of a slice in each format, see Protocol.h
+template <WireFormat F>
+struct SliceOf {
+  typedef RGB type[W * STRIP_H];
+};
+template <>
+struct SliceOf<WireFormat::APA102> {
+  typedef uint8_t type[W * Column::SIZE];
+};
+template <>
+struct SliceOf<WireFormat::RGB565> {
+  typedef uint8_t type[W * STRIP_H * 2];
+};
+template <>
+struct SliceOf<WireFormat::PALETTE8> {
+  typedef uint8_t type[1 + PALETTE_SIZE * 3 + W * STRIP_H];
+};
+
+typedef SliceOf<WIRE_FORMAT>::type Slice;
+
+// A received frame: its header, then the payload it describes
+struct JitterSlot {
+  FrameHeader header;
+  Slice payload;
+};
+
+typedef RingBuffer<JitterSlot, JITTER_BUFFER_DEPTH> JitterBuffer;
\ No newline at end of file
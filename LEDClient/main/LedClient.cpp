@@ -17,17 +17,45 @@ const char* TAG = "LedClient";
 const char* SERVER_ADDR = "10.10.10.1";
 const int SERVER_PORT = 5050;
 std::unique_ptr<LEDClient> led_client;
+
+// Column buffers for a bank, unless slices are shown in place
+APA102Frame<STRIP_H>* make_bank(
+    std::unique_ptr<APA102Frame<STRIP_H>[]>& frames) {
+  if (WIRE_FORMAT != WireFormat::APA102) {
+    frames.reset(new APA102Frame<STRIP_H>[W]);
+  }
+  return frames.get();
+}
 }  // namespace
 
 LEDClient::LEDClient() : 
   state_(STOPPED), 
-  x_(0),
+  loaded_(make_bank(frames_[0]), make_bank(frames_[1])),
+  // blank until the first frame is staged
+  in_place_(nullptr, nullptr),
+  fill_x_(W),
+  pending_(false),
+  staged_at_(0),
+  blank_((uint8_t*)heap_caps_malloc(Column::SIZE,
+                                    MALLOC_CAP_DMA | MALLOC_CAP_32BIT)),
+  showing_(false),
+  missed_columns_(0),
+  overrun_columns_(0),
+  rotation_us_(0),
+  last_rev_us_(0),
   led_clock_(new SquareWaveGenerator<W * 16, PIN_CLOCK_GEN>()),
   bufs_(new JitterBuffer()),
-  read_pending_(false),
-  dropped_frames_(0) 
+  playout_(JITTER_START_LEVEL, JITTER_MIN_DEPTH, JITTER_MAX_DEPTH),
+  dropped_frames_(0),
+  shown_frame_(0),
+  synced_(false),
+  underruns_(0),
+  skipped_frames_(0)
 {
   assert(bufs_);
+  assert(blank_);
+  uint8_t black[STRIP_H * 3] = {};
+  Column::encode(black, blank_);
   esp_timer_create_args_t args;
   args.callback = &LEDClient::handle_connect_timer;
   args.arg = this;
@@ -35,11 +63,12 @@ LEDClient::LEDClient() :
   args.name = "connect_timer";
   ERR_THROW(esp_timer_create(&args, &connect_timer_));
 
-  args.callback = &LEDClient::handle_prefetch_timer;
+  args.callback = &LEDClient::handle_telemetry_timer;
   args.arg = this;
   args.dispatch_method = ESP_TIMER_TASK;
-  args.name = "prefetch_timer";
-  ERR_THROW(esp_timer_create(&args, &prefetch_timer_));
+  args.name = "telemetry_timer";
+  ERR_THROW(esp_timer_create(&args, &telemetry_timer_));
+  ERR_THROW(esp_timer_start_periodic(telemetry_timer_, 250000));
   ERR_THROW(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
                                        LEDClient::handle_event, this));
   ERR_THROW(esp_event_handler_register(LED_EVENT, ESP_EVENT_ANY_ID,
@@ -52,8 +81,8 @@ LEDClient::LEDClient() :
 LEDClient::~LEDClient() {
   stop_connect_timer();
   ERR_LOG("esp_timer_delete", esp_timer_delete(connect_timer_));
-  stop_prefetch_timer();
-  ERR_LOG("esp_timer_delete", esp_timer_delete(prefetch_timer_));
+  ERR_LOG("esp_timer_stop", esp_timer_stop(telemetry_timer_));
+  ERR_LOG("esp_timer_delete", esp_timer_delete(telemetry_timer_));
   stop_gpio();
   if (led_task_) {
     vTaskDelete(led_task_);
@@ -61,14 +90,11 @@ LEDClient::~LEDClient() {
   if (io_task_) {
     vTaskDelete(io_task_);
   }
+  heap_caps_free(blank_);
 }
 
 void LEDClient::start() { wifi_.start(); }
 
-void IRAM_ATTR LEDClient::send_pixels() {
-  *spi_ << frame_[x_];
-}
-
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void LEDClient::run_io(void* arg) {
@@ -80,23 +106,60 @@ void LEDClient::run_io(void* arg) {
 void IRAM_ATTR LEDClient::run_leds(void* arg) {
   auto c = reinterpret_cast<LEDClient*>(arg);
   c->spi_.reset(new SPI());
+  c->sender_.reset(new ColumnSender<W>(*c->spi_));
+  // The clock ISR notifies this task, possibly before the handle is stored
+  // by whoever created it
+  c->led_task_ = xTaskGetCurrentTaskHandle();
   c->stop_gpio();
   c->start_gpio();
   ets_isr_mask(1ULL << XT_TIMER_INTNUM);
-  while (true) {}
+  while (true) {
+    // Clock edges since the last wakeup, more than one if columns were
+    // missed
+    c->send_columns(ulTaskNotifyTake(pdTRUE, portMAX_DELAY));
+  }
 }
 
 void IRAM_ATTR LEDClient::on_clock_isr(void* arg) {
   auto c = reinterpret_cast<LEDClient*>(arg);
-  c->send_pixels();
-  if (++c->x_ == W) {
-    c->x_ = 0;
-    int yield = 0;
-    esp_event_isr_post(LED_EVENT, LED_EVENT_NEED_FRAME, NULL, 0, &yield);
-    if (yield) {
-      portYIELD_FROM_ISR();
-    }
+  BaseType_t yield = pdFALSE;
+  vTaskNotifyGiveFromISR(c->led_task_, &yield);
+  if (yield) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+void IRAM_ATTR LEDClient::send_columns(uint32_t edges) {
+  sender_->on_edges(
+      edges,
+      [this](int x, ColumnTransfers& t) {
+        if constexpr (WIRE_FORMAT == WireFormat::APA102) {
+          auto columns = in_place_.front();
+          t.add(columns ? columns + x * Column::SIZE : blank_, Column::SIZE);
+          t.add(blank_, Column::SIZE);
+        } else {
+          auto& column = loaded_.front()[x];
+          t.add(column.data(), column.size());
+        }
+      },
+      [this]() { on_revolution(); },
+      // The bank just taken off display is no longer read by the bus, so
+      // the frame loop may release or refill it
+      []() { esp_event_post(LED_EVENT, LED_EVENT_NEED_FRAME, NULL, 0, 0); });
+}
+
+void IRAM_ATTR LEDClient::on_revolution() {
+  // The frame on display only changes here, between revolutions
+  if constexpr (WIRE_FORMAT == WireFormat::APA102) {
+    in_place_.flip();
+  } else {
+    loaded_.flip();
+  }
+  auto now = esp_timer_get_time();
+  if (last_rev_us_) {
+    rotation_us_ = now - last_rev_us_;
   }
+  last_rev_us_ = now;
 }
 
 void LEDClient::dump_event(void* arg, esp_event_base_t base, int32_t id,
@@ -137,6 +200,9 @@ void LEDClient::state_stopped(esp_event_base_t base, int32_t id, void* data) {
       state_ = READY;
       on_got_ip();
       break;
+    case LED_EVENT_TELEMETRY_TIMER:
+      // nothing to report before we connect
+      break;
     default:
       ESP_LOGW(TAG, "Unhandled event id: %d", id);
   }
@@ -153,13 +219,18 @@ void LEDClient::state_ready(esp_event_base_t base, int32_t id, void* data) {
     case LED_EVENT_CONN_ACTIVE:
       ESP_LOGI(TAG, "State transition: %s -> %s on %d", "READY", "PREFETCH", id);
       state_ = PREFETCH;
-      start_prefetch_timer();
-      read_pending_ = true;
-      connection_->read_frame(*bufs_);
+      playout_.reset();
+      connection_->start_reading(*bufs_, JITTER_START_LEVEL);
       break;
     case LED_EVENT_NEED_FRAME:
       // ignore clock before we are active
       break;
+    case LED_EVENT_FILL_COLUMNS:
+      // a frame load cut short when the connection dropped
+      break;
+    case LED_EVENT_TELEMETRY_TIMER:
+      // nothing to report before we connect
+      break;
     default:
       ESP_LOGW(TAG, "Unhandled event id: %d", id);
   }
@@ -175,31 +246,22 @@ void LEDClient::state_prefetch(esp_event_base_t base, int32_t id, void* data) {
     case LED_EVENT_CONN_ERR:
       ESP_LOGI(TAG, "State transition: %s -> %s on %d", "PREFETCH", "READY", id);
       state_ = READY;
-      stop_prefetch_timer();
       on_conn_err();
       break;
-    case LED_EVENT_PREFETCH_TIMER:
-      if (bufs_->level() == bufs_->depth()) {
-        ESP_LOGI(TAG, "State transition: %s -> %s on %d", "PREFETCH", "ACTIVE", id);
-        state_ = ACTIVE;
-        advance_frame();
-        xTaskCreatePinnedToCore(LEDClient::run_leds, "LED_LOOP", 2048, this,
-                                configMAX_PRIORITIES - 1, &led_task_, 1);
-//        gpio_intr_enable(PIN_CLOCK_READ);
-      } else {
-        start_prefetch_timer();
-      }
-      break;
     case LED_EVENT_NEED_FRAME:
       // ignore clock before we are active
       break;
-    case LED_EVENT_READ_COMPLETE:
-read_pending_ = false;
-if (bufs_->level() < bufs_->depth()) {
-  read_pending_ = true;
-  connection_->read_frame(*bufs_);
-}
-break;
+    case LED_EVENT_PRIMED:
+      ESP_LOGI(TAG, "State transition: %s -> %s on %d", "PREFETCH", "ACTIVE", id);
+      state_ = ACTIVE;
+      advance_frame();
+      xTaskCreatePinnedToCore(LEDClient::run_leds, "LED_LOOP", 4096, this,
+                              configMAX_PRIORITIES - 1, &led_task_, 1);
+//      gpio_intr_enable(PIN_CLOCK_READ);
+      break;
+    case LED_EVENT_TELEMETRY_TIMER:
+      send_telemetry();
+      break;
     default:
       ESP_LOGW(TAG, "Unhandled event id: %d", id);
   }
@@ -220,12 +282,11 @@ void LEDClient::state_active(esp_event_base_t base, int32_t id, void* data) {
   case LED_EVENT_NEED_FRAME:
     advance_frame();
     break;
-  case LED_EVENT_READ_COMPLETE:
-    read_pending_ = false;
-    if (bufs_->level() < bufs_->depth()) {
-      read_pending_ = true;
-      connection_->read_frame(*bufs_);
-    }
+  case LED_EVENT_FILL_COLUMNS:
+    fill_columns(FILL_COLUMNS);
+    break;
+  case LED_EVENT_TELEMETRY_TIMER:
+    send_telemetry();
     break;
   default:
     ESP_LOGW(TAG, "Unhandled event id: %d", id);
@@ -236,6 +297,10 @@ void LEDClient::on_got_ip() {
   try {
     ESP_LOGI(TAG, "Resetting client connection on IP change");
     dropped_frames_ = 0;
+    synced_ = false;
+    underruns_ = 0;
+    skipped_frames_ = 0;
+    fill_x_ = W;
     connection_.reset(new ServerConnection(
       ctx_,
       ntohl(wifi_.ip()), 
@@ -251,6 +316,10 @@ void LEDClient::on_got_ip() {
 void LEDClient::on_conn_err() {
   connection_.reset();
   dropped_frames_ = 0;
+  synced_ = false;
+  underruns_ = 0;
+  skipped_frames_ = 0;
+  fill_x_ = W;
   start_connect_timer();
 }
 
@@ -273,57 +342,180 @@ void LEDClient::handle_connect_timer(void* arg) {
     c->wifi_.mac_address()));
 }
 
-void LEDClient::start_prefetch_timer() {
-  ESP_LOGI(TAG, "Waiting for frame prefetch to complete...");
-  ERR_THROW(esp_timer_start_once(prefetch_timer_, 500000));
+void LEDClient::handle_telemetry_timer(void* arg) {
+  esp_event_post(LED_EVENT, LED_EVENT_TELEMETRY_TIMER, NULL, 0, 0);
 }
 
-void LEDClient::stop_prefetch_timer() {
-  ESP_LOGI(TAG, "Stopping prefetch_timer...");
-  ERR_LOG("esp_timer_stop", esp_timer_stop(prefetch_timer_));
+void LEDClient::send_telemetry() {
+  Telemetry t;
+  t.buffer_level = bufs_->level();
+  t.buffer_depth = playout_.target();
+  t.shown_frame = shown_frame_;
+  t.rotation_us = rotation_us_;
+  t.dropped_frames = dropped_frames_;
+  t.underruns = underruns_;
+  t.skipped_frames = skipped_frames_;
+  seal(t);
+  connection_->send_telemetry(t);
+  if (sender_) {
+    auto missed = sender_->missed();
+    auto overruns = sender_->overruns();
+    if (missed != missed_columns_ || overruns != overrun_columns_) {
+      ESP_LOGW(TAG, "Columns missed: %u, overrun: %u",
+               unsigned(missed - missed_columns_),
+               unsigned(overruns - overrun_columns_));
+      missed_columns_ = missed;
+      overrun_columns_ = overruns;
+    }
+  }
 }
 
-void LEDClient::handle_prefetch_timer(void* arg) {
-  esp_event_post(LED_EVENT, LED_EVENT_PREFETCH_TIMER, NULL, 0, 0);
+// Times the frames that arrived since the last advance. Frames are read
+// on the IO task without waking this one, which catches up here.
+void LEDClient::feed_playout() {
+  auto& log = connection_->arrivals();
+  while (log.level()) {
+    auto& a = log.front();
+    playout_.on_arrival(a.frame_num, a.pts_us, a.arrival_us);
+    log.pop();
+  }
 }
 
 void LEDClient::advance_frame() {
   assert(connection_);
-  if (bufs_->level()) {
-    if (bufs_->level() < bufs_->depth()) {
-      ESP_LOGW(TAG, "jitter buffer level: %d/%d",
-               bufs_->level(), bufs_->depth());    
+  feed_playout();
+  // The frame chosen last revolution is not on display yet: its load ran
+  // late, or this event did. It goes up at the next flip instead of this
+  // one, and the next frame waits for it.
+  if (fill_x_ < W) {
+    ESP_LOGW(TAG, "Frame load late at column %d", fill_x_);
+    fill_columns(W);
+    return;
+  }
+  if (in_place_.staged() || loaded_.staged()) {
+    ESP_LOGW(TAG, "Frame advance late, staged frame not on display yet");
+    return;
+  }
+  // APA102 slices are shown in place, so the frame on display holds the
+  // front of the buffer and the next one is chosen from those after it.
+  // Once the LED task has flipped to the one staged, and reaped every
+  // transfer sent from the one before, everything before it goes.
+  size_t held = 0;
+  if constexpr (WIRE_FORMAT == WireFormat::APA102) {
+    if (pending_) {
+      bufs_->skip(staged_at_);
+      pending_ = false;
+      showing_ = true;
     }
-    ESP_LOGD(TAG, "Frame advanced -> jitter buffer level: %d/%d",
-             bufs_->level(), bufs_->depth());
-
-    // Catch up if we have extra frames available
-    int ffwd = bufs_->ffwd(dropped_frames_);
-    if (ffwd) {
-      dropped_frames_ -= ffwd;
+    held = showing_ ? 1 : 0;
+  }
+  if (bufs_->level() > held) {
+    auto level = bufs_->level() - held;
+    if (level < playout_.target()) {
+      ESP_LOGW(TAG, "jitter buffer level: %d/%d", level, playout_.target());
+    }
+    ESP_LOGD(TAG, "Frame advanced -> jitter buffer level: %d/%d", level,
+             playout_.target());
+
+    // Each tick that found no frame pushed the schedule back by one, so
+    // frames numbered before the one due now are late. The playout decides
+    // how many of them to skip, and whether the buffer is deep enough to
+    // lose one more.
+    uint64_t due = shown_frame_ + 1 + dropped_frames_;
+    int skipped = 0;
+    if (synced_) {
+      skipped = playout_.skip_count(
+          level, shown_frame_, due,
+          [this, held](size_t i) {
+            return bufs_->at(held + i).header.frame_num;
+          });
+    }
+    skipped_frames_ += skipped;
+    if (skipped) {
       ESP_LOGW(TAG, "Caught up by %d frames -> jitter buffer level: %d/%d",
-               ffwd, bufs_->level(), bufs_->depth());
+               skipped, level - skipped, playout_.target());
     }
-    // load and pop front frame
-    for (int i = 0; i < W; ++i) {
-      frame_[i].load(bufs_->front() + i * STRIP_H);
+    auto& slot = bufs_->at(held + skipped);
+    auto num = slot.header.frame_num;
+    if (synced_ && num <= shown_frame_) {
+      ESP_LOGW(TAG, "Frame number went back from %llu to %llu, resyncing",
+               shown_frame_, num);
+    } else if (synced_ && num > due + skipped) {
+      ESP_LOGW(TAG, "Server skipped %llu frames", num - due - skipped);
     }
-    bufs_->pop();
-    // Backfill popped frames
-    if (!read_pending_) {
-      read_pending_ = true;
-      connection_->read_frame(*bufs_);
+    // A late frame left in the buffer is shown late: the schedule moves
+    // back to it
+    dropped_frames_ = 0;
+    shown_frame_ = num;
+    synced_ = true;
+    if constexpr (WIRE_FORMAT == WireFormat::APA102) {
+      // display in place from the next revolution
+      in_place_.back() = reinterpret_cast<const uint8_t*>(slot.payload);
+      in_place_.stage();
+      pending_ = true;
+      staged_at_ = held + skipped;
+    } else {
+      // release skipped frames, and load the next one from the front
+      bufs_->skip(skipped);
+      fill_x_ = 0;
+      fill_columns(FILL_COLUMNS);
     }
+    // Backfill released frames
+    connection_->resume_reading();
   }
   else {
     dropped_frames_++;
+    underruns_++;
+    playout_.on_underrun();
     ESP_LOGE(TAG, "Frame dropped (%d)", dropped_frames_);
-    if (dropped_frames_ > 16 * 10) {
+    if (dropped_frames_ > MAX_DROPPED_FRAMES) {
         assert(0);
     }
   }
 }
 
+// Loads up to n more columns of the frame at the front of the buffer into
+// the back bank, continuing on a later event until the frame is complete,
+// then stages it and releases its slot
+void LEDClient::fill_columns(int n) {
+  if (fill_x_ >= W) {
+    return;
+  }
+  auto payload = reinterpret_cast<const uint8_t*>(bufs_->front().payload);
+  auto bank = loaded_.back();
+  auto end = std::min(fill_x_ + n, W);
+  if constexpr (WIRE_FORMAT == WireFormat::RGB565) {
+    for (; fill_x_ < end; ++fill_x_) {
+      bank[fill_x_].load_rgb565(payload + fill_x_ * STRIP_H * 2);
+    }
+  } else if constexpr (WIRE_FORMAT == WireFormat::PALETTE8) {
+    auto palette = payload + 1;
+    if (fill_x_ == 0) {
+      for (int c = 0; c <= payload[0]; ++c) {
+        auto e = palette + c * 3;
+        palette_lut_[c] = 0xffu | e[0] << 8 | e[1] << 16 |
+                          static_cast<uint32_t>(e[2]) << 24;
+      }
+    }
+    auto indices = palette + PALETTE_SIZE * 3;
+    for (; fill_x_ < end; ++fill_x_) {
+      bank[fill_x_].load_indexed(indices + fill_x_ * STRIP_H, palette_lut_);
+    }
+  } else {
+    auto pixels = reinterpret_cast<const RGB*>(payload);
+    for (; fill_x_ < end; ++fill_x_) {
+      bank[fill_x_].load(pixels + fill_x_ * STRIP_H);
+    }
+  }
+  if (fill_x_ < W) {
+    ERR_THROW(esp_event_post(LED_EVENT, LED_EVENT_FILL_COLUMNS, NULL, 0, 0));
+    return;
+  }
+  loaded_.stage();
+  bufs_->pop();
+  connection_->resume_reading();
+}
+
 void LEDClient::start_gpio() {
   try {
     ESP_LOGI(TAG, "Starting GPIO");
@@ -3,7 +3,9 @@
 #include <sstream>
 
 #include "App.h"
+#include "ColumnBanks.h"
 #include "LEDC.h"
+#include "Playout.h"
 #include "Types.h"
 #include "ServerConnection.h"
 #include "SPI.h"
@@ -16,9 +18,10 @@ ESP_EVENT_DECLARE_BASE(LED_EVENT);
 enum {
   LED_EVENT_CONN_ERR = 10000,
   LED_EVENT_CONN_ACTIVE = 10001,
-  LED_EVENT_PREFETCH_TIMER = 10002,
   LED_EVENT_NEED_FRAME = 10003,
-  LED_EVENT_READ_COMPLETE = 10004,
+  LED_EVENT_PRIMED = 10004,
+  LED_EVENT_TELEMETRY_TIMER = 10005,
+  LED_EVENT_FILL_COLUMNS = 10006,
 };
 
 class LEDClient : public esp::App {
@@ -26,7 +29,6 @@ class LEDClient : public esp::App {
   LEDClient();
   ~LEDClient();
   void start();
-  void send_pixels();
 
  private:
 
@@ -39,26 +41,62 @@ class LEDClient : public esp::App {
 
   static const gpio_num_t PIN_CLOCK_GEN = GPIO_NUM_25;
   static const gpio_num_t PIN_CLOCK_READ = GPIO_NUM_26;
+  // Columns loaded per LED_EVENT_FILL_COLUMNS, so other events get a turn
+  static const int FILL_COLUMNS = 32;
 
   State state_;
   esp::WifiClient wifi_;
-  std::unique_ptr<ServerConnection> connection_;
+  std::shared_ptr<ServerConnection> connection_;
   esp_timer_handle_t connect_timer_;
-  esp_timer_handle_t prefetch_timer_;
-  APA102Frame<STRIP_H> frame_[W];
+  esp_timer_handle_t telemetry_timer_;
+  // The LED task sends from a front bank and flips to the back one between
+  // revolutions once the frame loop stages it, see ColumnBanks.h. Other
+  // slices are loaded into the column buffers of loaded_'s back bank a few
+  // columns at a time. APA102 slices are sent from the jitter buffer:
+  // in_place_'s back bank points at the slot staged, and the frame on
+  // display stays at the buffer's front until the LED task flips past it
+  // and its last columns are off the bus.
+  std::unique_ptr<APA102Frame<STRIP_H>[]> frames_[2];
+  ColumnBanks<APA102Frame<STRIP_H>> loaded_;
+  ColumnBanks<const uint8_t> in_place_;
+  // Column of the frame at the buffer's front loaded so far, W when done
+  int fill_x_;
+  // APA102: offset in the buffer of the slot staged, until it is on display
+  bool pending_;
+  size_t staged_at_;
+  // LED frames for the palette of the PALETTE8 slice being loaded
+  uint32_t palette_lut_[PALETTE_SIZE];
+  uint8_t* blank_;
+  bool showing_;
   std::unique_ptr<SPI> spi_;
-  volatile uint32_t x_;
+  // The clock ISR wakes the LED task, which queues the column due
+  std::unique_ptr<ColumnSender<W>> sender_;
+  // Sender counts last logged
+  uint32_t missed_columns_;
+  uint32_t overrun_columns_;
+  // Revolution period measured between column 0 clocks
+  volatile uint32_t rotation_us_;
+  int64_t last_rev_us_;
   TaskHandle_t led_task_;
   asio::io_context ctx_;
   TaskHandle_t io_task_;
   std::unique_ptr<SquareWaveGenerator<W * 16, PIN_CLOCK_GEN>> led_clock_;
   std::unique_ptr<JitterBuffer> bufs_;
-  bool read_pending_;
+  Playout playout_;
+  // Ticks that found no frame to show and have not been caught up yet
   uint32_t dropped_frames_;
+  // Number of the frame on display, once the first one is shown
+  uint64_t shown_frame_;
+  bool synced_;
+  // Reported to the server, since connecting
+  uint32_t underruns_;
+  uint32_t skipped_frames_;
 
   static void run_io(void* arg);
   static void run_leds(void* arg);
   static void on_clock_isr(void* arg);
+  void send_columns(uint32_t edges);
+  void on_revolution();
 
   static void dump_event(void* arg, esp_event_base_t base, int32_t id,
                          void* data);
@@ -73,13 +111,14 @@ class LEDClient : public esp::App {
   void stop_connect_timer();
   static void handle_connect_timer(void* arg);
 
-  void start_prefetch_timer();
-  void stop_prefetch_timer();
-  static void handle_prefetch_timer(void* arg);
+  static void handle_telemetry_timer(void* arg);
+  void send_telemetry();
 
   void on_got_ip();
   void on_conn_err();
+  void feed_playout();
   void advance_frame();
+  void fill_columns(int n);
 
   void start_gpio();
   void stop_gpio();
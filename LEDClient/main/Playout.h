@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// Adaptive playout for the jitter buffer. Playback starts once a few frames
+// are buffered instead of when the buffer is full, and the buffer is then
+// kept at a target depth that covers the arrival jitter measured so far.
+//
+// Jitter is estimated as in RFC 3550: the change in transit time (arrival
+// minus presentation time) from one frame to the next, smoothed over 16
+// frames, so the offset between the server's clock and ours cancels out.
+// The target is the frames needed to cover JITTER_MARGIN times that, plus
+// one, and it grows by one at each underrun. It shrinks by a frame at a time
+// after SHRINK_FRAMES frames that needed less, so a calm spell does not
+// undo the depth a burst needed.
+//
+// Times are microseconds on the caller's clocks, and nothing here depends on
+// the platform, so the firmware, ledsim and replays of recorded arrivals all
+// run the same code.
+class Playout {
+ public:
+  static const int JITTER_MARGIN = 3;
+  static const int SHRINK_FRAMES = 64;
+
+  Playout(size_t start_level, size_t min_depth, size_t max_depth)
+      : start_level_(start_level),
+        min_depth_(std::max<size_t>(min_depth, 1)),
+        max_depth_(std::max(max_depth, min_depth_)) {
+    reset();
+  }
+
+  // For a new connection
+  void reset() {
+    target_ = std::min(std::max(start_level_, min_depth_), max_depth_);
+    calm_ = 0;
+    have_last_ = false;
+    last_num_ = 0;
+    last_transit_us_ = 0;
+    last_pts_us_ = 0;
+    jitter_us_ = 0;
+    period_us_ = 0;
+  }
+
+  bool can_start(size_t level) const { return level >= start_level_; }
+  size_t target() const { return target_; }
+  int64_t jitter_us() const { return jitter_us_; }
+  int64_t period_us() const { return period_us_; }
+
+  void on_arrival(uint64_t frame_num, int64_t pts_us, int64_t arrival_us) {
+    int64_t transit = arrival_us - pts_us;
+    // Frame numbers going back mean a new stream with its own timing
+    if (have_last_ && frame_num > last_num_) {
+      auto period = (pts_us - last_pts_us_) /
+                    static_cast<int64_t>(frame_num - last_num_);
+      period_us_ = period_us_ ? period_us_ + (period - period_us_) / 8
+                              : period;
+      auto d = std::abs(transit - last_transit_us_);
+      jitter_us_ += (d - jitter_us_) / 16;
+      adapt();
+    }
+    have_last_ = true;
+    last_num_ = frame_num;
+    last_transit_us_ = transit;
+    last_pts_us_ = pts_us;
+  }
+
+  void on_underrun() {
+    target_ = std::min(target_ + 1, max_depth_);
+    calm_ = 0;
+  }
+
+  // Frames to release from the front of the buffer before showing the next
+  // one, out of the level buffered, where num(i) is the number of the i-th
+  // and the frame after shown is due now. Late frames are skipped to catch
+  // up while the buffer holds more than the target; past that they are
+  // shown late, which moves the schedule back and deepens the buffer. A
+  // buffer more than a frame over a target that shrank loses one frame.
+  template <typename FrameNum>
+  size_t skip_count(size_t level, uint64_t shown, uint64_t due,
+                    FrameNum num) const {
+    size_t skip = 0;
+    while (level - skip > target_) {
+      uint64_t n = num(skip);
+      if (n <= shown || n >= due) {
+        break;
+      }
+      ++skip;
+    }
+    if (!skip && level > target_ + 1) {
+      ++skip;
+    }
+    return skip;
+  }
+
+ private:
+  void adapt() {
+    size_t want = min_depth_;
+    if (period_us_ > 0) {
+      want = 1 + (JITTER_MARGIN * jitter_us_ + period_us_ - 1) / period_us_;
+    }
+    want = std::min(std::max(want, min_depth_), max_depth_);
+    if (want > target_) {
+      target_ = want;
+      calm_ = 0;
+    } else if (want == target_) {
+      calm_ = 0;
+    } else if (++calm_ >= SHRINK_FRAMES) {
+      --target_;
+      calm_ = 0;
+    }
+  }
+
+  size_t start_level_;
+  size_t min_depth_;
+  size_t max_depth_;
+  size_t target_;
+  int calm_;
+  bool have_last_;
+  uint64_t last_num_;
+  int64_t last_transit_us_;
+  int64_t last_pts_us_;
+  // Smoothed |change in transit| and frame period
+  int64_t jitter_us_;
+  int64_t period_us_;
+};
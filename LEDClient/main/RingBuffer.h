@@ -1,68 +1,93 @@
 #pragma once
 
-#include <mutex>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
-#include "Mutex.h"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 
+// Ring of D slots shared by one producer and one consumer, wait-free on both
+// sides. The producer fills the slot reserve() returns in place and
+// publishes it with push(); the consumer reads from front() and releases
+// slots with pop() or skip(). Each index is a free-running count written by
+// one side only, with release, and read by the other with acquire, so a
+// pushed slot is complete when the consumer sees it and a released one is
+// no longer read when the producer reuses it. level() may be called from
+// either side, or from anywhere for logging.
 template <typename T, int D>
 class RingBuffer {
  public:
-  RingBuffer() : r_(0), w_(0), level_(0) { 
-    memset(bufs_, 0, sizeof(bufs_));
-  }
+  static_assert(D > 0 && (D & (D - 1)) == 0,
+                "depth must divide the index range");
+
+  RingBuffer() : r_(0), w_(0) { memset(bufs_, 0, sizeof(bufs_)); }
 
   constexpr size_t datum_size() const { return sizeof(T); }
-  constexpr size_t depth() { return D; }
+  constexpr size_t depth() const { return D; }
 
   size_t level() const {
-    std::lock_guard<Mutex> _(lock_);
-    return level_;
+    auto r = r_.load(std::memory_order_acquire);
+    return w_.load(std::memory_order_acquire) - r;
+  }
+
+  // Consumer only. The slot at front() + i, for i < level().
+  const T& front() const { return at(0); }
+  const T& at(size_t i) const {
+    return bufs_[(r_.load(std::memory_order_relaxed) + i) % D];
   }
 
-  const T& front() const {
-    std::lock_guard<Mutex> _(lock_);
-    return bufs_[r_];
+  // Producer only. The slot to fill next, or null if the ring is full.
+  T* reserve() {
+    auto w = w_.load(std::memory_order_relaxed);
+    if (w - r_.load(std::memory_order_acquire) == D) {
+      return nullptr;
+    }
+    return &bufs_[w % D];
   }
 
-  T* next() {
-    std::lock_guard<Mutex> _(lock_);
-    return &bufs_[(w_ + 1) % D];
+  // Producer only. As above, also giving the number of free slots that
+  // follow in memory from the one returned, itself included, for filling
+  // several at once.
+  T* reserve(size_t& count) {
+    auto w = w_.load(std::memory_order_relaxed);
+    size_t free = D - (w - r_.load(std::memory_order_acquire));
+    count = std::min<size_t>(free, D - w % D);
+    return count ? &bufs_[w % D] : nullptr;
   }
 
+  // Producer only. Publishes the reserved slot.
   void push() {
-    std::lock_guard<Mutex> _(lock_);
-    if (level_ && w_ == r_) {
-      assert(0);
-    }
-    level_++;
-    w_ = (w_ + 1) % D;
+    auto w = w_.load(std::memory_order_relaxed);
+    assert(w - r_.load(std::memory_order_acquire) < D);
+    w_.store(w + 1, std::memory_order_release);
   }
 
+  // Consumer only
   void pop() {
-    std::lock_guard<Mutex> _(lock_);
-    if (!level_) {
-      assert(r_ == w_);
+    auto r = r_.load(std::memory_order_relaxed);
+    if (r == w_.load(std::memory_order_acquire)) {
       throw std::runtime_error("buffer underrun!");
     }
-    r_ = (r_ + 1) % D;
-    level_--;
+    r_.store(r + 1, std::memory_order_release);
   }
 
-  uint32_t ffwd(uint32_t n) {
-    std::lock_guard<Mutex> _n(lock_);
-    if (!level_) {
+  // Consumer only. Releases up to n slots from the front in one step, always
+  // leaving the newest, and returns how many.
+  uint32_t skip(uint32_t n) {
+    auto r = r_.load(std::memory_order_relaxed);
+    uint32_t level = w_.load(std::memory_order_acquire) - r;
+    if (!level) {
       return 0;
     }
-    int popped = std::min(n, level_ - 1);
-    r_ = (r_ + popped) % D;
-    level_ -= popped;
-    return popped;
+    n = std::min(n, level - 1);
+    r_.store(r + n, std::memory_order_release);
+    return n;
   }
 
  private:
-  T bufs_[D];
-  int r_;
-  int w_;
-  size_t level_;
-  mutable Mutex lock_;
+  alignas(4) T bufs_[D];
+  // Slots popped and pushed so far, on their own cache lines on hosts
+  alignas(64) std::atomic<uint32_t> r_;
+  alignas(64) std::atomic<uint32_t> w_;
 };
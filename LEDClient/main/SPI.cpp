@@ -1,7 +1,7 @@
 #include "SPI.h"
 #include "esp_intr_alloc.h"
 
-SPI::SPI()
+SPI::SPI() : next_txn_(0)
 {
 	spi_bus_config_t bus_cfg = {};
 	bus_cfg.miso_io_num = -1;
@@ -25,7 +25,7 @@ SPI::SPI()
 	dev_cfg.input_delay_ns = 0;
 	dev_cfg.spics_io_num = -1;
 	dev_cfg.flags = 0;
-	dev_cfg.queue_size = 1;
+	dev_cfg.queue_size = QUEUE_DEPTH;
 	dev_cfg.pre_cb = NULL;
 	dev_cfg.post_cb = NULL;
 	ERR_THROW(spi_bus_add_device(VSPI_HOST, &dev_cfg, &device_));
@@ -36,4 +36,21 @@ SPI::~SPI() {
 	spi_device_release_bus(device_);
   spi_bus_remove_device(device_);
   spi_bus_free(VSPI_HOST);
-}
\ No newline at end of file
+}
+
+void IRAM_ATTR SPI::queue(const uint8_t* data, size_t size) {
+  auto& txn = txns_[next_txn_++ % QUEUE_DEPTH];
+  txn = {};
+  txn.tx_buffer = data;
+  txn.length = size * 8;
+  ERR_THROW(spi_device_queue_trans(device_, &txn, 0));
+}
+
+size_t IRAM_ATTR SPI::reap() {
+  spi_transaction_t* txn;
+  size_t n = 0;
+  while (spi_device_get_trans_result(device_, &txn, 0) == ESP_OK) {
+    ++n;
+  }
+  return n;
+}
@@ -17,8 +17,13 @@ ServerConnection::ServerConnection(asio::io_context& ctx,
       remote_ep_(asio::ip::address_v4(dst_), dst_port),
       sock_(ctx_, local_ep_),
       id_(mac),
-      read_pending_(false),
-      op_id_(0) {
+      telemetry_pending_(false),
+      reader_(sock_, *this, WIRE_FORMAT, WIRE_CODEC) {
+  assert(id_.size() == sizeof(hello_.id));
+  std::copy(id_.begin(), id_.end(), hello_.id);
+  hello_.version = PROTOCOL_VERSION;
+  hello_.format = WIRE_FORMAT;
+  hello_.codec = WIRE_CODEC;
   connect();
 }
 
@@ -43,10 +48,10 @@ void ServerConnection::connect() {
 }
 
 void ServerConnection::send_header() {
-  ESP_LOGI(TAG, "ID: %02x-%02x-%02x-%02x-%02x-%02x", id_[0], id_[1], id_[2],
-           id_[3], id_[4], id_[5]);
+  ESP_LOGI(TAG, "ID: %02x-%02x-%02x-%02x-%02x-%02x format: %d", id_[0], id_[1],
+           id_[2], id_[3], id_[4], id_[5], static_cast<int>(hello_.format));
   asio::async_write(
-      sock_, asio::buffer(id_),
+      sock_, asio::buffer(&hello_, sizeof(hello_)),
       [this](const std::error_code& ec, std::size_t length) {
         if (!ec) {
           ESP_LOGI(TAG, "Sent HELLO: %s -> %s", to_string(local_ep_).c_str(),
@@ -60,27 +65,67 @@ void ServerConnection::send_header() {
       });
 }
 
-void ServerConnection::read_frame(JitterBuffer& bufs) {
-  assert(bufs.level() < bufs.depth());
-  auto op_id = op_id_++;
-  ESP_LOGD(TAG, "Read %d started - Jitter buffer level: %d/%d", op_id,
-           bufs.level(), bufs.depth());
-  asio::async_read(
-      sock_, asio::buffer((void*)bufs.next(), bufs.datum_size()),
-      [&, this, op_id](const std::error_code& ec, std::size_t bytes) {
-        if (!ec && bytes) {
-          ESP_LOGD(TAG, "Read %d complete: %d bytes", op_id, bytes);
-          bufs.push();
-          ESP_LOGD(TAG, "Push %d - Jitter buffer level: %d/%d", op_id,
-                   bufs.level(), bufs.depth());
-          ERR_THROW(
-              esp_event_post(LED_EVENT, LED_EVENT_READ_COMPLETE, NULL, 0, 0));
-        } else if (ec != std::errc::operation_canceled) {
-          ESP_LOGE(TAG, "Read error: %s", ec.message().c_str());
-          read_pending_ = false;
-          post_conn_err();
-        }
-      });
+void ServerConnection::send_telemetry(const Telemetry& t) {
+  // The client may let go of the connection before the IO task gets to the
+  // report, which is then not sent. Once it is written, the write holds the
+  // connection, and the report it writes from, until it completes.
+  asio::post(ctx_, [this, weak = weak_from_this(), t]() {
+    auto self = weak.lock();
+    if (!self) {
+      return;
+    }
+    // Reports are periodic, so one that would queue behind another is
+    // dropped
+    if (telemetry_pending_) {
+      return;
+    }
+    telemetry_ = t;
+    telemetry_pending_ = true;
+    asio::async_write(
+        sock_, asio::buffer(&telemetry_, sizeof(telemetry_)),
+        [this, self](const std::error_code& ec, std::size_t length) {
+          if (ec == std::errc::operation_canceled) {
+            return;
+          }
+          telemetry_pending_ = false;
+          if (ec) {
+            ESP_LOGE(TAG, "Write error %s: %s", to_string(remote_ep_).c_str(),
+                     ec.message().c_str());
+            post_conn_err();
+          }
+        });
+  });
+}
+
+void ServerConnection::start_reading(JitterBuffer& bufs,
+                                     size_t prime_level) {
+  asio::post(ctx_, [this, &bufs, prime_level]() {
+    ESP_LOGI(TAG, "Reading frames - Jitter buffer level: %d/%d", bufs.level(),
+             bufs.depth());
+    reader_.start(bufs, prime_level);
+  });
+}
+
+bool ServerConnection::on_frame(JitterSlot& slot, size_t wire_bytes) {
+  ESP_LOGD(TAG, "Read frame %llu, %d bytes", slot.header.frame_num,
+           wire_bytes);
+  // Timing is only lost if the frame loop falls far behind
+  if (auto a = arrivals_.reserve()) {
+    a->frame_num = slot.header.frame_num;
+    a->pts_us = slot.header.pts_ns / 1000;
+    a->arrival_us = esp_timer_get_time();
+    arrivals_.push();
+  }
+  return true;
+}
+
+void ServerConnection::on_primed() {
+  ERR_THROW(esp_event_post(LED_EVENT, LED_EVENT_PRIMED, NULL, 0, 0));
+}
+
+void ServerConnection::on_error(const std::string& what) {
+  ESP_LOGE(TAG, "%s: %s", to_string(remote_ep_).c_str(), what.c_str());
+  post_conn_err();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <memory>
 #include <sstream>
 #include <vector>
 
+#include "FrameReader.h"
 #include "JitterBuffer.h"
 #include "asio.hpp"
 
@@ -13,7 +15,23 @@ std::string to_string(const T& t) {
   return ss.str();
 }
 
-class ServerConnection {
+// When each frame arrived, for the playout to time
+struct Arrival {
+  uint64_t frame_num;
+  int64_t pts_us;
+  int64_t arrival_us;
+};
+
+// Frames that can arrive between two frame advances before their timing is
+// lost
+const int ARRIVAL_LOG_DEPTH = 32;
+
+typedef RingBuffer<Arrival, ARRIVAL_LOG_DEPTH> ArrivalLog;
+
+// Owned through a shared_ptr, so that writes queued from other tasks can
+// keep it alive until they complete on the IO task
+class ServerConnection
+    : public std::enable_shared_from_this<ServerConnection> {
  public:
   ServerConnection(asio::io_context& ctx, uint32_t src, uint32_t dst,
                    uint16_t dst_port, const std::vector<uint8_t>& id);
@@ -21,9 +39,25 @@ class ServerConnection {
   static void start_io();
   void connect();
   void send_header();
-  void read_frame(JitterBuffer& bufs);
+  // Streams frames into bufs until the connection fails, posting
+  // LED_EVENT_PRIMED once it holds prime_level of them. The frame loop
+  // calls resume_reading() after releasing frames and drains arrivals().
+  void start_reading(JitterBuffer& bufs, size_t prime_level);
+  void resume_reading() { reader_.wake(); }
+  ArrivalLog& arrivals() { return arrivals_; }
+  // From any task. The report is written on the IO task, which owns the
+  // socket.
+  void send_telemetry(const Telemetry& t);
 
  private:
+  typedef FrameReader<asio::ip::tcp::socket, JitterSlot, JITTER_BUFFER_DEPTH,
+                      ServerConnection>
+      Reader;
+  friend Reader;
+
+  bool on_frame(JitterSlot& slot, size_t wire_bytes);
+  void on_primed();
+  void on_error(const std::string& what);
   void post_conn_err();
   void post_conn_active();
 
@@ -34,6 +68,11 @@ class ServerConnection {
   asio::ip::tcp::endpoint remote_ep_;
   asio::ip::tcp::socket sock_;
   std::vector<uint8_t> id_;
-  bool read_pending_;
-  uint32_t op_id_;
+  Hello hello_;
+  // The report being written, IO task only
+  Telemetry telemetry_;
+  bool telemetry_pending_;
+  Reader reader_;
+  // Written on the IO task as frames arrive, read by the frame loop
+  ArrivalLog arrivals_;
 };
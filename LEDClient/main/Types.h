@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 struct __attribute__((__packed__)) RGB {
   RGB() {}
   RGB(uint8_t r, uint8_t g, uint8_t b) : b_(b), g_(g), r_(r) {}
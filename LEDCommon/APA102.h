@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// One column of S LEDs as an APA102 SPI transfer: a zero start frame, an
+// 0xE0 | brightness, B, G, R frame per LED, then zero end-frame bytes to
+// clock the data through the strip. Columns are zero-padded to a multiple of
+// 4 bytes so each one can be handed to the SPI DMA engine where it lies.
+template <size_t S>
+class APA102Column {
+ public:
+  static const size_t START_SIZE = 4;
+  static const size_t LED_SIZE = 4;
+  static const size_t END_SIZE = (((S + 1) / 2) + 7) / 8;
+  static const size_t FRAME_SIZE = START_SIZE + S * LED_SIZE + END_SIZE;
+  static const size_t SIZE = (FRAME_SIZE + 3) & ~size_t(3);
+
+  // Encodes S packed B,G,R pixels into SIZE bytes at out
+  static void encode(const uint8_t* bgr, uint8_t* out,
+                     uint8_t brightness = 31) {
+    uint8_t header = 0xe0 | (brightness & 0x1f);
+    memset(out, 0, START_SIZE);
+    encode_leds(bgr, out + START_SIZE, header);
+    memset(out + START_SIZE + S * LED_SIZE, 0,
+           SIZE - START_SIZE - S * LED_SIZE);
+  }
+
+  // The LED frames alone. encode_leds() picks the fastest encoder the CPU
+  // supports; each is public so they can be checked against each other.
+  static void encode_leds_scalar(const uint8_t* bgr, uint8_t* out, size_t n,
+                                 uint8_t header) {
+    for (size_t i = 0; i < n; ++i, bgr += 3, out += 4) {
+      out[0] = header;
+      out[1] = bgr[0];
+      out[2] = bgr[1];
+      out[3] = bgr[2];
+    }
+  }
+
+#if defined(__ARM_NEON)
+  // 16 LEDs per step: de-interleave B,G,R and re-interleave with the header
+  static void encode_leds_neon(const uint8_t* bgr, uint8_t* out,
+                               uint8_t header) {
+    size_t i = 0;
+    for (; i + 16 <= S; i += 16) {
+      uint8x16x3_t in = vld3q_u8(bgr + i * 3);
+      uint8x16x4_t leds = {{vdupq_n_u8(header), in.val[0], in.val[1],
+                            in.val[2]}};
+      vst4q_u8(out + i * 4, leds);
+    }
+    encode_leds_scalar(bgr + i * 3, out + i * 4, S - i, header);
+  }
+
+  static void encode_leds(const uint8_t* bgr, uint8_t* out, uint8_t header) {
+    encode_leds_neon(bgr, out, header);
+  }
+#elif defined(__x86_64__) || defined(__i386__)
+  // 4 LEDs per step: spread 12 bytes into 16 with a byte shuffle and OR in
+  // the header. Each load reads 16 bytes, so the tail goes through the scalar
+  // path to stay inside the input.
+  __attribute__((target("ssse3"))) static void encode_leds_ssse3(
+      const uint8_t* bgr, uint8_t* out, uint8_t header) {
+    const __m128i shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7,
+                                          8, -1, 9, 10, 11);
+    const __m128i headers = _mm_set1_epi32(header);
+    size_t i = 0;
+    for (; i * 3 + 16 <= S * 3; i += 4) {
+      __m128i in =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgr + i * 3));
+      __m128i leds = _mm_or_si128(_mm_shuffle_epi8(in, shuffle), headers);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), leds);
+    }
+    encode_leds_scalar(bgr + i * 3, out + i * 4, S - i, header);
+  }
+
+  static void encode_leds(const uint8_t* bgr, uint8_t* out, uint8_t header) {
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3) {
+      encode_leds_ssse3(bgr, out, header);
+    } else {
+      encode_leds_scalar(bgr, out, S, header);
+    }
+  }
+#else
+  static void encode_leds(const uint8_t* bgr, uint8_t* out, uint8_t header) {
+    encode_leds_scalar(bgr, out, S, header);
+  }
+#endif
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 as used by Ethernet and zlib (reflected polynomial 0xEDB88320).
+// Pass a previous result as crc to continue over more data.
+inline uint32_t crc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+  struct Table {
+    Table() {
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+          c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        entries[i] = c;
+      }
+    }
+    uint32_t entries[256];
+  };
+  static const Table table;
+  crc = ~crc;
+  for (const uint8_t* end = data + len; data < end; ++data) {
+    crc = table.entries[(crc ^ *data) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "CRC32.h"
+
+// All multi-byte fields are little-endian, the native order of the server
+// and the ESP32.
+
+const uint32_t FRAME_MAGIC = 0x4d534850;  // "PHSM"
+const uint32_t TELEMETRY_MAGIC = 0x4d4c4554;  // "TELM"
+const uint8_t PROTOCOL_VERSION = 4;
+
+// A client resets once it falls this many frames behind schedule
+const uint32_t MAX_DROPPED_FRAMES = 160;
+
+// Slice payload encodings, chosen by the client in its Hello
+enum class WireFormat : uint8_t {
+  RAW_BGR = 0,   // packed B,G,R pixels, STRIP_H per column
+  APA102 = 1,    // one padded APA102 SPI frame per column, see APA102.h
+  RGB565 = 2,    // a 5:6:5 R,G,B word per pixel, STRIP_H per column
+  PALETTE8 = 3,  // palette colors used - 1, 256 B,G,R palette entries, then
+                 // a palette index per pixel, STRIP_H per column
+};
+
+const int WIRE_FORMAT_COUNT = 4;
+
+inline bool valid(WireFormat f) {
+  return f == WireFormat::RAW_BGR || f == WireFormat::APA102 ||
+         f == WireFormat::RGB565 || f == WireFormat::PALETTE8;
+}
+
+// Payload compression, also chosen by the client in its Hello. Coded
+// payloads decode to the payload of the chosen format.
+enum class WireCodec : uint8_t {
+  NONE = 0,
+  DELTA_RLE = 1,  // against the previous payload, see SliceCodec.h
+};
+
+inline bool valid(WireCodec c) {
+  return c == WireCodec::NONE || c == WireCodec::DELTA_RLE;
+}
+
+// First message on a connection, client to server
+struct __attribute__((__packed__)) Hello {
+  uint8_t id[6];      // station MAC address
+  uint8_t version;    // PROTOCOL_VERSION
+  WireFormat format;  // encoding of every slice sent to this client
+  WireCodec codec;    // compression of every slice sent to this client
+};
+
+// Precedes every slice payload, server to client. The payload follows
+// immediately and is length bytes long.
+struct __attribute__((__packed__)) FrameHeader {
+  uint32_t magic;      // FRAME_MAGIC
+  uint8_t version;     // PROTOCOL_VERSION
+  WireFormat format;   // payload encoding
+  uint16_t slice;      // slice index
+  uint64_t frame_num;  // frame number, consecutive unless frames were skipped
+  uint64_t pts_ns;     // presentation time, steady clock nanoseconds
+  uint32_t length;     // payload bytes, as coded
+  uint32_t crc;        // CRC-32 of the payload, as coded, then the fields above
+};
+
+// Continues a payload's CRC over the header fields before crc, so the
+// payload's own CRC can be computed once for any number of headers
+inline uint32_t frame_crc(const FrameHeader& h, uint32_t payload_crc) {
+  return crc32(reinterpret_cast<const uint8_t*>(&h),
+               offsetof(FrameHeader, crc), payload_crc);
+}
+
+// For payloads whose CRC is already known
+inline FrameHeader make_frame_header(uint64_t frame_num, uint64_t pts_ns,
+                                     uint16_t slice, WireFormat format,
+                                     uint32_t length, uint32_t payload_crc) {
+  FrameHeader h;
+  h.magic = FRAME_MAGIC;
+  h.version = PROTOCOL_VERSION;
+  h.format = format;
+  h.slice = slice;
+  h.frame_num = frame_num;
+  h.pts_ns = pts_ns;
+  h.length = length;
+  h.crc = frame_crc(h, payload_crc);
+  return h;
+}
+
+inline FrameHeader make_frame_header(uint64_t frame_num, uint64_t pts_ns,
+                                     uint16_t slice, WireFormat format,
+                                     const uint8_t* payload, uint32_t length) {
+  return make_frame_header(frame_num, pts_ns, slice, format, length,
+                           crc32(payload, length));
+}
+
+// A header that fails this check means the stream is out of sync
+inline bool check_header(const FrameHeader& h, WireFormat format,
+                         size_t max_length) {
+  return h.magic == FRAME_MAGIC && h.version == PROTOCOL_VERSION &&
+         h.format == format && h.length <= max_length;
+}
+
+// Covers the header too, so a header that passed check_header() but was
+// corrupted anywhere fails here
+inline bool check_payload(const FrameHeader& h, const uint8_t* payload) {
+  return frame_crc(h, crc32(payload, h.length)) == h.crc;
+}
+
+// Sent periodically after the Hello, client to server. Counters cover the
+// current connection.
+struct __attribute__((__packed__)) Telemetry {
+  uint32_t magic;           // TELEMETRY_MAGIC
+  uint8_t version;          // PROTOCOL_VERSION
+  uint8_t buffer_level;     // frames in the jitter buffer
+  uint8_t buffer_depth;     // frames the jitter buffer aims to hold
+  uint8_t reserved;
+  uint64_t shown_frame;     // number of the frame on display
+  uint32_t rotation_us;     // last measured revolution period, 0 if unknown
+  uint32_t dropped_frames;  // frames behind schedule now
+  uint32_t underruns;       // ticks that found no frame to show
+  uint32_t skipped_frames;  // frames skipped to catch up
+  uint32_t crc;             // CRC-32 of the fields above
+};
+
+static_assert(sizeof(Telemetry) == 36);
+
+// Fills in magic, version and crc
+inline void seal(Telemetry& t) {
+  t.magic = TELEMETRY_MAGIC;
+  t.version = PROTOCOL_VERSION;
+  t.reserved = 0;
+  t.crc =
+      crc32(reinterpret_cast<const uint8_t*>(&t), offsetof(Telemetry, crc));
+}
+
+inline bool check_telemetry(const Telemetry& t) {
+  return t.magic == TELEMETRY_MAGIC && t.version == PROTOCOL_VERSION &&
+         crc32(reinterpret_cast<const uint8_t*>(&t),
+               offsetof(Telemetry, crc)) == t.crc;
+}
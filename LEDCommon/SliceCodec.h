@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// WireCodec::DELTA_RLE. A slice payload is XORed with the previous payload
+// sent on the connection, so bytes that did not change become zeros, and the
+// result is run-length coded:
+//
+//   SLICE_KEY, coded against zeros, or SLICE_DELTA, against the previous
+//   payload; then tokens until the payload is complete:
+//     0x00-0x7f        c + 1 literal bytes follow, to XOR with the reference
+//     0x80-0xfe        c - 0x7f bytes (1..127) equal to the reference
+//     0xff, n (le16)   n bytes (128..65535) equal to the reference
+//
+// Frames that barely change code to a few hundred bytes, and decoding is a
+// copy or an XOR per run, cheap enough for the ESP32 to decode straight into
+// a jitter buffer slot.
+const uint8_t SLICE_KEY = 0;
+const uint8_t SLICE_DELTA = 1;
+
+// Largest coded size of an n byte payload, when nothing repeats
+constexpr size_t max_coded_size(size_t n) { return 1 + n + (n + 127) / 128; }
+
+namespace slice_codec {
+
+// Unchanged runs shorter than this cost less as part of a literal
+const size_t MIN_RUN = 3;
+const size_t MAX_LITERAL = 128;
+const size_t MAX_SHORT_RUN = 127;
+const size_t MAX_LONG_RUN = 65535;
+
+inline uint64_t load64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// End of the run of bytes from i that equal the reference
+inline size_t run_end(const uint8_t* cur, const uint8_t* ref, size_t i,
+                      size_t n) {
+  if (ref) {
+    for (; i + 8 <= n && load64(cur + i) == load64(ref + i); i += 8) {
+    }
+    for (; i < n && cur[i] == ref[i]; ++i) {
+    }
+  } else {
+    for (; i + 8 <= n && !load64(cur + i); i += 8) {
+    }
+    for (; i < n && !cur[i]; ++i) {
+    }
+  }
+  return i;
+}
+
+}  // namespace slice_codec
+
+// Codes n bytes of cur against ref, the previous payload, or against zeros
+// if ref is null. out must hold max_coded_size(n). Returns the coded size.
+inline size_t slice_encode(const uint8_t* cur, const uint8_t* ref, size_t n,
+                           uint8_t* out) {
+  using namespace slice_codec;
+  size_t o = 0;
+  out[o++] = ref ? SLICE_DELTA : SLICE_KEY;
+  size_t i = 0;
+  while (i < n) {
+    size_t end = run_end(cur, ref, i, n);
+    if (end - i >= MIN_RUN || (end == n && end > i)) {
+      while (i < end) {
+        size_t run = end - i < MAX_LONG_RUN ? end - i : MAX_LONG_RUN;
+        if (run <= MAX_SHORT_RUN) {
+          out[o++] = static_cast<uint8_t>(0x7f + run);
+        } else {
+          out[o++] = 0xff;
+          out[o++] = run & 0xff;
+          out[o++] = run >> 8;
+        }
+        i += run;
+      }
+      continue;
+    }
+    // A literal, up to the next run worth coding
+    size_t j = i;
+    size_t same = 0;
+    while (j < n && j - i < MAX_LITERAL) {
+      uint8_t d = ref ? cur[j] ^ ref[j] : cur[j];
+      same = d ? 0 : same + 1;
+      out[o + 1 + j - i] = d;
+      ++j;
+      if (same == MIN_RUN) {
+        j -= MIN_RUN;
+        break;
+      }
+    }
+    out[o] = static_cast<uint8_t>(j - i - 1);
+    o += 1 + j - i;
+    i = j;
+  }
+  return o;
+}
+
+// Decodes len coded bytes into the n byte payload out. ref is the previous
+// payload, which a delta needs; it may be out itself, but must not
+// otherwise overlap it. Returns false, with out partly written, if the
+// input is malformed or codes a size other than n.
+inline bool slice_decode(const uint8_t* in, size_t len, const uint8_t* ref,
+                         uint8_t* out, size_t n) {
+  if (!len || in[0] > SLICE_DELTA || (in[0] == SLICE_DELTA && !ref)) {
+    return false;
+  }
+  if (in[0] == SLICE_KEY) {
+    ref = nullptr;
+  }
+  const uint8_t* end = in + len;
+  ++in;
+  size_t o = 0;
+  while (in < end) {
+    uint8_t c = *in++;
+    if (c < 0x80) {
+      size_t count = c + 1;
+      if (count > static_cast<size_t>(end - in) || count > n - o) {
+        return false;
+      }
+      if (ref) {
+        for (size_t k = 0; k < count; ++k) {
+          out[o + k] = ref[o + k] ^ in[k];
+        }
+      } else {
+        memcpy(out + o, in, count);
+      }
+      in += count;
+      o += count;
+      continue;
+    }
+    size_t count = c - 0x7f;
+    if (c == 0xff) {
+      if (end - in < 2) {
+        return false;
+      }
+      count = in[0] | in[1] << 8;
+      in += 2;
+    }
+    if (count > n - o) {
+      return false;
+    }
+    if (!ref) {
+      memset(out + o, 0, count);
+    } else if (ref != out) {
+      memcpy(out + o, ref + o, count);
+    }
+    o += count;
+  }
+  return o == n;
+}
@@ -0,0 +1,159 @@
+#include "AsyncLog.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace {
+
+// Gives the thread's ring up to the log thread, to free once drained, when
+// the thread exits
+struct RingOwner {
+  ~RingOwner() {
+    if (ring) {
+      ring->orphan();
+    }
+  }
+  LogRing* ring = nullptr;
+};
+
+thread_local RingOwner ring_owner;
+
+}  // namespace
+
+std::string LogRecord::format() const {
+  std::string out;
+  const char* f = site->format;
+  int arg = 0;
+  while (*f) {
+    if (f[0] == '{' && f[1] == '}' && arg < argc) {
+      char buf[32];
+      auto& a = args[arg];
+      switch (types[arg]) {
+        case INT:
+          snprintf(buf, sizeof(buf), "%" PRId64, a.i);
+          out += buf;
+          break;
+        case UINT:
+          snprintf(buf, sizeof(buf), "%" PRIu64, a.u);
+          out += buf;
+          break;
+        case DOUBLE:
+          snprintf(buf, sizeof(buf), "%g", a.d);
+          out += buf;
+          break;
+        case STRING:
+          out.append(text + a.s.offset, a.s.len);
+          break;
+        case ID:
+          snprintf(buf, sizeof(buf), "%02x-%02x-%02x-%02x-%02x-%02x", a.id[0],
+                   a.id[1], a.id[2], a.id[3], a.id[4], a.id[5]);
+          out += buf;
+          break;
+      }
+      ++arg;
+      f += 2;
+    } else {
+      out += *f++;
+    }
+  }
+  if (suppressed) {
+    out += " [" + std::to_string(suppressed) + " similar suppressed]";
+  }
+  return out;
+}
+
+AsyncLog& AsyncLog::get() {
+  static AsyncLog log;
+  return log;
+}
+
+AsyncLog::AsyncLog()
+    : min_severity_(boost::log::trivial::trace),
+      stop_(false),
+      records_(0),
+      suppressed_(0),
+      orphan_dropped_(0),
+      reported_dropped_(0),
+      thread_([this]() { run(); }) {}
+
+AsyncLog::~AsyncLog() { stop(); }
+
+void AsyncLog::stop() {
+  if (!stop_.exchange(true)) {
+    wake_.notify_all();
+    thread_.join();
+  }
+}
+
+AsyncLog::Stats AsyncLog::stats() const {
+  std::scoped_lock _(rings_lock_);
+  auto dropped = orphan_dropped_;
+  for (auto& r : rings_) {
+    dropped += r->dropped();
+  }
+  return Stats{records_.load(), dropped, suppressed_.load()};
+}
+
+LogRing& AsyncLog::thread_ring() {
+  if (!ring_owner.ring) {
+    auto ring = std::make_unique<LogRing>();
+    ring_owner.ring = ring.get();
+    std::scoped_lock _(rings_lock_);
+    rings_.push_back(std::move(ring));
+  }
+  return *ring_owner.ring;
+}
+
+void AsyncLog::run() {
+  while (true) {
+    auto gen = wake_.generation();
+    bool stop = stop_.load();
+    forward();
+    if (stop) {
+      return;
+    }
+    wake_.wait(gen, POLL);
+  }
+}
+
+// Formats everything queued on every ring, oldest first
+void AsyncLog::forward() {
+  uint64_t dropped;
+  {
+    std::scoped_lock _(rings_lock_);
+    for (auto& r : rings_) {
+      r->drain([this](const LogRecord& rec) { batch_.push_back(rec); });
+    }
+    // A ring orphaned before the drain above has nothing left in it
+    dropped = orphan_dropped_;
+    for (auto it = rings_.begin(); it != rings_.end();) {
+      if ((*it)->orphaned() && (*it)->empty()) {
+        orphan_dropped_ += (*it)->dropped();
+        dropped += (*it)->dropped();
+        it = rings_.erase(it);
+      } else {
+        dropped += (*it)->dropped();
+        ++it;
+      }
+    }
+  }
+  std::stable_sort(batch_.begin(), batch_.end(),
+                   [](const LogRecord& a, const LogRecord& b) {
+                     return a.time_ns < b.time_ns;
+                   });
+  auto& lg = boost::log::trivial::logger::get();
+  uint64_t suppressed = 0;
+  for (auto& rec : batch_) {
+    BOOST_LOG_SEV(lg, rec.site->severity) << rec.format();
+    suppressed += rec.suppressed;
+  }
+  records_.fetch_add(batch_.size(), std::memory_order_relaxed);
+  suppressed_.fetch_add(suppressed, std::memory_order_relaxed);
+  batch_.clear();
+  if (dropped != reported_dropped_) {
+    BOOST_LOG_SEV(lg, boost::log::trivial::warning)
+        << "Log: " << dropped - reported_dropped_
+        << " records dropped, a thread logged faster than they were written";
+    reported_dropped_ = dropped;
+  }
+}
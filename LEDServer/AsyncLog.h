@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <boost/log/trivial.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Futex.h"
+
+// Logging for hot paths. ALOG(severity, format, args...) copies its
+// arguments into a fixed-size binary record on a per-thread ring and
+// returns; a background thread formats records in time order and forwards
+// them to Boost.Log, so the sinks and filter set up for LOG() apply to both.
+// Records reach the sinks up to POLL after they were written, from the log
+// thread, so sink timestamps and thread ids are the log thread's.
+// Formats are string literals with a {} per argument. Arguments, taken by
+// value so packed fields can be passed directly, may be integers, enums,
+// floating point, strings (copied, and truncated if long) and LogId, a
+// client id formatted as LOG() prints it.
+//
+// ALOG_RATE(severity, per_sec, ...) emits at most per_sec records a second
+// from its call site; the next record it emits carries the number it
+// suppressed. When a thread's ring is full the record is dropped and
+// counted, and the count is logged.
+//
+// Calls below ALOG_MIN_SEVERITY compile to nothing, arguments included;
+// release builds leave out debug and trace.
+
+#ifndef ALOG_MIN_SEVERITY
+#ifdef NDEBUG
+#define ALOG_MIN_SEVERITY info
+#else
+#define ALOG_MIN_SEVERITY trace
+#endif
+#endif
+
+#define ALOG_RATE(SEVERITY, PER_SEC, FORMAT, ...)                     \
+  do {                                                                \
+    if constexpr (boost::log::trivial::SEVERITY >=                    \
+                  boost::log::trivial::ALOG_MIN_SEVERITY) {           \
+      static LogSite alog_site_(boost::log::trivial::SEVERITY, FORMAT, \
+                                PER_SEC);                             \
+      AsyncLog::write(alog_site_, ##__VA_ARGS__);                     \
+    }                                                                 \
+  } while (0)
+
+#define ALOG(SEVERITY, FORMAT, ...) ALOG_RATE(SEVERITY, 0, FORMAT, ##__VA_ARGS__)
+
+// A 6-byte client id, printed as 24-0a-c4-c0-6b-f0
+struct LogId {
+  const uint8_t* id;
+};
+
+// One ALOG call site. Rate limiting counts records in the current second.
+struct LogSite {
+  constexpr LogSite(boost::log::trivial::severity_level severity,
+                    const char* format, uint32_t per_sec)
+      : severity(severity),
+        format(format),
+        per_sec(per_sec),
+        window_(0),
+        count_(0),
+        suppressed_(0) {}
+
+  // Sets suppressed to the records rejected since the last one admitted
+  bool admit(uint64_t now_ns, uint64_t& suppressed) {
+    uint64_t window = now_ns / 1000000000;
+    auto w = window_.load(std::memory_order_relaxed);
+    if (w != window &&
+        window_.compare_exchange_strong(w, window, std::memory_order_relaxed)) {
+      count_.store(0, std::memory_order_relaxed);
+    }
+    if (count_.fetch_add(1, std::memory_order_relaxed) >= per_sec) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+
+  const boost::log::trivial::severity_level severity;
+  const char* const format;
+  const uint32_t per_sec;
+
+ private:
+  std::atomic<uint64_t> window_;
+  std::atomic<uint32_t> count_;
+  std::atomic<uint64_t> suppressed_;
+};
+
+// Two cache lines: the site, the time and up to MAX_ARGS arguments, with
+// string arguments copied into text
+struct alignas(64) LogRecord {
+  static const int MAX_ARGS = 6;
+
+  enum Type : uint8_t { INT, UINT, DOUBLE, STRING, ID };
+
+  const LogSite* site;
+  uint64_t time_ns;
+  uint64_t suppressed;
+  uint8_t argc;
+  uint8_t text_len;
+  Type types[MAX_ARGS];
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    // Offset and length in text
+    struct {
+      uint8_t offset;
+      uint8_t len;
+    } s;
+    uint8_t id[6];
+  } args[MAX_ARGS];
+  char text[128 - 32 - MAX_ARGS * 8];
+
+  template <typename T>
+  void add(T v) {
+    if constexpr (std::is_enum_v<T>) {
+      add(static_cast<std::underlying_type_t<T>>(v));
+    } else if constexpr (std::is_floating_point_v<T>) {
+      types[argc] = DOUBLE;
+      args[argc++].d = v;
+    } else if constexpr (std::is_signed_v<T>) {
+      types[argc] = INT;
+      args[argc++].i = v;
+    } else {
+      static_assert(std::is_unsigned_v<T>, "unsupported ALOG argument");
+      types[argc] = UINT;
+      args[argc++].u = v;
+    }
+  }
+  void add(const char* s) { add_string(s, strlen(s)); }
+  void add(const std::string& s) { add_string(s.data(), s.size()); }
+  void add(LogId v) {
+    types[argc] = ID;
+    memcpy(args[argc++].id, v.id, sizeof(args[0].id));
+  }
+
+  std::string format() const;
+
+ private:
+  void add_string(const char* s, size_t len) {
+    len = std::min(len, sizeof(text) - text_len);
+    memcpy(text + text_len, s, len);
+    types[argc] = STRING;
+    args[argc].s.offset = text_len;
+    args[argc++].s.len = len;
+    text_len += len;
+  }
+};
+static_assert(sizeof(LogRecord) == 128);
+
+// Records written by one thread, read by the log thread
+class LogRing {
+ public:
+  static const size_t SIZE = 1024;
+
+  LogRing() : head_(0), tail_(0), dropped_(0), orphaned_(false) {}
+
+  // Returns nullptr when full
+  LogRecord* claim() {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == SIZE) {
+      dropped_.store(dropped_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &records_[head % SIZE];
+  }
+  // Returns true when the ring has just filled past half
+  bool publish() {
+    auto head = head_.load(std::memory_order_relaxed) + 1;
+    head_.store(head, std::memory_order_release);
+    return head - tail_.load(std::memory_order_relaxed) == SIZE / 2;
+  }
+
+  template <typename F>
+  void drain(F&& f) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+      f(records_[tail % SIZE]);
+    }
+    tail_.store(tail, std::memory_order_release);
+  }
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_relaxed);
+  }
+
+  void orphan() { orphaned_.store(true, std::memory_order_release); }
+  bool orphaned() const { return orphaned_.load(std::memory_order_acquire); }
+
+ private:
+  alignas(64) std::atomic<uint64_t> head_;
+  alignas(64) std::atomic<uint64_t> tail_;
+  alignas(64) std::atomic<uint64_t> dropped_;
+  std::atomic<bool> orphaned_;
+  LogRecord records_[SIZE];
+};
+
+class AsyncLog {
+ public:
+  struct Stats {
+    uint64_t records;
+    uint64_t dropped;
+    uint64_t suppressed;
+  };
+
+  static AsyncLog& get();
+
+  template <typename... Args>
+  static void write(LogSite& site, Args... args) {
+    static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS,
+                  "too many ALOG arguments");
+    auto& log = get();
+    if (site.severity < log.min_severity_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    auto now = now_ns();
+    uint64_t suppressed = 0;
+    if (site.per_sec && !site.admit(now, suppressed)) {
+      return;
+    }
+    auto& ring = log.thread_ring();
+    auto r = ring.claim();
+    if (!r) {
+      return;
+    }
+    r->site = &site;
+    r->time_ns = now;
+    r->suppressed = suppressed;
+    r->argc = 0;
+    r->text_len = 0;
+    (r->add(args), ...);
+    if (ring.publish()) {
+      log.wake_.notify_all();
+    }
+  }
+
+  // Records below severity are discarded before they are queued; set it
+  // with the Boost.Log filter
+  void set_min_severity(boost::log::trivial::severity_level severity) {
+    min_severity_.store(severity);
+  }
+
+  Stats stats() const;
+  // Forwards everything queued and stops the log thread. Later records are
+  // discarded.
+  void stop();
+
+ private:
+  // How often the log thread looks for records when not woken
+  static constexpr std::chrono::milliseconds POLL{20};
+
+  AsyncLog();
+  ~AsyncLog();
+
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  LogRing& thread_ring();
+  void run();
+  void forward();
+
+  std::atomic<boost::log::trivial::severity_level> min_severity_;
+  mutable std::mutex rings_lock_;
+  std::vector<std::unique_ptr<LogRing>> rings_;
+  std::vector<LogRecord> batch_;
+  Futex wake_;
+  std::atomic<bool> stop_;
+  std::atomic<uint64_t> records_;
+  std::atomic<uint64_t> suppressed_;
+  // Drops by rings already freed, and the total last logged
+  uint64_t orphan_dropped_;
+  uint64_t reported_dropped_;
+  std::thread thread_;
+};
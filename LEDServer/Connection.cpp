@@ -1,89 +1,407 @@
 #include "Connection.h"
 
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
 #include <boost/log/trivial.hpp>
+#include <cerrno>
 #include <iomanip>
 #include <sstream>
 
+#include "AsyncLog.h"
 #include "LEDServer.h"
+#include "LEDCommon/SliceCodec.h"
+#include "SliceEncoder.h"
+#include "Trace.h"
 #define LOG(X) BOOST_LOG_TRIVIAL(X)
 
 using namespace boost::asio;
 using namespace boost::asio::ip;
 
+namespace {
+uint64_t to_ns(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+}  // namespace
+
 Connection::Connection(LEDServer& server, tcp::socket& sock,
                        std::shared_ptr<IOThread> io)
     : server_(server),
       sock_(std::move(sock)),
       frame_num_(0),
-      slice_idx_(0),
       io_(io),
+      format_(WireFormat::RAW_BGR),
+      codec_(WireCodec::NONE),
       key_(sock_.remote_endpoint().address().to_v4().to_ulong()),
+      slice_idx_(0),
+      consumer_(0),
       ready_(false),
-      canceled_(false) {}
+      sending_(false),
+      canceled_(false),
+      frames_(nullptr),
+      pending_head_(0),
+      pending_count_(0),
+      writing_(false),
+      waiting_(false),
+      wait_ns_(nullptr),
+      write_ns_(nullptr),
+      latency_ns_(nullptr),
+      encode_ns_(nullptr),
+      sent_bytes_(nullptr),
+      sent_frames_(nullptr),
+      cache_hits_(nullptr),
+      cache_misses_(nullptr) {}
 
 Connection::~Connection() { cancel(); }
 
 void Connection::post_cancel() {
-  post(io_->ctx_, [this]() { cancel(); });
+  post(io_->ctx_, [self = shared_from_this()]() { self->cancel(); });
 }
 
 void Connection::cancel() {
   if (!canceled_) {
     canceled_ = true;
     LOG(info) << "Connection canceled: " << id_str();
-    sock_.shutdown(tcp::socket::shutdown_both);
-    sock_.cancel();
-    sock_.close();
+    // The peer may already be gone
+    boost::system::error_code ec;
+    sock_.shutdown(tcp::socket::shutdown_both, ec);
+    sock_.cancel(ec);
+    sock_.close(ec);
   }
 }
 
 void Connection::read_header() {
-  async_read(sock_, buffer(id_, sizeof(id_)),
+  async_read(sock_, buffer(&hello_, sizeof(hello_)),
              [this](const std::error_code& ec, std::size_t bytes) {
                if (!ec && bytes) {
-                 LOG(info) << "Header: ID = " << id_str();
+                 std::copy(hello_.id, hello_.id + sizeof(id_), id_);
+                 format_ = hello_.format;
+                 codec_ = hello_.codec;
+                 LOG(info) << "Header: ID = " << id_str() << " version = "
+                           << static_cast<int>(hello_.version)
+                           << " format = " << static_cast<int>(format_)
+                           << " codec = " << static_cast<int>(codec_);
+                 if (hello_.version != PROTOCOL_VERSION) {
+                   LOG(error) << "Unsupported protocol version from "
+                              << id_str();
+                   cancel();
+                   return;
+                 }
+                 if (!valid(format_) || !valid(codec_)) {
+                   LOG(error) << "Unknown wire format from " << id_str();
+                   cancel();
+                   return;
+                 }
                  server_.get().post_client_ready(shared_from_this());
+                 read_telemetry();
+               } else if (ec != std::errc::operation_canceled) {
+                 LOG(error) << "Read Error: " << ec.message();
+                 cancel();
+               }
+             });
+}
+void Connection::read_telemetry() {
+  if (canceled_) {
+    return;
+  }
+  async_read(sock_, buffer(&telemetry_, sizeof(telemetry_)),
+             [this, self = shared_from_this()](const std::error_code& ec,
+                                               std::size_t bytes) {
+               if (!ec && bytes) {
+                 if (!check_telemetry(telemetry_)) {
+                   LOG(error) << "Bad telemetry from " << id_str();
+                   cancel();
+                   return;
+                 }
+                 on_telemetry();
+                 read_telemetry();
                } else if (ec != std::errc::operation_canceled) {
                  LOG(error) << "Read Error: " << ec.message();
                  cancel();
                }
              });
 }
-void Connection::start_send(RGBFrameBuffer& frames, int slice_idx) {
-  slice_idx_ = slice_idx;
-  post(io_->ctx_, [&frames, this]() { this->send(frames); });
-}
-
-void Connection::send(RGBFrameBuffer& frames) {
-  while (!canceled_) {
-    auto frame = frames.pop(frame_num_);
-    auto slice = frame->slice_data(slice_idx_);
-    try {
-      auto bytes = write(sock_, slice);
-      LOG(info) << "Frame " << frame_num_ << " sent to client ID " << id_str()
-                << " [" << bytes << " bytes]";
-      ++frame_num_;
-    } catch (boost::system::system_error& e) {
-      if (e.code() != std::errc::operation_canceled) {
-        LOG(error) << "Write Error: " << e.what();
+
+void Connection::on_telemetry() {
+  auto& t = telemetry_;
+  ALOG(debug,
+       "Telemetry from {}: frame {}, buffer {}/{}, {} behind, rotation {}us",
+       LogId{id_}, t.shown_frame, t.buffer_level, t.buffer_depth,
+       t.dropped_frames, t.rotation_us);
+  if (!frames_) {
+    return;
+  }
+  // A mirror's rotor is not the one the frame clock follows
+  if (consumer_ == slice_idx_) {
+    server_.get().report_telemetry(slice_idx_, t);
+  }
+  if (t.dropped_frames > MAX_DROPPED_FRAMES / 2) {
+    ALOG_RATE(warning, 1, "Client {} is {} frames behind, it resets at {}",
+              LogId{id_}, t.dropped_frames, MAX_DROPPED_FRAMES);
+  }
+  // Frames queued here are already late for a client that is behind, so
+  // jump it to the newest one
+  if (t.dropped_frames && frames_->stats(consumer_).lag > 1) {
+    auto skipped = frames_->skip_to_latest(consumer_);
+    ALOG_RATE(info, 1,
+              "Client {} is {} frames behind, skipped {} queued frames",
+              LogId{id_}, t.dropped_frames, skipped);
+  }
+}
+
+void Connection::start_send(RGBFrameBuffer& frames, int slice_idx,
+                            int consumer) {
+  sending_ = true;
+  post(io_->ctx_, [self = shared_from_this(), &frames, slice_idx, consumer]() {
+    auto& metrics = self->server_.get().metrics();
+    auto labels = "slice=\"" + std::to_string(slice_idx) + "\",client=\"" +
+                  self->id_str() + "\"";
+    self->wait_ns_ = &metrics.histogram("ledserve_consumer_wait_ns", labels);
+    self->write_ns_ = &metrics.histogram("ledserve_write_ns", labels);
+    self->latency_ns_ = &metrics.histogram("ledserve_latency_ns", labels);
+    self->encode_ns_ = &metrics.histogram("ledserve_encode_ns", labels);
+    self->sent_bytes_ = &metrics.counter("ledserve_sent_bytes", labels);
+    self->sent_frames_ = &metrics.counter("ledserve_sent_frames", labels);
+    self->cache_hits_ =
+        &metrics.counter("ledserve_slice_cache_hits", labels);
+    self->cache_misses_ =
+        &metrics.counter("ledserve_slice_cache_misses", labels);
+    self->slice_idx_ = slice_idx;
+    self->consumer_ = consumer;
+    self->frames_ = &frames;
+    self->pull_frames();
+  });
+}
+
+void Connection::frame_ready() {
+  post(io_->ctx_, [self = std::move(waiting_self_)]() {
+    self->waiting_ = false;
+    self->pull_frames();
+  });
+}
+
+void Connection::pull_frames() {
+  if (canceled_) {
+    return;
+  }
+  while (!waiting_ && pending_count_ < MAX_IN_FLIGHT) {
+    uint64_t num;
+    auto frame = frames_->try_pop(consumer_, num);
+    if (!frame) {
+      if (!frames_->canceled()) {
+        if (wait_start_ == std::chrono::steady_clock::time_point()) {
+          wait_start_ = std::chrono::steady_clock::now();
+        }
+        waiting_ = true;
+        waiting_self_ = shared_from_this();
+        frames_->notify_when_ready(consumer_, this);
+      }
+      break;
+    }
+    if (wait_start_ == std::chrono::steady_clock::time_point()) {
+      wait_ns_->record(0);
+    } else {
+      auto now = std::chrono::steady_clock::now();
+      wait_ns_->record(now - wait_start_);
+      if (Trace::enabled()) {
+        Trace::complete("wait for frame", to_ns(wait_start_), to_ns(now), num,
+                        slice_idx_);
       }
+      wait_start_ = std::chrono::steady_clock::time_point();
+    }
+    if (frame_num_ && num != frame_num_) {
+      ALOG_RATE(warning, 1, "Client {} fell behind, skipped {} frames",
+                LogId{id_}, num - frame_num_);
+    }
+    frame_num_ = num + 1;
+    TraceScope _("encode", num, slice_idx_);
+    auto& p = pending_[(pending_head_ + pending_count_) % MAX_IN_FLIGHT];
+    p.frame_ = std::move(frame);
+    if (!prepare(p, num)) {
+      p.frame_.reset();
       cancel();
+      return;
+    }
+    ++pending_count_;
+  }
+  if (!writing_ && pending_count_) {
+    write_next();
+  }
+}
+
+// Encodes the slice of a rendered frame, or finds it in the show file a
+// played frame comes from. A show in the client's format is sent from the
+// file, unless it is to be compressed; a raw one is encoded from its mapping
+// like a rendered frame. Encoded slices, and their CRCs, are shared through
+// the frame's cache with other clients of the slice; only a payload coded
+// for this connection alone has its CRC taken here.
+bool Connection::prepare(Pending& p, uint64_t num) {
+  auto file = p.frame_->show();
+  p.file_ = nullptr;
+  p.sent_ = 0;
+  uint32_t crc;
+  if (file) {
+    auto& e = file->entry(p.frame_->show_frame(), slice_idx_);
+    if (file->format() == format_ && codec_ == WireCodec::NONE) {
+      p.file_ = file;
+      p.file_offset_ = e.offset;
+      p.header_ = make_frame_header(num, p.frame_->pts(), slice_idx_,
+                                    format_, e.length, e.crc);
+      return true;
     }
+    if (file->format() == format_) {
+      p.payload_ = buffer(file->payload(e), e.length);
+      crc = e.crc;
+    } else if (file->format() != WireFormat::RAW_BGR) {
+      LOG(error) << "Client " << id_str() << " wants format "
+                 << static_cast<int>(format_) << ", show " << file->path()
+                 << " is in format " << static_cast<int>(file->format());
+      return false;
+    } else {
+      p.payload_ = encoded(
+          p,
+          [&](std::vector<uint8_t>& buf) {
+            return encode_slice(file->payload(e), format_, buf);
+          },
+          crc);
+    }
+  } else {
+    p.payload_ = encoded(
+        p,
+        [&](std::vector<uint8_t>& buf) {
+          return encode_slice(*p.frame_, slice_idx_, format_, buf);
+        },
+        crc);
+  }
+  if (codec_ == WireCodec::DELTA_RLE) {
+    p.payload_ = code(p.payload_, p.coded_);
+    crc = crc32(static_cast<const uint8_t*>(p.payload_.data()),
+                p.payload_.size());
   }
-  /*
-  async_write(sock_, slice,
-              [&frames, frame, this](const std::error_code& ec, std::size_t
-  bytes) { if (!ec) { LOG(info) << "Frame " << frame_num_ << " sent to client
-  ID "
-                               << id_str() << " [" << bytes << " bytes]";
-                  ++frame_num_;
-                  this->send(frames);
-                } else if (ec != std::errc::operation_canceled) {
-                  LOG(error) << "Write Error: " << ec.message();
-                  cancel();
-                }
+  p.header_ = make_frame_header(num, p.frame_->pts(), slice_idx_, format_,
+                                p.payload_.size(), crc);
+  return true;
+}
+
+template <typename Encode>
+const_buffer Connection::encoded(Pending& p, Encode&& encode,
+                                 uint32_t& crc) {
+  bool hit;
+  auto payload = p.frame_->encoded().get(
+      slice_idx_, format_,
+      [&](std::vector<uint8_t>& buf) {
+        auto start = std::chrono::steady_clock::now();
+        auto payload = encode(buf);
+        encode_ns_->record(std::chrono::steady_clock::now() - start);
+        return payload;
+      },
+      crc, hit);
+  (hit ? cache_hits_ : cache_misses_)->add(1);
+  return payload;
+}
+
+// Codes a payload against the last one, which it then replaces. Frames are
+// written in the order they are coded, so the client decodes each against
+// the payload it decoded before.
+const_buffer Connection::code(const_buffer payload, std::vector<uint8_t>& out) {
+  auto data = static_cast<const uint8_t*>(payload.data());
+  out.resize(max_coded_size(payload.size()));
+  auto size = slice_encode(data, ref_.empty() ? nullptr : ref_.data(),
+                           payload.size(), out.data());
+  ref_.assign(data, data + payload.size());
+  return buffer(out.data(), size);
+}
+
+void Connection::write_next() {
+  writing_ = true;
+  write_start_ = std::chrono::steady_clock::now();
+  auto& p = pending_[pending_head_];
+  if (p.file_) {
+    send_from_file();
+    return;
+  }
+  // Header and payload go out in one gathered write, without copying
+  std::array<const_buffer, 2> frame = {buffer(&p.header_, sizeof(p.header_)),
+                                       p.payload_};
+  async_write(sock_, frame,
+              [this, self = shared_from_this()](const std::error_code& ec,
+                                                std::size_t bytes) {
+                on_written(ec, bytes);
               });
-  */
+}
+
+// Sends the header with MSG_MORE, so it leaves in the same segment as the
+// payload, then the payload from the page cache with sendfile(), so it is
+// never copied into user space. Waits for the socket whenever it is full.
+void Connection::send_from_file() {
+  auto& p = pending_[pending_head_];
+  auto fd = sock_.native_handle();
+  size_t total = sizeof(p.header_) + p.header_.length;
+  boost::system::error_code nb;
+  sock_.native_non_blocking(true, nb);
+  std::error_code ec = nb;
+  while (!ec && p.sent_ < total) {
+    ssize_t n;
+    if (p.sent_ < sizeof(p.header_)) {
+      n = ::send(fd, reinterpret_cast<const uint8_t*>(&p.header_) + p.sent_,
+                 sizeof(p.header_) - p.sent_, MSG_MORE | MSG_NOSIGNAL);
+    } else {
+      off_t offset = p.file_offset_ + p.sent_ - sizeof(p.header_);
+      n = ::sendfile(fd, p.file_->fd(), &offset, total - p.sent_);
+      if (n == 0) {
+        // The file was truncated under us
+        ec = std::make_error_code(std::errc::io_error);
+        break;
+      }
+    }
+    if (n >= 0) {
+      p.sent_ += n;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      sock_.async_wait(tcp::socket::wait_write,
+                       [this, self = shared_from_this()](
+                           const std::error_code& ec) {
+                         if (ec) {
+                           on_written(ec, 0);
+                         } else {
+                           send_from_file();
+                         }
+                       });
+      return;
+    } else if (errno != EINTR) {
+      ec = std::error_code(errno, std::system_category());
+    }
+  }
+  on_written(ec, p.sent_);
+}
+
+void Connection::on_written(const std::error_code& ec, std::size_t bytes) {
+  writing_ = false;
+  auto& p = pending_[pending_head_];
+  if (!ec) {
+    auto now = std::chrono::steady_clock::now();
+    write_ns_->record(now - write_start_);
+    if (Trace::enabled()) {
+      Trace::complete("write", to_ns(write_start_), to_ns(now),
+                      p.header_.frame_num, slice_idx_);
+    }
+    latency_ns_->record(now.time_since_epoch() -
+                        std::chrono::nanoseconds(p.header_.pts_ns));
+    sent_bytes_->add(bytes);
+    sent_frames_->add(1);
+    ALOG(debug, "Frame {} sent to client ID {} [{} bytes]",
+         p.header_.frame_num, LogId{id_}, bytes);
+    p.frame_.reset();
+    pending_head_ = (pending_head_ + 1) % MAX_IN_FLIGHT;
+    --pending_count_;
+    pull_frames();
+  } else {
+    if (ec != std::errc::operation_canceled) {
+      LOG(error) << "Write Error: " << ec.message();
+    }
+    cancel();
+  }
 }
 
 std::string Connection::id_str() const {
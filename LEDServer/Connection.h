@@ -1,19 +1,32 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <vector>
+#include "LEDCommon/Protocol.h"
+#include "Metrics.h"
+#include "ShowFile.h"
 #include "Types.h"
 #include "FrameBuffer.h"
 
 class LEDServer;
 class IOThread;
 
-class Connection : public std::enable_shared_from_this<Connection> {
+// Streams one slice to one client. All socket work runs on the connection's
+// IOThread without blocking it: frames are popped as they become available
+// and sent with async_write, up to MAX_IN_FLIGHT frames ahead, so one IO
+// thread can serve many connections.
+class Connection : public std::enable_shared_from_this<Connection>,
+                   public FrameWaiter {
  public:
   typedef uint8_t id_t[6];
   typedef unsigned long key_t;
 
+  // Frames a connection holds between popping them and finishing their write
+  static const int MAX_IN_FLIGHT = 2;
+
   Connection(LEDServer& server, boost::asio::ip::tcp::socket& sock,
              std::shared_ptr<IOThread>);
   ~Connection();
@@ -24,21 +37,82 @@ class Connection : public std::enable_shared_from_this<Connection> {
   void post_cancel();
   void set_ready(bool ready) { ready_ = ready; }
   bool ready() const { return ready_; }
-  void start_send(RGBFrameBuffer& frames_, int slice_idx);
+  // consumer is the connection's frame buffer consumer: slice_idx for the
+  // slice's own client, past the slices for a mirror
+  void start_send(RGBFrameBuffer& frames_, int slice_idx, int consumer);
+  bool sending() const { return sending_; }
   key_t key() const { return key_; }
   std::string id_str() const;
 
  private:
-  void send(RGBFrameBuffer& frames);
+  struct Pending {
+    RGBFrameBuffer::FramePtr frame_;
+    std::vector<uint8_t> coded_;
+    FrameHeader header_;
+    boost::asio::const_buffer payload_;
+    // Set instead of payload_ when the payload is sent straight from a show
+    // file, at file_offset_. sent_ counts header and payload bytes.
+    const ShowFile* file_;
+    uint64_t file_offset_;
+    size_t sent_;
+  };
+
+  void frame_ready() override;
+  void read_telemetry();
+  void on_telemetry();
+  void pull_frames();
+  bool prepare(Pending& p, uint64_t num);
+  template <typename Encode>
+  boost::asio::const_buffer encoded(Pending& p, Encode&& encode,
+                                    uint32_t& crc);
+  boost::asio::const_buffer code(boost::asio::const_buffer payload,
+                                 std::vector<uint8_t>& out);
+  void write_next();
+  void send_from_file();
+  void on_written(const std::error_code& ec, std::size_t bytes);
   void cancel();
 
   std::reference_wrapper<LEDServer> server_;
   boost::asio::ip::tcp::socket sock_;
+  // Number of the frame expected next, to spot frames the buffer skipped
   uint64_t frame_num_;
   std::shared_ptr<IOThread> io_;
+  Hello hello_;
+  Telemetry telemetry_;
   id_t id_;
+  WireFormat format_;
+  WireCodec codec_;
+  // Last payload coded for the client, which the next is coded against
+  std::vector<uint8_t> ref_;
   key_t key_;
   int slice_idx_;
+  int consumer_;
   bool ready_;
+  bool sending_;
   bool canceled_;
+  RGBFrameBuffer* frames_;
+  Pending pending_[MAX_IN_FLIGHT];
+  int pending_head_;
+  int pending_count_;
+  bool writing_;
+  bool waiting_;
+  // Keeps the connection alive while registered with the frame buffer
+  std::shared_ptr<Connection> waiting_self_;
+
+  // Labeled with the slice and client, set up by start_send(). Waits are
+  // from asking the buffer for a frame to getting it, and latency is from a
+  // frame's presentation time to its write completing. wait_start_ is unset
+  // unless the connection is waiting. Encodes are counted as cache hits,
+  // where another connection encoded the payload, or misses, which are
+  // timed.
+  Histogram* wait_ns_;
+  Histogram* write_ns_;
+  Histogram* latency_ns_;
+  Histogram* encode_ns_;
+  Counter* sent_bytes_;
+  Counter* sent_frames_;
+  Counter* cache_hits_;
+  Counter* cache_misses_;
+  std::chrono::steady_clock::time_point wait_start_;
+  std::chrono::steady_clock::time_point write_start_;
 };
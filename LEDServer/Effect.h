@@ -1,24 +1,51 @@
 #pragma once
+#include <chrono>
+
 #include "Types.h"
 #include "FrameBuffer.h"
 #include "boost/asio.hpp"
 
+// Position of a frame within an effect's run
+struct FrameTime {
+  uint64_t num;                // frames since the effect started
+  std::chrono::nanoseconds t;  // time since the effect started
+};
+
 class Effect {
  public:
   Effect() : frame_count_(0) {}
   virtual ~Effect(){};
   virtual bool show_bg() { return true; }
-  virtual void draw_frame(RGBFrameBuffer::Frame& frame) = 0;
+  virtual void draw_frame(RGBFrameBuffer::Frame& frame,
+                          const FrameTime& time) = 0;
+
+  // Effects returning true are drawn through draw_tile() instead, which
+  // must only write pixels inside the tile and derive them from the tile and
+  // time alone. Tiles of one frame, and different frames, may then be drawn
+  // concurrently and out of order.
+  virtual bool tiled() { return false; }
+  virtual void draw_tile(RGBFrameBuffer::Frame&, const Tile&,
+                         const FrameTime&) {}
 
  protected:
   uint64_t frame_count_;
 };
 
+// Base for effects that compute each pixel from its position and the frame
+// time, with no state carried between frames
+class TiledEffect : public Effect {
+ public:
+  bool tiled() { return true; }
+  void draw_frame(RGBFrameBuffer::Frame& frame, const FrameTime& time) {
+    draw_tile(frame, Tile{0, 0, Config::W, Config::H}, time);
+  }
+};
+
 class Test : public Effect {
  public:
   Test() {}
 
-  void draw_frame(RGBFrameBuffer::Frame& frame) {
+  void draw_frame(RGBFrameBuffer::Frame& frame, const FrameTime&) {
     for (int x = 0; x < Config::W; ++x) {
       for (int y = 0; y < Config::H; ++y) {
         if (x % 8 == 0 || y % 8 == 6) {
@@ -31,48 +58,50 @@ class Test : public Effect {
   }
 };
 
-/*
 #include "ColorSpace.h"
 
-class RainbowHSV : public Effect {
+class RainbowHSV : public TiledEffect {
  public:
-  void draw_frame() {
-    Canvas<W, H> _(this->bufs_);
-    for (int x = 0; x < W; ++x) {
-      for (int y = 0; y < H; ++y) {
+  void draw_tile(RGBFrameBuffer::Frame& frame, const Tile& tile,
+                 const FrameTime&) {
+    for (int x = tile.x0; x < tile.x1; ++x) {
+      for (int y = tile.y0; y < tile.y1; ++y) {
         ColorSpace::Rgb rgb;
-        ColorSpace::Hsv((y % Config::STRIP_H) * 360 / Config::STRIP_H, 1, 1).ToRgb(&rgb);
-        _[x][y] = rgb;
+        ColorSpace::Hsv((y % Config::STRIP_H) * 360 / Config::STRIP_H, 1, 1)
+            .ToRgb(&rgb);
+        frame.pixel(x, y) = rgb;
       }
     }
   }
 };
 
-class RainbowTwistHSV : public Effect {
+class RainbowTwistHSV : public TiledEffect {
  public:
-  void draw_frame() {
-    Canvas<W, H> _(this->bufs_);
-    for (int x = 0; x < Config::W; ++x) {
-      for (int y = 0; y < Config::H; ++y) {
+  void draw_tile(RGBFrameBuffer::Frame& frame, const Tile& tile,
+                 const FrameTime&) {
+    for (int x = tile.x0; x < tile.x1; ++x) {
+      for (int y = tile.y0; y < tile.y1; ++y) {
         ColorSpace::Rgb rgb;
-        ColorSpace::Hsv(((x + y) % Config::STRIP_H) * 360 / Config::STRIP_H, 1, 1).ToRgb(&rgb);
-        _[x][y] = rgb;
+        ColorSpace::Hsv(((x + y) % Config::STRIP_H) * 360 / Config::STRIP_H,
+                        1, 1)
+            .ToRgb(&rgb);
+        frame.pixel(x, y) = rgb;
       }
     }
   }
 };
 
-class RainbowHSL : public Effect {
+class RainbowHSL : public TiledEffect {
  public:
-  void draw_frame() {
-    Canvas<W, H> _(this->bufs_);
-    for (int x = 0; x < W; ++x) {
-      for (int y = 0; y < H; ++y) {
+  void draw_tile(RGBFrameBuffer::Frame& frame, const Tile& tile,
+                 const FrameTime&) {
+    for (int x = tile.x0; x < tile.x1; ++x) {
+      for (int y = tile.y0; y < tile.y1; ++y) {
         ColorSpace::Rgb rgb;
-        ColorSpace::Hsl((y % STRIP_H) * 360 / STRIP_H, 100, 50).ToRgb(&rgb);
-        _[x][y] = rgb;
+        ColorSpace::Hsl((y % Config::STRIP_H) * 360 / Config::STRIP_H, 100, 50)
+            .ToRgb(&rgb);
+        frame.pixel(x, y) = rgb;
       }
     }
   }
 };
-*/
\ No newline at end of file
@@ -1,77 +1,350 @@
 #pragma once
 
-#include <condition_variable>
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <mutex>
-#include <map>
 
+#include "Futex.h"
+#include "Trace.h"
 #include "Types.h"
 
+// Asynchronous consumers implement this to be told when a frame they asked
+// for can be popped without blocking. frame_ready() runs on the producer
+// thread, or on the registering thread if the frame is already there.
+class FrameWaiter {
+ public:
+  virtual ~FrameWaiter() {}
+  virtual void frame_ready() = 0;
+};
+
+// Fixed ring of MAX_FRAMES slots shared by one producer and MAX_CLIENTS
+// consumers, numbered 0..MAX_CLIENTS-1. Frame N lives in slot N % MAX_FRAMES
+// until every consumer has popped it or the producer needs the slot back.
+// Each consumer has a read cursor kept here, and each slot has its own futex,
+// so a consumer only wakes when the frame it is waiting for is published and
+// the producer only wakes when the slot it needs is released.
+//
+// The producer only waits for consumers whose LagPolicy is BLOCK. Frames a
+// DROP_OLDEST consumer has not popped are overwritten when their slot is
+// needed, and it resumes from the oldest frame left. A SKIP_TO_LATEST
+// consumer always jumps to the newest published frame, releasing the frames
+// it skipped. Frames lost either way are counted per consumer.
 template <typename T, size_t MAX_FRAMES, size_t MAX_CLIENTS>
 class FrameBuffer {
  public:
   typedef T Frame;
   typedef std::shared_ptr<T> FramePtr;
-  constexpr size_t max_frames() { return MAX_FRAMES; }
-  constexpr size_t max_clients() { return MAX_CLIENTS; }
+  static constexpr size_t max_frames() { return MAX_FRAMES; }
+  static constexpr size_t max_clients() { return MAX_CLIENTS; }
 
-  FrameBuffer() : canceled_(false) {}
+  struct ConsumerStats {
+    LagPolicy policy;
+    uint64_t next;      // Number of the next frame to pop
+    uint64_t lag;       // Frames published but not popped yet
+    uint64_t max_lag;
+    uint64_t skipped;   // Frames overwritten or skipped before being popped
+  };
+
+  FrameBuffer() : published_(0), blocking_(ALL), canceled_(false) {}
   ~FrameBuffer() {}
 
+  // Not safe against concurrent push/pop
   void clear() {
-    std::scoped_lock _(lock_);
-    frames_.clear();
+    for (auto& s : slots_) {
+      s.frame_.reset();
+      s.pending_.store(0);
+      s.num_.store(EMPTY);
+      s.futex_.notify_all();
+    }
+    for (auto& c : consumers_) {
+      c.next_.store(0);
+      c.max_lag_.store(0);
+      c.skipped_.store(0);
+    }
+    published_.store(0);
+  }
+
+  void set_policy(size_t consumer, LagPolicy policy) {
+    consumers_[consumer].policy_.store(policy);
+    if (policy == LagPolicy::BLOCK) {
+      blocking_.fetch_or(bit(consumer));
+    } else {
+      blocking_.fetch_and(~bit(consumer));
+    }
+    // The producer may be waiting on this consumer
+    for (auto& s : slots_) {
+      s.futex_.notify_all();
+    }
   }
 
   void push(uint64_t num, std::shared_ptr<T> frame) {
-    std::unique_lock lock(lock_);
-    while (!canceled_ && frames_.size() == MAX_FRAMES) {
-      size_cond_.wait(lock);
+    auto& s = slot(num);
+    uint64_t blocked_ns = 0;
+    while (true) {
+      auto gen = s.futex_.generation();
+      if (canceled_) {
+        return;
+      }
+      if (!(s.pending_.load(std::memory_order_acquire) & blocking_.load())) {
+        break;
+      }
+      if (!blocked_ns && Trace::enabled()) {
+        blocked_ns = Trace::now_ns();
+      }
+      s.futex_.wait(gen);
+    }
+    if (blocked_ns) {
+      Trace::complete("push blocked", blocked_ns, Trace::now_ns(), num);
+    }
+    // Dropped outside the lock, as it may return the frame to its pool
+    FramePtr evicted;
+    {
+      std::scoped_lock _(s.lock_);
+      evicted = std::move(s.frame_);
+      s.frame_ = std::move(frame);
+      s.pending_.store(ALL, std::memory_order_relaxed);
+      s.num_.store(num, std::memory_order_relaxed);
+    }
+    published_.store(num + 1);
+    s.futex_.notify_all();
+    if (s.has_waiters_.load()) {
+      notify_waiters(s);
+    }
+  }
+
+  // Pops the consumer's next frame and sets frame_num to its number, blocking
+  // until it is published. Returns an empty FramePtr if canceled first.
+  FramePtr pop(size_t consumer, uint64_t& frame_num) {
+    while (true) {
+      auto next = consumers_[consumer].next_.load();
+      auto& s = slot(next);
+      auto gen = s.futex_.generation();
+      if (auto frame = try_pop(consumer, frame_num)) {
+        return frame;
+      }
+      if (canceled_) {
+        return FramePtr();
+      }
+      // Skipping ahead moved the cursor to another slot
+      if (consumers_[consumer].next_.load() == next) {
+        s.futex_.wait(gen);
+      }
     }
-    frames_[num] = FrameRef(num, frame);
-    size_cond_.notify_all();
   }
 
-  FramePtr pop(uint64_t frame_num) {
-    std::unique_lock lock(lock_);
-    while (!canceled_ &&
-            (frames_.empty() || frames_.rbegin()->first < frame_num)) {
-        size_cond_.wait(lock);
+  // Returns an empty FramePtr if the consumer's next frame has not been
+  // published yet
+  FramePtr try_pop(size_t consumer, uint64_t& frame_num) {
+    auto& c = consumers_[consumer];
+    if (c.policy_.load(std::memory_order_relaxed) == LagPolicy::SKIP_TO_LATEST) {
+      skip_to_latest(consumer);
     }
-    auto& frameref = frames_[frame_num];
-    auto frame = frameref.frame_;
-    if (--frameref.refs_ == 0) {
-        frames_.erase(frame_num);
-        size_cond_.notify_all();
+    auto next = c.next_.load(std::memory_order_relaxed);
+    while (true) {
+      auto& s = slot(next);
+      std::unique_lock lock(s.lock_);
+      auto num = s.num_.load(std::memory_order_relaxed);
+      if (num == next) {
+        auto pending = s.pending_.load(std::memory_order_relaxed) & ~bit(consumer);
+        s.pending_.store(pending, std::memory_order_release);
+        FramePtr frame;
+        if (pending) {
+          frame = s.frame_;
+        } else {
+          frame = std::move(s.frame_);
+          s.num_.store(EMPTY, std::memory_order_relaxed);
+        }
+        lock.unlock();
+        if (!(pending & blocking_.load())) {
+          s.futex_.notify_all();
+        }
+        auto lag = published_.load(std::memory_order_relaxed) - next;
+        if (lag > c.max_lag_.load(std::memory_order_relaxed)) {
+          c.max_lag_.store(lag, std::memory_order_relaxed);
+        }
+        c.next_.store(next + 1, std::memory_order_release);
+        frame_num = next;
+        return frame;
+      }
+      if (num == EMPTY || num < next) {
+        c.next_.store(next, std::memory_order_release);
+        return FramePtr();
+      }
+      // Overwritten before we got to it, along with every frame up to the
+      // oldest one still in the ring
+      lock.unlock();
+      auto oldest = published_.load() - MAX_FRAMES;
+      Trace::instant("frames overwritten", next, consumer, oldest - next);
+      next = skip(c, next, oldest);
     }
-    return frame;
   }
 
-  void cancel() {
+  // Moves the consumer's cursor to the newest published frame, whatever its
+  // policy, and returns the number of frames skipped. Must be called from
+  // the consumer's own thread.
+  uint64_t skip_to_latest(size_t consumer) {
+    auto& c = consumers_[consumer];
+    auto next = c.next_.load(std::memory_order_relaxed);
+    auto published = published_.load();
+    if (published <= next + 1) {
+      return 0;
+    }
+    release(consumer, next, published - 1);
+    skip(c, next, published - 1);
+    Trace::instant("skipped to latest", next, consumer, published - 1 - next);
+    return published - 1 - next;
+  }
+
+  // Calls waiter->frame_ready() once, when the consumer's next frame can be
+  // popped or the buffer is canceled. A consumer has one waiter per slot: one
+  // left by a canceled client of the consumer is displaced by the client
+  // replacing it, and told at once so it can let go.
+  void notify_when_ready(size_t consumer, FrameWaiter* waiter) {
+    auto next = consumers_[consumer].next_.load();
+    auto& s = slot(next);
+    bool ready;
+    FrameWaiter* displaced = nullptr;
     {
-      std::scoped_lock _(lock_);
-      canceled_ = true;
+      std::scoped_lock _(s.lock_);
+      // Pairs with the published_ store and has_waiters_ load in push(), so
+      // either push() sees the waiter or we see the frame
+      s.has_waiters_.store(true);
+      ready = canceled_ || published_.load() > next;
+      if (!ready) {
+        if (s.waiting_ & bit(consumer)) {
+          displaced = s.waiters_[consumer];
+        }
+        s.waiters_[consumer] = waiter;
+        s.waiting_ |= bit(consumer);
+      } else if (!s.waiting_) {
+        s.has_waiters_.store(false);
+      }
+    }
+    if (displaced && displaced != waiter) {
+      displaced->frame_ready();
+    }
+    if (ready) {
+      waiter->frame_ready();
     }
-    size_cond_.notify_all();
   }
 
+  ConsumerStats stats(size_t consumer) const {
+    auto& c = consumers_[consumer];
+    auto next = c.next_.load();
+    auto published = published_.load();
+    return ConsumerStats{c.policy_.load(), next,
+                         published > next ? published - next : 0,
+                         c.max_lag_.load(), c.skipped_.load()};
+  }
+
+  void cancel() {
+    canceled_ = true;
+    for (auto& s : slots_) {
+      s.futex_.notify_all();
+      notify_waiters(s);
+    }
+  }
+
+  bool canceled() const { return canceled_; }
+
  private:
-  struct FrameRef {
-    FrameRef() : refs_(0), num_(-1) {}
-    FrameRef(uint64_t num, FramePtr frame)
-        : refs_(MAX_CLIENTS), num_(num), frame_(frame) {}
-    FrameRef(const FrameRef& fr)
-        : refs_(fr.refs_), num_(fr.num_), frame_(fr.frame_) {}
-
-    int refs_;
-    uint64_t num_;
+  static_assert(MAX_CLIENTS <= 64);
+  static constexpr uint64_t EMPTY = ~0ULL;
+  static constexpr uint64_t ALL =
+      MAX_CLIENTS == 64 ? ~0ULL : (1ULL << MAX_CLIENTS) - 1;
+
+  struct alignas(64) Slot {
+    Slot() : num_(EMPTY), pending_(0), has_waiters_(false), waiting_(0) {}
+
+    std::atomic<uint64_t> num_;
+    // Consumers that have not popped the frame yet, one bit each
+    std::atomic<uint64_t> pending_;
+    // Guards frame_ against being replaced while a consumer copies it, and
+    // the waiter list
+    std::mutex lock_;
     FramePtr frame_;
+    Futex futex_;
+    // Asynchronous consumers waiting for the next frame in this slot, by
+    // consumer, and one bit each for those that are
+    std::atomic<bool> has_waiters_;
+    FrameWaiter* waiters_[MAX_CLIENTS];
+    uint64_t waiting_;
+  };
+
+  // The cursor and counters are written only by the consumer's own thread
+  struct alignas(64) Consumer {
+    Consumer()
+        : policy_(LagPolicy::BLOCK), next_(0), max_lag_(0), skipped_(0) {}
+
+    std::atomic<LagPolicy> policy_;
+    std::atomic<uint64_t> next_;
+    std::atomic<uint64_t> max_lag_;
+    std::atomic<uint64_t> skipped_;
   };
 
-  std::mutex lock_;
-  std::condition_variable size_cond_;
-  std::map<uint64_t, FrameRef> frames_;
-  bool canceled_;
+  static constexpr uint64_t bit(size_t consumer) { return 1ULL << consumer; }
+
+  Slot& slot(uint64_t num) { return slots_[num % MAX_FRAMES]; }
+
+  uint64_t skip(Consumer& c, uint64_t from, uint64_t to) {
+    c.skipped_.fetch_add(to - from, std::memory_order_relaxed);
+    c.next_.store(to, std::memory_order_release);
+    return to;
+  }
+
+  // Gives up the consumer's claim on frames [from, to) still in the ring
+  void release(size_t consumer, uint64_t from, uint64_t to) {
+    from = std::max(from, to > MAX_FRAMES ? to - MAX_FRAMES : 0);
+    for (auto num = from; num < to; ++num) {
+      auto& s = slot(num);
+      FramePtr released;
+      uint64_t pending;
+      {
+        std::scoped_lock _(s.lock_);
+        pending = s.pending_.load(std::memory_order_relaxed);
+        if (s.num_.load(std::memory_order_relaxed) != num ||
+            !(pending & bit(consumer))) {
+          continue;
+        }
+        pending &= ~bit(consumer);
+        s.pending_.store(pending, std::memory_order_release);
+        if (!pending) {
+          released = std::move(s.frame_);
+          s.num_.store(EMPTY, std::memory_order_relaxed);
+        }
+      }
+      if (!(pending & blocking_.load())) {
+        s.futex_.notify_all();
+      }
+    }
+  }
+
+  void notify_waiters(Slot& s) {
+    FrameWaiter* waiters[MAX_CLIENTS];
+    size_t count = 0;
+    {
+      std::scoped_lock _(s.lock_);
+      for (size_t c = 0; c < MAX_CLIENTS; ++c) {
+        if (s.waiting_ & bit(c)) {
+          waiters[count++] = s.waiters_[c];
+        }
+      }
+      s.waiting_ = 0;
+      s.has_waiters_.store(false);
+    }
+    for (size_t i = 0; i < count; ++i) {
+      waiters[i]->frame_ready();
+    }
+  }
+
+  Slot slots_[MAX_FRAMES];
+  Consumer consumers_[MAX_CLIENTS];
+  // One past the number of the newest frame pushed
+  std::atomic<uint64_t> published_;
+  // Consumers with LagPolicy::BLOCK, one bit each
+  std::atomic<uint64_t> blocking_;
+  std::atomic<bool> canceled_;
 };
 
-typedef FrameBuffer<RGBFrame, 16, Config::SLICE_COUNT> RGBFrameBuffer;
+typedef FrameBuffer<RGBFrame, 16, Config::CLIENT_COUNT> RGBFrameBuffer;
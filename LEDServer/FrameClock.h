@@ -0,0 +1,151 @@
+#pragma once
+
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+
+// A frame rate as an exact fraction, so frame times are computed from the
+// frame number and never accumulate rounding drift
+struct FrameRate {
+  uint64_t frames;
+  uint64_t secs;
+
+  static constexpr FrameRate fps(uint64_t fps) { return FrameRate{fps, 1}; }
+  // One frame per revolution of a display spinning at rpm
+  static constexpr FrameRate per_revolution(uint64_t rpm) {
+    return FrameRate{rpm, 60};
+  }
+
+  // Time of frame num after frame 0
+  std::chrono::nanoseconds time(uint64_t num) const {
+    const unsigned __int128 NS = 1000000000;
+    return std::chrono::nanoseconds(
+        static_cast<int64_t>(num * NS * secs / frames));
+  }
+
+  std::chrono::nanoseconds period() const { return time(1); }
+  uint64_t frames_in(std::chrono::seconds s) const {
+    return s.count() * frames / secs;
+  }
+  double hz() const { return static_cast<double>(frames) / secs; }
+};
+
+// Paces the producer to a FrameRate. Frame N is due at a fixed offset of
+// N periods from the clock's epoch; wait() sleeps until then with an
+// absolute-deadline timer, so lateness in one frame is not carried into the
+// next. A frame that is ready after its deadline counts as a miss, and one
+// that is more than a period late moves the epoch forward instead of
+// rushing the frames behind it out in a burst.
+//
+// Only the producer thread may use a clock.
+class FrameClock {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Stats {
+    uint64_t frames;
+    uint64_t missed;
+    uint64_t resyncs;
+    std::chrono::nanoseconds max_late;
+    // How far past the deadline wait() actually returned
+    std::chrono::nanoseconds mean_jitter;
+    std::chrono::nanoseconds max_jitter;
+  };
+
+  explicit FrameClock(FrameRate rate)
+      : rate_(rate),
+        started_(false),
+        base_(0),
+        frames_(0),
+        missed_(0),
+        resyncs_(0),
+        max_late_(0),
+        total_jitter_(0),
+        max_jitter_(0) {}
+
+  const FrameRate& rate() const { return rate_; }
+
+  // Frames from num on follow the new rate, starting at num's deadline
+  void set_rate(FrameRate rate, uint64_t num) {
+    if (started_) {
+      epoch_ = deadline(num);
+      base_ = num;
+    }
+    rate_ = rate;
+  }
+
+  // Starts the clock on first use, with frame num due now
+  Clock::time_point deadline(uint64_t num) {
+    if (!started_) {
+      started_ = true;
+      epoch_ = Clock::now();
+      base_ = num;
+    }
+    return epoch_ + rate_.time(num - base_);
+  }
+
+  // Called once frame num is ready; returns at its deadline
+  void wait(uint64_t num) {
+    auto due = deadline(num);
+    auto late = Clock::now() - due;
+    ++frames_;
+    if (late > std::chrono::nanoseconds::zero()) {
+      ++missed_;
+      max_late_ = std::max(max_late_, late);
+      if (late > rate_.period()) {
+        ++resyncs_;
+        epoch_ += late;
+      }
+      return;
+    }
+    sleep_until(due);
+    auto jitter = Clock::now() - due;
+    total_jitter_ += jitter;
+    max_jitter_ = std::max(max_jitter_, jitter);
+  }
+
+  Stats stats() const {
+    auto slept = static_cast<int64_t>(frames_ - missed_);
+    return Stats{frames_,
+                 missed_,
+                 resyncs_,
+                 max_late_,
+                 slept ? total_jitter_ / slept : std::chrono::nanoseconds(0),
+                 max_jitter_};
+  }
+
+ private:
+  // The kernel timer wakes a little late; the rest is spun off
+  static constexpr std::chrono::microseconds SPIN{50};
+
+  static void sleep_until(Clock::time_point t) {
+    auto wake = t - SPIN;
+    if (Clock::now() < wake) {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    wake.time_since_epoch())
+                    .count();
+      // steady_clock is CLOCK_MONOTONIC
+      timespec ts{static_cast<time_t>(ns / 1000000000),
+                  static_cast<long>(ns % 1000000000)};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+             EINTR) {
+      }
+    }
+    while (Clock::now() < t) {
+    }
+  }
+
+  FrameRate rate_;
+  bool started_;
+  Clock::time_point epoch_;
+  uint64_t base_;
+  uint64_t frames_;
+  uint64_t missed_;
+  uint64_t resyncs_;
+  std::chrono::nanoseconds max_late_;
+  std::chrono::nanoseconds total_jitter_;
+  std::chrono::nanoseconds max_jitter_;
+};
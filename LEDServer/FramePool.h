@@ -0,0 +1,197 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cassert>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "Types.h"
+
+// Fixed set of preallocated frames handed out as shared_ptrs. Frame storage
+// and the shared_ptr control blocks live in one pre-faulted mapping, so
+// acquiring a frame never touches the heap. A frame returns to the pool when
+// its last reference is dropped, on whichever thread that happens, and
+// T::recycle() then drops whatever was derived from its old contents.
+template <typename T>
+class FramePool {
+ public:
+  typedef std::shared_ptr<T> FramePtr;
+
+  struct Stats {
+    size_t capacity;
+    size_t in_use;
+    size_t high_water;
+    uint64_t stalls;
+  };
+
+  FramePool(size_t capacity, bool hugepages, bool lock)
+      : capacity_(capacity),
+        in_use_(0),
+        high_water_(0),
+        stalls_(0),
+        hugepages_(false),
+        locked_(false),
+        canceled_(false) {
+    map(hugepages);
+    if (lock) {
+      locked_ = mlock(slots_, map_size_) == 0;
+    }
+    free_.reserve(capacity_);
+    for (size_t i = 0; i < capacity_; ++i) {
+      new (&slots_[i].frame_) T();
+      free_.push_back(capacity_ - 1 - i);
+    }
+  }
+
+  ~FramePool() {
+    assert(in_use_ == 0);
+    for (size_t i = 0; i < capacity_; ++i) {
+      slots_[i].frame_.~T();
+    }
+    if (locked_) {
+      munlock(slots_, map_size_);
+    }
+    munmap(slots_, map_size_);
+  }
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // Blocks while every frame is in use. Returns an empty FramePtr if canceled.
+  FramePtr acquire() {
+    size_t idx;
+    {
+      std::unique_lock lock(lock_);
+      if (!canceled_ && free_.empty()) {
+        ++stalls_;
+        while (!canceled_ && free_.empty()) {
+          free_cond_.wait(lock);
+        }
+      }
+      if (canceled_) {
+        return FramePtr();
+      }
+      idx = free_.back();
+      free_.pop_back();
+      high_water_ = std::max(high_water_, ++in_use_);
+    }
+    return FramePtr(&slots_[idx].frame_, NoDelete(), SlotAllocator<T>(this, idx));
+  }
+
+  void cancel() {
+    {
+      std::scoped_lock _(lock_);
+      canceled_ = true;
+    }
+    free_cond_.notify_all();
+  }
+
+  Stats stats() {
+    std::scoped_lock _(lock_);
+    return Stats{capacity_, in_use_, high_water_, stalls_};
+  }
+
+  size_t capacity() const { return capacity_; }
+  bool hugepages() const { return hugepages_; }
+  bool locked() const { return locked_; }
+
+ private:
+  static const size_t CTRL_SIZE = 64;
+  static const size_t HUGEPAGE_SIZE = 2 * 1024 * 1024;
+
+  struct alignas(64) Slot {
+    T frame_;
+    alignas(std::max_align_t) unsigned char ctrl_[CTRL_SIZE];
+  };
+
+  struct NoDelete {
+    void operator()(T*) const {}
+  };
+
+  // Places the shared_ptr control block in the slot's ctrl_ area. The slot is
+  // returned to the pool from deallocate(), which runs only after the control
+  // block has been destroyed.
+  template <typename U>
+  struct SlotAllocator {
+    typedef U value_type;
+    template <typename V>
+    struct rebind {
+      typedef SlotAllocator<V> other;
+    };
+
+    SlotAllocator(FramePool* pool, size_t idx) : pool_(pool), idx_(idx) {}
+    template <typename V>
+    SlotAllocator(const SlotAllocator<V>& a) : pool_(a.pool_), idx_(a.idx_) {}
+
+    U* allocate([[maybe_unused]] size_t n) {
+      static_assert(sizeof(U) <= CTRL_SIZE);
+      static_assert(alignof(U) <= alignof(std::max_align_t));
+      assert(n == 1);
+      return reinterpret_cast<U*>(pool_->slots_[idx_].ctrl_);
+    }
+    void deallocate(U*, size_t) { pool_->release(idx_); }
+
+    template <typename V>
+    bool operator==(const SlotAllocator<V>& a) const {
+      return pool_ == a.pool_ && idx_ == a.idx_;
+    }
+    template <typename V>
+    bool operator!=(const SlotAllocator<V>& a) const {
+      return !(*this == a);
+    }
+
+    FramePool* pool_;
+    size_t idx_;
+  };
+
+  void map(bool hugepages) {
+    size_t size = capacity_ * sizeof(Slot);
+    void* p = MAP_FAILED;
+    if (hugepages) {
+      map_size_ = (size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+      p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1,
+               0);
+      hugepages_ = p != MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+      map_size_ = size;
+      p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+      if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+    }
+    slots_ = static_cast<Slot*>(p);
+  }
+
+  void release(size_t idx) {
+    slots_[idx].frame_.recycle();
+    {
+      std::scoped_lock _(lock_);
+      free_.push_back(idx);
+      --in_use_;
+    }
+    free_cond_.notify_one();
+  }
+
+  size_t capacity_;
+  size_t map_size_;
+  Slot* slots_;
+  std::mutex lock_;
+  std::condition_variable free_cond_;
+  std::vector<size_t> free_;
+  size_t in_use_;
+  size_t high_water_;
+  uint64_t stalls_;
+  bool hugepages_;
+  bool locked_;
+  bool canceled_;
+};
+
+typedef FramePool<RGBFrame> RGBFramePool;
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+
+// Wakeup channel over a single Linux futex word. Waiters read the current
+// generation, check their own condition, then wait() on that generation; any
+// notify_all() in between makes the wait return immediately, so no wakeup is
+// lost. notify_all() skips the syscall when nobody is sleeping.
+class Futex {
+ public:
+  Futex() : gen_(0), waiters_(0) {}
+
+  uint32_t generation() const { return gen_.load(); }
+
+  void wait(uint32_t gen) {
+    waiters_.fetch_add(1);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&gen_), FUTEX_WAIT_PRIVATE,
+            gen, nullptr, nullptr, 0);
+    waiters_.fetch_sub(1);
+  }
+
+  // As wait(), but returns after timeout at the latest
+  void wait(uint32_t gen, std::chrono::nanoseconds timeout) {
+    timespec ts{static_cast<time_t>(timeout.count() / 1000000000),
+                static_cast<long>(timeout.count() % 1000000000)};
+    waiters_.fetch_add(1);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&gen_), FUTEX_WAIT_PRIVATE,
+            gen, &ts, nullptr, 0);
+    waiters_.fetch_sub(1);
+  }
+
+  void notify_all() {
+    gen_.fetch_add(1);
+    if (waiters_.load()) {
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&gen_),
+              FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+  }
+
+ private:
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+  std::atomic<uint32_t> gen_;
+  std::atomic<uint32_t> waiters_;
+};
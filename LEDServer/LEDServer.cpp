@@ -5,8 +5,12 @@
 #include <boost/log/expressions.hpp>
 #include <boost/log/trivial.hpp>
 #include <cassert>
+#include <ctime>
 #include <unordered_map>
 
+#include "AsyncLog.h"
+#include "Trace.h"
+
 #define LOG(X) BOOST_LOG_TRIVIAL(X)
 
 using namespace boost::asio;
@@ -14,6 +18,37 @@ using namespace boost::asio::ip;
 
 namespace {
 const char* TAG = "LEDServer";
+
+// The thread calling run() renders alongside the pool
+int render_threads() {
+  return std::max(1u, std::thread::hardware_concurrency()) - 1;
+}
+
+// One frame in flight per rendering core
+int render_depth() { return render_threads() + 1; }
+
+// Metrics are served here, on localhost only
+const uint16_t STATS_PORT = 5051;
+
+// Longest a trace runs before it is written
+const auto TRACE_WINDOW = std::chrono::seconds(10);
+
+uint64_t to_ns(FrameClock::Clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+// Records a producer stage that began at start in its histogram, and in the
+// trace if one is running
+void stage(Histogram& h, const char* name, FrameClock::Clock::time_point start,
+           uint64_t frame, const char* effect = nullptr) {
+  auto end = FrameClock::Clock::now();
+  h.record(end - start);
+  if (Trace::enabled()) {
+    Trace::complete(name, to_ns(start), to_ns(end), frame, -1, effect);
+  }
+}
 }  // namespace
 
 const char * Config::_slices[Config::SLICE_COUNT] = {"24-0a-c4-c0-6b-f0",
@@ -21,8 +56,18 @@ const char * Config::_slices[Config::SLICE_COUNT] = {"24-0a-c4-c0-6b-f0",
                      //"24-0a-c4-c0-4b-6c"
 };
 
+// A stalled slice loses frames rather than freezing every other slice
+const LagPolicy Config::_lag_policies[Config::SLICE_COUNT] = {
+    LagPolicy::DROP_OLDEST,
+};
+
+const std::array<Mirror, Config::MIRROR_COUNT> Config::_mirrors = {{
+    // {"24-0a-c4-c0-66-b8", 0},
+}};
+
 IOThread::IOThread()
     : guard_(make_work_guard(ctx_)), thread_([this]() {
+        Trace::set_thread_name("io");
         LOG(info) << "IO thread start: " << std::hex
                   << std::this_thread::get_id();
         ctx_.run();
@@ -31,23 +76,68 @@ IOThread::IOThread()
       }) {}
 
 LEDServer::LEDServer()
-    : frame_num_(0),
+    // Frames in the buffer, those each client holds while sending, and those
+    // being rendered
+    : frame_pool_(RGBFrameBuffer::max_frames() +
+                      RGBFrameBuffer::max_clients() *
+                          Connection::MAX_IN_FLIGHT +
+                      render_depth(),
+                  true, true),
+      renderer_(render_threads(), render_depth()),
+      clock_(FrameRate::per_revolution(Config::RPM)),
+      rotation_us_(0),
+      followed_us_(0),
+      telemetry_{},
+      frame_num_(0),
+      acquire_ns_(metrics_.histogram("ledserve_acquire_ns")),
+      render_ns_(nullptr),
+      push_ns_(metrics_.histogram("ledserve_push_ns")),
       shutdown_(false),
       signals_(main_io_, SIGINT, SIGTERM),
-      accept_sock_(main_io_, tcp::endpoint(tcp::v4(), 5050)) {}
+      stats_signal_(main_io_, SIGUSR1),
+      stats_endpoint_(main_io_, STATS_PORT, metrics_),
+      trace_signal_(main_io_, SIGUSR2),
+      trace_timer_(main_io_),
+      accept_sock_(main_io_, tcp::endpoint(tcp::v4(), 5050)) {
+  for (int i = 0; i < Config::SLICE_COUNT; ++i) {
+    frames_.set_policy(i, Config::_lag_policies[i]);
+    metrics_.gauge(
+        "ledserve_slice_lag", [this, i]() { return frames_.stats(i).lag; },
+        "slice=\"" + std::to_string(i) + "\"");
+  }
+  for (int i = Config::SLICE_COUNT; i < Config::CLIENT_COUNT; ++i) {
+    frames_.set_policy(i, LagPolicy::SKIP_TO_LATEST);
+  }
+  // Frames out of the pool: rendering, queued or being sent
+  metrics_.gauge("ledserve_frames_in_flight",
+                 [this]() { return frame_pool_.stats().in_use; });
+  metrics_.gauge("ledserve_frames_rendering",
+                 [this]() { return renderer_.in_flight(); });
+}
 
 LEDServer::~LEDServer() { stop(); }
 
 void LEDServer::start() {
   LOG(info) << "Starting server";
+  LOG(info) << "Frame pool: " << frame_pool_.capacity() << " frames"
+            << (frame_pool_.hugepages() ? ", hugepages" : "")
+            << (frame_pool_.locked() ? ", locked" : "");
   subscribe_signals();
+  subscribe_stats_signal();
+  subscribe_trace_signal();
+  stats_endpoint_.start();
   int num_client_io_threads =
       std::max((uint)1, std::thread::hardware_concurrency() - 1);
   for (int i = 0; i < num_client_io_threads; ++i) {
     workers_.emplace_back(new IOThread());
   }
   accept();
-  main_io_thread_ = std::thread([this]() { main_io_.run(); });
+  // The thread calling start() goes on to render
+  Trace::set_thread_name("producer");
+  main_io_thread_ = std::thread([this]() {
+    Trace::set_thread_name("main io");
+    main_io_.run();
+  });
 }
 
 void LEDServer::stop() {
@@ -62,20 +152,38 @@ void LEDServer::stop() {
   LOG(debug) << "worker threads joined";
   accept_sock_.close();
   signals_.cancel();
+  stats_signal_.cancel();
+  stats_endpoint_.stop();
+  post(main_io_, [this]() {
+    trace_signal_.cancel();
+    if (Trace::enabled()) {
+      stop_trace();
+    }
+  });
   main_io_thread_.join();
   LOG(info) << "Server stopped";
 }
 
 void LEDServer::post_drop_client(std::shared_ptr<Connection> client) {
   post(main_io_, [this, client]() {
-    clients_.erase(std::remove_if(
-        clients_.begin(), clients_.end(),
-        [&](auto& c) { return c->id_str() == client->id_str(); }));
+    clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+                                  [&](auto& c) {
+                                    return c->id_str() == client->id_str();
+                                  }),
+                   clients_.end());
+    // Its telemetry read keeps it alive until the socket is closed
+    client->post_cancel();
   });
 }
 
 void LEDServer::post_connection_error(std::shared_ptr<Connection> client) {
-  post(main_io_, [this, client]() { clients_.clear(); });
+  post(main_io_, [this, client]() {
+    for (auto& c : clients_) {
+      c->post_cancel();
+    }
+    client->post_cancel();
+    clients_.clear();
+  });
 }
 
 bool LEDServer::all_clients_ready() {
@@ -101,8 +209,7 @@ void LEDServer::post_client_ready(std::shared_ptr<Connection> client) {
       post_connection_error(client);
       return;
     }
-    if (std::find(Config::_slices, std::end(Config::_slices), client->id_str()) ==
-        std::end(Config::_slices)) {
+    if (consumer_index(client->id_str()) < 0) {
       post_drop_client(client);
       return;
     }
@@ -148,6 +255,7 @@ void LEDServer::subscribe_signals() {
     if (!ec) {
       LOG(info) << "Received signal " << signal_number;
       shutdown_ = true;
+      frame_pool_.cancel();
       frames_.cancel();
     } else {
       LOG(error) << "Signal listen error: " << ec.message();
@@ -155,18 +263,258 @@ void LEDServer::subscribe_signals() {
   });
 }
 
-int LEDServer::slice_index(const std::string& client_id) {
+void LEDServer::subscribe_stats_signal() {
+  stats_signal_.async_wait([this](const std::error_code& ec, int) {
+    if (!ec) {
+      LOG(info) << "Metrics:\n" << metrics_.dump();
+      subscribe_stats_signal();
+    }
+  });
+}
+
+void LEDServer::subscribe_trace_signal() {
+  trace_signal_.async_wait([this](const std::error_code& ec, int) {
+    if (ec) {
+      return;
+    }
+    if (Trace::enabled()) {
+      stop_trace();
+    } else {
+      LOG(info) << "Trace started";
+      Trace::start();
+      trace_timer_.expires_after(TRACE_WINDOW);
+      trace_timer_.async_wait([this](const std::error_code& ec) {
+        if (!ec) {
+          stop_trace();
+        }
+      });
+    }
+    subscribe_trace_signal();
+  });
+}
+
+// Writes the trace to the working directory
+void LEDServer::stop_trace() {
+  trace_timer_.cancel();
+  auto path = "ledserve-" + std::to_string(time(nullptr)) + ".trace.json";
+  if (!Trace::stop(path)) {
+    LOG(error) << "Can't write trace to " << path;
+  }
+}
+
+// Frame buffer consumer of a slice's client or a mirror, or -1 for clients
+// that are not configured as either
+int LEDServer::consumer_index(const std::string& client_id) {
   auto iter = std::find(Config::_slices, std::end(Config::_slices), client_id);
-  assert(iter != std::end(Config::_slices));
-  return std::distance(Config::_slices, iter);
+  if (iter != std::end(Config::_slices)) {
+    return std::distance(Config::_slices, iter);
+  }
+  for (int i = 0; i < Config::MIRROR_COUNT; ++i) {
+    if (client_id == Config::_mirrors[i].id) {
+      return Config::SLICE_COUNT + i;
+    }
+  }
+  return -1;
+}
+
+int LEDServer::consumer_slice(int consumer) {
+  return consumer < Config::SLICE_COUNT
+             ? consumer
+             : Config::_mirrors[consumer - Config::SLICE_COUNT].slice;
 }
 
+// Mirrors that connect once the slices are sending start straight away
 void LEDServer::start_sending() {
   for (auto& c : clients_) {
-    c->start_send(frames_, slice_index(c->id_str()));
+    // Others are still waiting to be dropped
+    auto consumer = consumer_index(c->id_str());
+    if (consumer >= 0 && c->ready() && !c->sending()) {
+      c->start_send(frames_, consumer_slice(consumer), consumer);
+    }
+  }
+}
+
+// Frames are stamped with their scheduled presentation time when rendering
+// starts, and pushed at that time by the frame clock
+void LEDServer::play(uint64_t frames) {
+  if (effect_->tiled()) {
+    play_pipelined(frames);
+    return;
+  }
+  for (uint64_t num = 0; num < frames && !is_shutdown(); ++num) {
+    auto t = FrameClock::Clock::now();
+    auto frame = frame_pool_.acquire();
+    if (!frame) {
+      break;
+    }
+    stage(acquire_ns_, "acquire", t, frame_num_);
+    follow_rotation();
+    frame->set_pts(to_ns(clock_.deadline(frame_num_)));
+    frame->set_show(nullptr, 0);
+    t = FrameClock::Clock::now();
+    renderer_.draw(*effect_, *frame, FrameTime{num, clock_.rate().time(num)});
+    stage(*render_ns_, "render", t, frame_num_, effect_trace_name_);
+    {
+      TraceScope _("wait for deadline", frame_num_);
+      clock_.wait(frame_num_);
+    }
+    t = FrameClock::Clock::now();
+    frames_.push(frame_num_, std::move(frame));
+    stage(push_ns_, "push", t, frame_num_++);
+  }
+}
+
+// Render time here is from submitting a frame to collecting it, which
+// includes waiting behind the frames ahead of it. A rate change applies from
+// the next frame to push, so frames are only stamped with their deadline
+// once collected, and those submitted after it are timed at the new rate.
+void LEDServer::play_pipelined(uint64_t frames) {
+  uint64_t num = 0;
+  uint64_t collected = 0;
+  std::vector<FrameClock::Clock::time_point> submitted(renderer_.depth());
+  while (!is_shutdown()) {
+    follow_rotation();
+    while (num < frames && renderer_.in_flight() < renderer_.depth()) {
+      auto frame_num = frame_num_ + renderer_.in_flight();
+      auto t = FrameClock::Clock::now();
+      auto frame = frame_pool_.acquire();
+      if (!frame) {
+        break;
+      }
+      stage(acquire_ns_, "acquire", t, frame_num);
+      frame->set_show(nullptr, 0);
+      submitted[num % submitted.size()] = FrameClock::Clock::now();
+      renderer_.submit(*effect_, std::move(frame),
+                       FrameTime{num, clock_.rate().time(num)}, frame_num);
+      ++num;
+    }
+    if (!renderer_.in_flight()) {
+      break;
+    }
+    auto frame = renderer_.collect();
+    stage(*render_ns_, "render", submitted[collected++ % submitted.size()],
+          frame_num_, effect_trace_name_);
+    frame->set_pts(to_ns(clock_.deadline(frame_num_)));
+    {
+      TraceScope _("wait for deadline", frame_num_);
+      clock_.wait(frame_num_);
+    }
+    auto t = FrameClock::Clock::now();
+    frames_.push(frame_num_, std::move(frame));
+    stage(push_ns_, "push", t, frame_num_++);
+  }
+  // Finish frames still in flight on shutdown, so none outlive the effect
+  while (renderer_.in_flight()) {
+    renderer_.collect();
   }
 }
 
+std::function<void()> LEDServer::play_show(const ShowFile& show) {
+  return [this, &show] {
+    effect_name_ = show.path();
+    play_file(show);
+    log_stats();
+  };
+}
+
+// Nothing is rendered: each frame from the pool only carries its place in
+// the show to the connections, which send its slices from the file
+void LEDServer::play_file(const ShowFile& show) {
+  for (uint64_t i = 0; i < show.frames() && !is_shutdown(); ++i) {
+    auto t = FrameClock::Clock::now();
+    auto frame = frame_pool_.acquire();
+    if (!frame) {
+      break;
+    }
+    stage(acquire_ns_, "acquire", t, frame_num_);
+    follow_rotation();
+    frame->set_pts(to_ns(clock_.deadline(frame_num_)));
+    frame->set_show(&show, i);
+    {
+      TraceScope _("wait for deadline", frame_num_);
+      clock_.wait(frame_num_);
+    }
+    t = FrameClock::Clock::now();
+    frames_.push(frame_num_, std::move(frame));
+    stage(push_ns_, "push", t, frame_num_++);
+  }
+}
+
+void LEDServer::report_telemetry(int slice, const Telemetry& t) {
+  if (t.rotation_us) {
+    rotation_us_.store(t.rotation_us, std::memory_order_relaxed);
+  }
+  std::scoped_lock _(telemetry_lock_);
+  telemetry_[slice] = t;
+}
+
+// Rotation-locked rendering: one frame per measured revolution, so frames
+// neither pile up in the clients nor run dry as the rotor speed drifts
+void LEDServer::follow_rotation() {
+  auto us = rotation_us_.load(std::memory_order_relaxed);
+  if (us == followed_us_) {
+    return;
+  }
+  followed_us_ = us;
+  auto measured = std::chrono::microseconds(us);
+  auto nominal = FrameRate::per_revolution(Config::RPM).period();
+  // Anything this far off is a sensor glitch, not the rotor
+  if (measured < nominal / 2 || measured > nominal * 2) {
+    return;
+  }
+  // Ignore changes under 0.5%, which are measurement noise
+  auto period = clock_.rate().period();
+  if (std::chrono::abs(measured - period) * 200 < period) {
+    return;
+  }
+  LOG(info) << "Following rotor: frame period " << period.count() / 1000
+            << "us -> " << us << "us";
+  clock_.set_rate(FrameRate{1000000, us}, frame_num_);
+}
+
+void LEDServer::log_stats() {
+  auto pool = frame_pool_.stats();
+  LOG(info) << "Frame pool: " << pool.in_use << "/" << pool.capacity
+            << " in use, high water " << pool.high_water << ", "
+            << pool.stalls << " stalls";
+  auto clock = clock_.stats();
+  LOG(info) << "Frame clock: " << clock.frames << " frames at "
+            << clock_.rate().hz() << " fps, " << clock.missed
+            << " missed deadlines (max " << clock.max_late.count() / 1000
+            << "us late, " << clock.resyncs << " resyncs), wakeup jitter "
+            << clock.mean_jitter.count() / 1000 << "us mean, "
+            << clock.max_jitter.count() / 1000 << "us max";
+  for (int i = 0; i < Config::SLICE_COUNT; ++i) {
+    auto lag = frames_.stats(i);
+    LOG(info) << "Slice " << i << " (" << Config::_slices[i] << "): lag "
+              << lag.lag << ", max lag " << lag.max_lag << ", "
+              << lag.skipped << " frames skipped";
+  }
+  for (int i = 0; i < Config::MIRROR_COUNT; ++i) {
+    auto lag = frames_.stats(Config::SLICE_COUNT + i);
+    LOG(info) << "Mirror of slice " << Config::_mirrors[i].slice << " ("
+              << Config::_mirrors[i].id << "): lag " << lag.lag
+              << ", max lag " << lag.max_lag << ", " << lag.skipped
+              << " frames skipped";
+  }
+  std::scoped_lock _(telemetry_lock_);
+  for (int i = 0; i < Config::SLICE_COUNT; ++i) {
+    auto& t = telemetry_[i];
+    if (!t.magic) {
+      continue;
+    }
+    LOG(info) << "Slice " << i << " client: frame " << t.shown_frame
+              << ", buffer " << static_cast<int>(t.buffer_level) << "/"
+              << static_cast<int>(t.buffer_depth) << ", "
+              << t.dropped_frames << " behind, " << t.underruns
+              << " underruns, " << t.skipped_frames
+              << " frames skipped, rotation " << t.rotation_us << "us";
+  }
+  auto log = AsyncLog::get().stats();
+  LOG(info) << "Async log: " << log.records << " records, " << log.dropped
+            << " dropped, " << log.suppressed << " rate limited";
+}
+
 void LEDServer::run(const Sequence& sequence) {
   while (true) {
     for (auto& play_effect : sequence) {
@@ -178,20 +526,28 @@ void LEDServer::run(const Sequence& sequence) {
   }
 }
 
+// Usage: ledserve [SHOW_FILE]
+// Plays the show file in a loop if one is given, or renders the show live
 int main(int argc, char* argv[]) {
   boost::log::core::get()->set_filter(boost::log::trivial::severity >=
                                       boost::log::trivial::info);
+  AsyncLog::get().set_min_severity(boost::log::trivial::info);
 
-  LEDServer server;
-  server.start();
-  Sequence show = {
-      server.play_secs<Test, 10>(),
-      //      server.play_secs<RainbowHSV, 10>(),
-      //     server.play_secs<RainbowTwistHSV, 10>(),
-      //    server.play_secs<RainbowHSL, 3>(),
-  };
-  while (!server.is_shutdown()) {
-    server.run(show);
+  // Outlives the server, whose frames refer to it
+  ShowFile show_file;
+  if (argc > 1 && !show_file.open(argv[1])) {
+    return 1;
+  }
+  {
+    LEDServer server;
+    server.start();
+    Sequence show = argc > 1 ? Sequence{server.play_show(show_file)}
+                             : make_show(server);
+    while (!server.is_shutdown()) {
+      server.run(show);
+    }
   }
+  // After the server, so its last records are written
+  AsyncLog::get().stop();
   return 0;
 }
@@ -1,14 +1,26 @@
 #pragma once
 
+#include <atomic>
 #include <boost/asio.hpp>
+#include <boost/core/demangle.hpp>
 #include <chrono>
 #include <iostream>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <typeinfo>
 #include <vector>
 
 #include "Connection.h"
 #include "Effect.h"
 #include "FrameBuffer.h"
+#include "FrameClock.h"
+#include "FramePool.h"
+#include "Metrics.h"
+#include "Renderer.h"
+#include "Show.h"
+#include "ShowFile.h"
+#include "Trace.h"
 #include "Types.h"
 
 struct IOThread {
@@ -20,8 +32,6 @@ struct IOThread {
   std::thread thread_;
 };
 
-typedef std::vector<std::function<void()>> Sequence;
-
 class LEDServer {
  public:
   LEDServer();
@@ -31,25 +41,68 @@ class LEDServer {
   void post_drop_client(std::shared_ptr<Connection> client);
   void post_connection_error(std::shared_ptr<Connection> client);
   void post_client_ready(std::shared_ptr<Connection> client);
+  // Called from connection threads with each telemetry report
+  void report_telemetry(int slice, const Telemetry& t);
+  Metrics& metrics() { return metrics_; }
   bool is_shutdown() { return shutdown_; }
   void run(const Sequence& sequence);
   template <typename Effect, size_t secs>
   std::function<void()> play_secs();
+  template <typename Effect, uint64_t frames>
+  std::function<void()> play_frames();
+  // Plays a show file rendered by ledrender. The show must outlive the
+  // server.
+  std::function<void()> play_show(const ShowFile& show);
 
  private:
   std::shared_ptr<IOThread> io_schedule();
   void accept();
   void subscribe_signals();
-  int slice_index(const std::string& client_id);
+  void subscribe_stats_signal();
+  void subscribe_trace_signal();
+  void stop_trace();
+  int consumer_index(const std::string& client_id);
+  static int consumer_slice(int consumer);
   void start_sending();
   bool all_clients_ready();
+  template <typename Effect>
+  std::function<void()> play_effect(uint64_t frames);
+  void play(uint64_t frames);
+  void play_pipelined(uint64_t frames);
+  void play_file(const ShowFile& show);
+  void follow_rotation();
+  void log_stats();
 
+  // First, so it outlives everything holding its metrics
+  Metrics metrics_;
   std::shared_ptr<Effect> effect_;
+  std::string effect_name_;
+  const char* effect_trace_name_;
+  RGBFramePool frame_pool_;
   RGBFrameBuffer frames_;
+  Renderer renderer_;
+  FrameClock clock_;
+  // Revolution period last measured by a client, which the clock follows
+  std::atomic<uint32_t> rotation_us_;
+  uint32_t followed_us_;
+  std::mutex telemetry_lock_;
+  Telemetry telemetry_[Config::SLICE_COUNT];
   uint64_t frame_num_;
+  // Producer stages: waiting for a free frame, rendering it (for the current
+  // effect) and pushing it, which blocks while a BLOCK consumer lags
+  Histogram& acquire_ns_;
+  Histogram* render_ns_;
+  Histogram& push_ns_;
   bool shutdown_;
   boost::asio::io_context main_io_;
   boost::asio::signal_set signals_;
+  // SIGUSR1 logs a snapshot of the metrics
+  boost::asio::signal_set stats_signal_;
+  StatsEndpoint stats_endpoint_;
+  // SIGUSR2 starts a trace, which ends after TRACE_WINDOW or on the next
+  // SIGUSR2
+  boost::asio::signal_set trace_signal_;
+  boost::asio::steady_timer trace_timer_;
   std::thread main_io_thread_;
   boost::asio::ip::tcp::acceptor accept_sock_;
   boost::asio::ip::tcp::endpoint accept_ep_;
@@ -57,17 +110,30 @@ class LEDServer {
   std::vector<std::shared_ptr<Connection>> clients_;
 };
 
+// The length in frames is taken when the effect starts, at the rate the
+// clock has then, which may have followed the rotor since the show began
 template <typename EffectDerived, size_t secs>
 std::function<void()> LEDServer::play_secs() {
   return [this] {
+    play_effect<EffectDerived>(
+        clock_.rate().frames_in(std::chrono::seconds(secs)))();
+  };
+}
+
+template <typename EffectDerived, uint64_t frames>
+std::function<void()> LEDServer::play_frames() {
+  return play_effect<EffectDerived>(frames);
+}
+
+template <typename EffectDerived>
+std::function<void()> LEDServer::play_effect(uint64_t frames) {
+  return [this, frames] {
     effect_ = std::make_shared<EffectDerived>();
-    auto start = std::chrono::steady_clock::now();
-    auto end = start + std::chrono::seconds(secs);
-    while (!is_shutdown() && std::chrono::steady_clock::now() < end) {
-      auto frame =
-          std::make_shared<RGBFrameBuffer::Frame>();
-      effect_->draw_frame(*frame);
-      frames_.push(frame_num_++, frame);
-    }
+    effect_name_ = boost::core::demangle(typeid(EffectDerived).name());
+    effect_trace_name_ = Trace::intern(effect_name_);
+    render_ns_ = &metrics_.histogram("ledserve_render_ns",
+                                     "effect=\"" + effect_name_ + "\"");
+    play(frames);
+    log_stats();
   };
 }
@@ -0,0 +1,178 @@
+#include "Metrics.h"
+
+#include <boost/log/trivial.hpp>
+#include <cstdio>
+#include <sstream>
+
+#define LOG(X) BOOST_LOG_TRIVIAL(X)
+
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+namespace {
+
+// name{labels,extra} or name{extra}, as the exposition format wants
+std::string series(const std::string& name, const std::string& labels,
+                   const std::string& extra = "") {
+  std::string s = name;
+  if (!labels.empty() || !extra.empty()) {
+    s += "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra +
+         "}";
+  }
+  return s;
+}
+
+}  // namespace
+
+uint64_t Histogram::Snapshot::percentile(double p) const {
+  if (!count) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(1, p * count + 0.5);
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      // The middle of the bucket, but never past the largest value seen
+      auto lo = lower_bound(i);
+      auto hi = i + 1 < BUCKETS ? lower_bound(i + 1) : lo;
+      return std::min(lo + (hi - lo) / 2, max);
+    }
+  }
+  return max;
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot s;
+  for (int i = 0; i < BUCKETS; ++i) {
+    s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+  }
+  s.count = count_.load(std::memory_order_relaxed);
+  s.sum = sum_.load(std::memory_order_relaxed);
+  s.max = max_.load(std::memory_order_relaxed);
+  return s;
+}
+
+double Counter::rate() const {
+  std::chrono::duration<double> secs =
+      std::chrono::steady_clock::now() - created_;
+  return secs.count() > 0 ? value() / secs.count() : 0;
+}
+
+Histogram& Metrics::histogram(const std::string& name,
+                              const std::string& labels) {
+  std::scoped_lock _(lock_);
+  auto& h = histograms_[Key(name, labels)];
+  if (!h) {
+    h.reset(new Histogram());
+  }
+  return *h;
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& labels) {
+  std::scoped_lock _(lock_);
+  auto& c = counters_[Key(name, labels)];
+  if (!c) {
+    c.reset(new Counter());
+  }
+  return *c;
+}
+
+void Metrics::gauge(const std::string& name, std::function<double()> read,
+                    const std::string& labels) {
+  std::scoped_lock _(lock_);
+  gauges_[Key(name, labels)] = std::move(read);
+}
+
+std::string Metrics::dump() const {
+  static const std::pair<double, const char*> QUANTILES[] = {
+      {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}, {0.999, "0.999"}};
+  std::scoped_lock _(lock_);
+  std::ostringstream out;
+  std::string last;
+  for (auto& [key, h] : histograms_) {
+    auto& [name, labels] = key;
+    if (name != last) {
+      out << "# TYPE " << name << " summary\n";
+      last = name;
+    }
+    auto s = h->snapshot();
+    for (auto& q : QUANTILES) {
+      auto quantile = std::string("quantile=\"") + q.second + "\"";
+      out << series(name, labels, quantile) << " " << s.percentile(q.first)
+          << "\n";
+    }
+    out << series(name, labels, "quantile=\"1\"") << " " << s.max << "\n"
+        << series(name + "_sum", labels) << " " << s.sum << "\n"
+        << series(name + "_count", labels) << " " << s.count << "\n";
+  }
+  for (auto& [key, c] : counters_) {
+    auto& [name, labels] = key;
+    if (name != last) {
+      out << "# TYPE " << name << " counter\n";
+      last = name;
+    }
+    out << series(name, labels) << " " << c->value() << "\n"
+        << series(name + "_per_sec", labels) << " " << c->rate() << "\n";
+  }
+  for (auto& [key, read] : gauges_) {
+    auto& [name, labels] = key;
+    if (name != last) {
+      out << "# TYPE " << name << " gauge\n";
+      last = name;
+    }
+    out << series(name, labels) << " " << read() << "\n";
+  }
+  return out.str();
+}
+
+StatsEndpoint::StatsEndpoint(io_context& ctx, uint16_t port,
+                             const Metrics& metrics)
+    : acceptor_(ctx, tcp::endpoint(address_v4::loopback(), port)),
+      metrics_(metrics) {}
+
+void StatsEndpoint::start() {
+  LOG(info) << "Stats at http://" << acceptor_.local_endpoint() << "/";
+  accept();
+}
+
+void StatsEndpoint::stop() {
+  boost::system::error_code ec;
+  acceptor_.close(ec);
+}
+
+// Whatever was asked, the answer is the current dump. The request is read
+// first, as some clients treat a reply before it as a reset.
+void StatsEndpoint::accept() {
+  acceptor_.async_accept([this](const boost::system::error_code& ec,
+                                tcp::socket sock) {
+    if (ec) {
+      if (ec != error::operation_aborted) {
+        LOG(error) << "Stats accept error: " << ec.message();
+      }
+      return;
+    }
+    auto s = std::make_shared<tcp::socket>(std::move(sock));
+    auto request = std::make_shared<std::array<char, 1024>>();
+    s->async_read_some(
+        buffer(*request),
+        [this, s, request](const boost::system::error_code& ec, size_t) {
+          if (ec) {
+            return;
+          }
+          auto body = metrics_.dump();
+          auto response = std::make_shared<std::string>(
+              "HTTP/1.0 200 OK\r\n"
+              "Content-Type: text/plain; version=0.0.4\r\n"
+              "Content-Length: " +
+              std::to_string(body.size()) + "\r\n\r\n" + body);
+          async_write(
+              *s, buffer(*response),
+              [s, response](const boost::system::error_code&, size_t) {
+                boost::system::error_code ec;
+                s->shutdown(tcp::socket::shutdown_both, ec);
+              });
+        });
+    accept();
+  });
+}
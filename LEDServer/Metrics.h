@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Log-linear histogram of non-negative values, such as latencies in
+// nanoseconds. Each power of two is split into SUB buckets, so a recorded
+// value is known to within 1/SUB (about 3%) over the whole range, as in
+// HdrHistogram. Recording is a few relaxed atomic adds and never blocks;
+// any thread may record while another takes a snapshot.
+class Histogram {
+ public:
+  static const int SUB_BITS = 5;
+  static const uint64_t SUB = 1 << SUB_BITS;
+  // Values from 2^MAX_EXP up are counted in the top bucket
+  static const int MAX_EXP = 40;
+  static const int BUCKETS = (MAX_EXP - SUB_BITS + 1) * SUB;
+
+  struct Snapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    std::array<uint64_t, BUCKETS> counts;
+
+    double mean() const {
+      return count ? static_cast<double>(sum) / count : 0;
+    }
+    // Value at or below which a fraction p of the recorded values fall
+    uint64_t percentile(double p) const;
+  };
+
+  Histogram() : counts_{}, count_(0), sum_(0), max_(0) {}
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  void record(uint64_t v) {
+    counts_[index(v)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(v, std::memory_order_relaxed);
+    auto max = max_.load(std::memory_order_relaxed);
+    while (v > max && !max_.compare_exchange_weak(max, v,
+                                                  std::memory_order_relaxed)) {
+    }
+  }
+  void record(std::chrono::nanoseconds d) {
+    record(static_cast<uint64_t>(std::max<int64_t>(d.count(), 0)));
+  }
+
+  Snapshot snapshot() const;
+
+  static int index(uint64_t v) {
+    if (v < SUB) {
+      return static_cast<int>(v);
+    }
+    int exp = std::min(63 - __builtin_clzll(v), MAX_EXP);
+    if (exp == MAX_EXP) {
+      return BUCKETS - 1;
+    }
+    int shift = exp - SUB_BITS;
+    return (shift + 1) * SUB + static_cast<int>((v >> shift) - SUB);
+  }
+  // Smallest value counted in bucket i
+  static uint64_t lower_bound(int i) {
+    if (i < static_cast<int>(SUB)) {
+      return i;
+    }
+    int shift = i / SUB - 1;
+    return (SUB + i % SUB) << shift;
+  }
+
+ private:
+  std::array<std::atomic<uint64_t>, BUCKETS> counts_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+// Monotonic count, such as bytes sent. Reported with its average rate since
+// it was created.
+class Counter {
+ public:
+  Counter() : value_(0), created_(std::chrono::steady_clock::now()) {}
+  Counter(const Counter&) = delete;
+  Counter& operator=(const Counter&) = delete;
+
+  void add(uint64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+  double rate() const;
+
+ private:
+  std::atomic<uint64_t> value_;
+  std::chrono::steady_clock::time_point created_;
+};
+
+// Named metrics of one server. A metric is a name plus a Prometheus label
+// set such as slice="0"; asking for one that exists returns it, so callers
+// look their metrics up once, off the hot path, and keep the reference,
+// which stays valid for the registry's lifetime. Gauges are read when a
+// snapshot is taken.
+class Metrics {
+ public:
+  Metrics() {}
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  Histogram& histogram(const std::string& name,
+                       const std::string& labels = "");
+  Counter& counter(const std::string& name, const std::string& labels = "");
+  void gauge(const std::string& name, std::function<double()> read,
+             const std::string& labels = "");
+
+  // Every metric in the Prometheus text format: histograms as summaries
+  // with p50, p90, p99, p99.9 and max, counters with a _per_sec rate
+  std::string dump() const;
+
+ private:
+  typedef std::pair<std::string, std::string> Key;
+
+  mutable std::mutex lock_;
+  std::map<Key, std::unique_ptr<Histogram>> histograms_;
+  std::map<Key, std::unique_ptr<Counter>> counters_;
+  std::map<Key, std::function<double()>> gauges_;
+};
+
+// Serves Metrics::dump() over HTTP to any request on a local port, for
+// curl or a Prometheus scraper
+class StatsEndpoint {
+ public:
+  StatsEndpoint(boost::asio::io_context& ctx, uint16_t port,
+                const Metrics& metrics);
+  void start();
+  void stop();
+
+ private:
+  void accept();
+
+  boost::asio::ip::tcp::acceptor acceptor_;
+  const Metrics& metrics_;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Reduced-depth encodings of packed B,G,R pixels, for WireFormat::RGB565
+// and WireFormat::PALETTE8.
+
+const size_t PALETTE_SIZE = 256;
+
+inline uint16_t to_rgb565(const uint8_t* bgr) {
+  return (bgr[2] & 0xf8) << 8 | (bgr[1] & 0xfc) << 3 | bgr[0] >> 3;
+}
+
+inline void pack_rgb565_scalar(const uint8_t* bgr, uint8_t* out, size_t n) {
+  for (size_t i = 0; i < n; ++i, bgr += 3, out += 2) {
+    uint16_t v = to_rgb565(bgr);
+    out[0] = v & 0xff;
+    out[1] = v >> 8;
+  }
+}
+
+#if defined(__ARM_NEON)
+// 8 pixels per step: de-interleave, then shift each channel into place
+inline void pack_rgb565(const uint8_t* bgr, uint8_t* out, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint8x8x3_t in = vld3_u8(bgr + i * 3);
+    uint16x8_t v = vshll_n_u8(vand_u8(in.val[2], vdup_n_u8(0xf8)), 8);
+    v = vorrq_u16(v, vshll_n_u8(vand_u8(in.val[1], vdup_n_u8(0xfc)), 3));
+    v = vorrq_u16(v, vmovl_u8(vshr_n_u8(in.val[0], 3)));
+    vst1q_u8(out + i * 2, vreinterpretq_u8_u16(v));
+  }
+  pack_rgb565_scalar(bgr + i * 3, out + i * 2, n - i);
+}
+#elif defined(__x86_64__) || defined(__i386__)
+// 4 pixels per step: spread each into a 32-bit lane with a byte shuffle,
+// mask and shift the channels into place, and gather the low halves. Each
+// load reads 16 bytes, so the tail goes through the scalar path to stay
+// inside the input.
+__attribute__((target("ssse3"))) inline void pack_rgb565_ssse3(
+    const uint8_t* bgr, uint8_t* out, size_t n) {
+  const __m128i spread =
+      _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i gather =
+      _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i b_mask = _mm_set1_epi32(0x001f);
+  const __m128i g_mask = _mm_set1_epi32(0x07e0);
+  const __m128i r_mask = _mm_set1_epi32(0xf800);
+  size_t i = 0;
+  for (; i * 3 + 16 <= n * 3; i += 4) {
+    __m128i v = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgr + i * 3)),
+        spread);
+    __m128i px = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 3), b_mask),
+                     _mm_and_si128(_mm_srli_epi32(v, 5), g_mask)),
+        _mm_and_si128(_mm_srli_epi32(v, 8), r_mask));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * 2),
+                     _mm_shuffle_epi8(px, gather));
+  }
+  pack_rgb565_scalar(bgr + i * 3, out + i * 2, n - i);
+}
+
+inline void pack_rgb565(const uint8_t* bgr, uint8_t* out, size_t n) {
+  static const bool ssse3 = __builtin_cpu_supports("ssse3");
+  if (ssse3) {
+    pack_rgb565_ssse3(bgr, out, n);
+  } else {
+    pack_rgb565_scalar(bgr, out, n);
+  }
+}
+#else
+inline void pack_rgb565(const uint8_t* bgr, uint8_t* out, size_t n) {
+  pack_rgb565_scalar(bgr, out, n);
+}
+#endif
+
+// Indexes n pixels against a palette, written to out as the colors used
+// minus one, PALETTE_SIZE B,G,R entries (unused ones zero), then an index
+// per pixel. Pixels with at most PALETTE_SIZE colors get a palette of
+// exactly those, in order of first use, so the same pixels always give the
+// same bytes. Others are rounded to a fixed 6x7x6 color cube.
+inline void encode_palette8(const uint8_t* bgr, size_t n, uint8_t* out) {
+  // Open addressing over 24-bit colors, with 0 marking an empty slot
+  const int TABLE_BITS = 10;
+  uint32_t keys[1 << TABLE_BITS] = {};
+  uint8_t index[1 << TABLE_BITS];
+  uint8_t* palette = out + 1;
+  uint8_t* indices = palette + PALETTE_SIZE * 3;
+  memset(palette, 0, PALETTE_SIZE * 3);
+  size_t used = 0;
+  uint32_t last = 0;
+  bool fits = true;
+  for (size_t i = 0; i < n && fits; ++i) {
+    const uint8_t* p = bgr + i * 3;
+    uint32_t key = (p[0] | p[1] << 8 | p[2] << 16) + 1;
+    // Runs of one color are common down a column
+    if (key == last) {
+      indices[i] = indices[i - 1];
+      continue;
+    }
+    last = key;
+    uint32_t slot = (key * 2654435761u) >> (32 - TABLE_BITS);
+    while (keys[slot] && keys[slot] != key) {
+      slot = (slot + 1) & ((1 << TABLE_BITS) - 1);
+    }
+    if (!keys[slot]) {
+      fits = used < PALETTE_SIZE;
+      keys[slot] = key;
+      index[slot] = used;
+      if (fits) {
+        memcpy(palette + used * 3, p, 3);
+        ++used;
+      }
+    }
+    indices[i] = index[slot];
+  }
+  if (fits) {
+    out[0] = used ? used - 1 : 0;
+    return;
+  }
+  // Too many colors
+  const int R = 6, G = 7, B = 6;
+  out[0] = R * G * B - 1;
+  for (int r = 0; r < R; ++r) {
+    for (int g = 0; g < G; ++g) {
+      for (int b = 0; b < B; ++b) {
+        uint8_t* e = palette + ((r * G + g) * B + b) * 3;
+        e[0] = b * 255 / (B - 1);
+        e[1] = g * 255 / (G - 1);
+        e[2] = r * 255 / (R - 1);
+      }
+    }
+  }
+  memset(palette + R * G * B * 3, 0, (PALETTE_SIZE - R * G * B) * 3);
+  for (size_t i = 0; i < n; ++i) {
+    const uint8_t* p = bgr + i * 3;
+    int r = (p[2] * (R - 1) + 127) / 255;
+    int g = (p[1] * (G - 1) + 127) / 255;
+    int b = (p[0] * (B - 1) + 127) / 255;
+    indices[i] = (r * G + g) * B + b;
+  }
+}
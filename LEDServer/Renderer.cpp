@@ -0,0 +1,106 @@
+#include "Renderer.h"
+
+#include <cassert>
+#include <string>
+
+#include "Trace.h"
+
+Renderer::Renderer(int threads, int depth)
+    : depth_(depth),
+      jobs_(depth),
+      submitted_(0),
+      collected_(0),
+      stop_(false) {
+  for (int i = 0; i < threads; ++i) {
+    threads_.emplace_back([this, i]() {
+      Trace::set_thread_name("render " + std::to_string(i));
+      run_worker();
+    });
+  }
+}
+
+Renderer::~Renderer() {
+  stop_ = true;
+  work_futex_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+void Renderer::draw(Effect& effect, RGBFrame& frame, const FrameTime& time) {
+  effect.draw_frame(frame, time);
+}
+
+void Renderer::submit(Effect& effect, FramePtr frame, const FrameTime& time,
+                      uint64_t frame_num) {
+  assert(in_flight() < depth_);
+  auto& job = jobs_[submitted_ % depth_];
+  job.effect_ = &effect;
+  job.frame_ = std::move(frame);
+  job.time_ = time;
+  job.frame_num_ = frame_num;
+  job.done_.store(0);
+  // Ids of successive jobs in one slot differ by depth_, and are never 0
+  uint32_t id = static_cast<uint32_t>(submitted_) + 1;
+  job.next_.store(claim_word(id, 0), std::memory_order_release);
+  ++submitted_;
+  work_futex_.notify_all();
+}
+
+Renderer::FramePtr Renderer::collect() {
+  assert(in_flight() > 0);
+  auto& job = jobs_[collected_ % depth_];
+  draw_tiles(job);
+  while (true) {
+    auto gen = job.done_futex_.generation();
+    if (job.done_.load(std::memory_order_acquire) == TILE_COUNT) {
+      break;
+    }
+    job.done_futex_.wait(gen);
+  }
+  auto frame = std::move(job.frame_);
+  ++collected_;
+  return frame;
+}
+
+void Renderer::run_worker() {
+  while (true) {
+    auto gen = work_futex_.generation();
+    if (stop_) {
+      return;
+    }
+    // Oldest frame first, so frames complete roughly in order
+    bool drew = false;
+    uint64_t oldest = collected_;
+    for (int i = 0; i < depth_; ++i) {
+      drew |= draw_tiles(jobs_[(oldest + i) % depth_]);
+    }
+    if (!drew) {
+      work_futex_.wait(gen);
+    }
+  }
+}
+
+bool Renderer::draw_tiles(Job& job) {
+  bool drew = false;
+  auto next = job.next_.load(std::memory_order_acquire);
+  auto id = next >> 32;
+  while ((next >> 32) == id &&
+         static_cast<uint32_t>(next) < static_cast<uint32_t>(TILE_COUNT)) {
+    if (!job.next_.compare_exchange_weak(next, next + 1,
+                                         std::memory_order_acq_rel)) {
+      continue;
+    }
+    auto tile = RGBFrame::Layout::tile(static_cast<uint32_t>(next));
+    {
+      TraceScope _("draw tile", job.frame_num_);
+      job.effect_->draw_tile(*job.frame_, tile, job.time_);
+    }
+    if (job.done_.fetch_add(1, std::memory_order_acq_rel) + 1 == TILE_COUNT) {
+      job.done_futex_.notify_all();
+    }
+    drew = true;
+    next = job.next_.load(std::memory_order_acquire);
+  }
+  return drew;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Effect.h"
+#include "Futex.h"
+#include "Types.h"
+
+// Draws frames on a pool of render threads plus the calling thread.
+//
+// Stateful effects are drawn whole, in order, by draw() on the calling
+// thread. Tiled effects are pipelined: submit() queues up to depth() frames,
+// each split into the frame layout's tiles that any thread may claim, and
+// collect() hands frames back in submission order as they complete. The
+// calling thread helps with the oldest frame while it waits in collect().
+class Renderer {
+ public:
+  typedef std::shared_ptr<RGBFrame> FramePtr;
+
+  Renderer(int threads, int depth);
+  ~Renderer();
+  Renderer(const Renderer&) = delete;
+  Renderer& operator=(const Renderer&) = delete;
+
+  void draw(Effect& effect, RGBFrame& frame, const FrameTime& time);
+
+  int depth() const { return depth_; }
+  int in_flight() const { return submitted_ - collected_; }
+  // Requires in_flight() < depth(). frame_num only tags the frame's trace
+  // events.
+  void submit(Effect& effect, FramePtr frame, const FrameTime& time,
+              uint64_t frame_num);
+  // Requires in_flight() > 0
+  FramePtr collect();
+
+ private:
+  static const int TILE_COUNT = RGBFrame::Layout::TILE_COUNT;
+
+  struct alignas(64) Job {
+    Job() : next_(claim_word(0, TILE_COUNT)), done_(0), effect_(nullptr) {}
+
+    // Job id in the high word, next unclaimed tile in the low word, so a
+    // thread that read a stale id can never claim a tile of the job that
+    // replaced it
+    std::atomic<uint64_t> next_;
+    std::atomic<int> done_;
+    Futex done_futex_;
+    Effect* effect_;
+    FramePtr frame_;
+    FrameTime time_;
+    uint64_t frame_num_;
+  };
+
+  static uint64_t claim_word(uint32_t id, uint32_t tile) {
+    return static_cast<uint64_t>(id) << 32 | tile;
+  }
+
+  void run_worker();
+  bool draw_tiles(Job& job);
+
+  int depth_;
+  std::vector<Job> jobs_;
+  std::vector<std::thread> threads_;
+  std::atomic<uint64_t> submitted_;
+  std::atomic<uint64_t> collected_;
+  Futex work_futex_;
+  std::atomic<bool> stop_;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "Effect.h"
+
+typedef std::vector<std::function<void()>> Sequence;
+
+// The show, played live by ledserve and rendered to a show file by
+// ledrender. Player provides play_secs and play_frames.
+template <typename Player>
+Sequence make_show(Player& player) {
+  return {
+      player.template play_secs<Test, 10>(),
+      //      player.template play_secs<RainbowHSV, 10>(),
+      //     player.template play_secs<RainbowTwistHSV, 10>(),
+      //    player.template play_secs<RainbowHSL, 3>(),
+  };
+}
@@ -0,0 +1,151 @@
+#include "ShowFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/log/trivial.hpp>
+#include <cerrno>
+#include <cstring>
+
+#include "SliceEncoder.h"
+
+#define LOG(X) BOOST_LOG_TRIVIAL(X)
+
+ShowFile::ShowFile() : fd_(-1), data_(nullptr), size_(0), index_(nullptr) {}
+
+ShowFile::~ShowFile() {
+  if (data_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool ShowFile::open(const std::string& path) {
+  path_ = path;
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    LOG(error) << "Can't open show " << path << ": " << strerror(errno);
+    return false;
+  }
+  size_ = st.st_size;
+  if (size_ < SHOW_DATA_OFFSET) {
+    LOG(error) << "Show " << path << " is truncated";
+    return false;
+  }
+  auto data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    LOG(error) << "Can't map show " << path << ": " << strerror(errno);
+    return false;
+  }
+  data_ = static_cast<const uint8_t*>(data);
+  // Read ahead now rather than on the first pass through the show
+  madvise(data, size_, MADV_WILLNEED);
+
+  auto& h = header();
+  if (h.magic != SHOW_MAGIC || h.version != SHOW_VERSION) {
+    LOG(error) << path << " is not a show file of version " << SHOW_VERSION;
+    return false;
+  }
+  if (h.width != Config::W || h.height != Config::H ||
+      h.strip_h != Config::STRIP_H || h.slices != Config::SLICE_COUNT ||
+      !valid(h.format) || !h.rate_frames || !h.rate_secs) {
+    LOG(error) << "Show " << path << " is " << h.width << "x" << h.height
+               << " in " << h.slices << " slices of " << h.strip_h
+               << ", not rendered for this display";
+    return false;
+  }
+  if (!h.frames || h.index_offset < SHOW_DATA_OFFSET ||
+      h.index_offset > size_ ||
+      h.frames > (size_ - h.index_offset) / sizeof(ShowIndexEntry) /
+                     Config::SLICE_COUNT) {
+    LOG(error) << "Show " << path << " has a bad index";
+    return false;
+  }
+  index_ = reinterpret_cast<const ShowIndexEntry*>(data_ + h.index_offset);
+  // Checked once here, so playback can trust every entry
+  for (uint64_t i = 0; i < h.frames * Config::SLICE_COUNT; ++i) {
+    auto& e = index_[i];
+    if (e.length != slice_size(h.format) || e.offset < SHOW_DATA_OFFSET ||
+        e.offset > h.index_offset || e.length > h.index_offset - e.offset) {
+      LOG(error) << "Show " << path << " has a bad index entry for frame "
+                 << i / Config::SLICE_COUNT;
+      return false;
+    }
+  }
+  LOG(info) << "Show " << path << ": " << h.frames << " frames at "
+            << rate().hz() << " fps, format " << static_cast<int>(h.format);
+  return true;
+}
+
+ShowWriter::ShowWriter(WireFormat format, FrameRate rate)
+    : format_(format), rate_(rate), file_(nullptr), offset_(0) {}
+
+ShowWriter::~ShowWriter() {
+  if (file_) {
+    fclose(file_);
+    unlink(tmp_path_.c_str());
+  }
+}
+
+bool ShowWriter::open(const std::string& path) {
+  path_ = path;
+  tmp_path_ = path + ".tmp";
+  file_ = fopen(tmp_path_.c_str(), "wb");
+  if (!file_) {
+    LOG(error) << "Can't create " << tmp_path_ << ": " << strerror(errno);
+    return false;
+  }
+  // The header is written last; until then the space before the payloads
+  // is zeros
+  std::vector<uint8_t> zeros(SHOW_DATA_OFFSET);
+  offset_ = SHOW_DATA_OFFSET;
+  return fwrite(zeros.data(), zeros.size(), 1, file_) == 1;
+}
+
+bool ShowWriter::append(RGBFrame& frame) {
+  for (int i = 0; i < Config::SLICE_COUNT; ++i) {
+    auto payload = encode_slice(frame, i, format_, buf_);
+    auto data = static_cast<const uint8_t*>(payload.data());
+    if (fwrite(data, payload.size(), 1, file_) != 1) {
+      LOG(error) << "Can't write " << tmp_path_ << ": " << strerror(errno);
+      return false;
+    }
+    index_.push_back(ShowIndexEntry{offset_,
+                                    static_cast<uint32_t>(payload.size()),
+                                    crc32(data, payload.size())});
+    offset_ += payload.size();
+  }
+  return true;
+}
+
+bool ShowWriter::close() {
+  ShowHeader h = {};
+  h.magic = SHOW_MAGIC;
+  h.version = SHOW_VERSION;
+  h.format = format_;
+  h.width = Config::W;
+  h.height = Config::H;
+  h.strip_h = Config::STRIP_H;
+  h.slices = Config::SLICE_COUNT;
+  h.rate_frames = rate_.frames;
+  h.rate_secs = rate_.secs;
+  h.frames = frames();
+  h.index_offset = offset_;
+  bool ok = fwrite(index_.data(), sizeof(ShowIndexEntry), index_.size(),
+                   file_) == index_.size() &&
+            fseek(file_, 0, SEEK_SET) == 0 &&
+            fwrite(&h, sizeof(h), 1, file_) == 1;
+  ok = fclose(file_) == 0 && ok;
+  file_ = nullptr;
+  if (!ok || rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+    LOG(error) << "Can't write " << path_ << ": " << strerror(errno);
+    unlink(tmp_path_.c_str());
+    return false;
+  }
+  return true;
+}
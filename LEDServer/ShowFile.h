@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "FrameClock.h"
+#include "LEDCommon/Protocol.h"
+#include "Types.h"
+
+// Show files hold frames rendered ahead of time by ledrender, every slice
+// already encoded in one wire format, so playing one back is a matter of
+// sending bytes from the page cache. A file is:
+//
+//   ShowHeader
+//   payloads, from SHOW_DATA_OFFSET: frame by frame, each frame's slices in
+//     order and each slice contiguous
+//   ShowIndexEntry per slice of every frame, at index_offset, in the same
+//     order as the payloads
+//
+// The index follows the payloads so frames can be written as they are
+// rendered, before the length of the show is known. Nothing in a file
+// depends on when or where it was rendered, so rendering the same show
+// twice gives the same bytes.
+
+const uint32_t SHOW_MAGIC = 0x574f4853;  // "SHOW"
+const uint16_t SHOW_VERSION = 1;
+// Payloads start on a page
+const uint64_t SHOW_DATA_OFFSET = 4096;
+
+struct __attribute__((__packed__)) ShowHeader {
+  uint32_t magic;      // SHOW_MAGIC
+  uint16_t version;    // SHOW_VERSION
+  WireFormat format;   // encoding of every payload
+  uint8_t reserved;
+  uint16_t width;      // Config geometry the show was rendered for
+  uint16_t height;
+  uint16_t strip_h;
+  uint16_t slices;
+  uint64_t rate_frames;  // FrameRate the show was rendered at
+  uint64_t rate_secs;
+  uint64_t frames;
+  uint64_t index_offset;
+};
+
+struct __attribute__((__packed__)) ShowIndexEntry {
+  uint64_t offset;  // from the start of the file
+  uint32_t length;
+  uint32_t crc;     // CRC-32 of the payload, continued in its FrameHeader
+};
+
+// A show file mapped read-only for playback. Payloads can be read through
+// the mapping, or sent straight from fd() with sendfile().
+class ShowFile {
+ public:
+  ShowFile();
+  ~ShowFile();
+  ShowFile(const ShowFile&) = delete;
+  ShowFile& operator=(const ShowFile&) = delete;
+
+  // Maps the file and checks it was rendered for this display. Logs why and
+  // returns false if it can't be played.
+  bool open(const std::string& path);
+
+  const std::string& path() const { return path_; }
+  int fd() const { return fd_; }
+  WireFormat format() const { return header().format; }
+  FrameRate rate() const {
+    return FrameRate{header().rate_frames, header().rate_secs};
+  }
+  uint64_t frames() const { return header().frames; }
+
+  const ShowIndexEntry& entry(uint64_t frame, int slice) const {
+    return index_[frame * Config::SLICE_COUNT + slice];
+  }
+  const uint8_t* payload(const ShowIndexEntry& e) const {
+    return data_ + e.offset;
+  }
+
+ private:
+  const ShowHeader& header() const {
+    return *reinterpret_cast<const ShowHeader*>(data_);
+  }
+
+  std::string path_;
+  int fd_;
+  const uint8_t* data_;
+  size_t size_;
+  const ShowIndexEntry* index_;
+};
+
+// Writes a show file from frames rendered in order. The file appears under
+// its name only once close() succeeds, so a server playing an older version
+// of it is never left with a truncated mapping.
+class ShowWriter {
+ public:
+  ShowWriter(WireFormat format, FrameRate rate);
+  ~ShowWriter();
+  ShowWriter(const ShowWriter&) = delete;
+  ShowWriter& operator=(const ShowWriter&) = delete;
+
+  bool open(const std::string& path);
+  // Encodes every slice of the frame and appends it
+  bool append(RGBFrame& frame);
+  // Writes the index and header, and moves the file into place
+  bool close();
+
+  uint64_t frames() const { return index_.size() / Config::SLICE_COUNT; }
+
+ private:
+  WireFormat format_;
+  FrameRate rate_;
+  std::string path_;
+  std::string tmp_path_;
+  FILE* file_;
+  uint64_t offset_;
+  std::vector<ShowIndexEntry> index_;
+  std::vector<uint8_t> buf_;
+};
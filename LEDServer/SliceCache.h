@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio/buffer.hpp>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "LEDCommon/Protocol.h"
+
+// A frame's slices encoded for the wire, kept with the frame. Each (slice,
+// format) is encoded once, by the first connection to ask for it, and every
+// other client of the slice in that format shares the result, so mirrors of
+// a slice cost no encoding, nor a CRC of the payload. Entries stay valid
+// until the frame goes back to its pool, and their buffers are reused by the
+// frame's next contents.
+template <int SLICES>
+class SliceCache {
+ public:
+  SliceCache() {}
+  SliceCache(const SliceCache&) = delete;
+  SliceCache& operator=(const SliceCache&) = delete;
+
+  // Returns the payload of the slice in the format, filled in by
+  // encode(std::vector<uint8_t>& buf) if no one has asked for it yet, sets
+  // crc to the payload's CRC32, and hit to whether someone had. A caller
+  // that finds another thread encoding the same entry waits for it.
+  template <typename Encode>
+  boost::asio::const_buffer get(int slice, WireFormat format, Encode&& encode,
+                                uint32_t& crc, bool& hit) {
+    auto& e = entries_[slice][static_cast<int>(format)];
+    hit = true;
+    if (!e.ready_.load(std::memory_order_acquire)) {
+      std::scoped_lock _(e.lock_);
+      if (!e.ready_.load(std::memory_order_relaxed)) {
+        e.payload_ = encode(e.buf_);
+        e.crc_ = crc32(static_cast<const uint8_t*>(e.payload_.data()),
+                       e.payload_.size());
+        e.ready_.store(true, std::memory_order_release);
+        hit = false;
+      }
+    }
+    crc = e.crc_;
+    return e.payload_;
+  }
+
+  // Only while no one else holds the frame
+  void clear() {
+    for (auto& slice : entries_) {
+      for (auto& e : slice) {
+        e.ready_.store(false, std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    Entry() : ready_(false), crc_(0) {}
+
+    std::atomic<bool> ready_;
+    std::mutex lock_;
+    std::vector<uint8_t> buf_;
+    boost::asio::const_buffer payload_;
+    uint32_t crc_;
+  };
+
+  Entry entries_[SLICES][WIRE_FORMAT_COUNT];
+};
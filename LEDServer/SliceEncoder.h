@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "LEDCommon/APA102.h"
+#include "LEDCommon/Protocol.h"
+#include "Quantize.h"
+#include "Types.h"
+
+typedef APA102Column<Config::STRIP_H> SliceColumn;
+
+const size_t SLICE_PIXELS = Config::W * Config::STRIP_H;
+const size_t RAW_SLICE_SIZE = SLICE_PIXELS * sizeof(RGB);
+
+// Payload size of a slice in the given wire format
+inline size_t slice_size(WireFormat format) {
+  switch (format) {
+    case WireFormat::APA102:
+      return Config::W * SliceColumn::SIZE;
+    case WireFormat::RGB565:
+      return SLICE_PIXELS * 2;
+    case WireFormat::PALETTE8:
+      return 1 + PALETTE_SIZE * 3 + SLICE_PIXELS;
+    case WireFormat::RAW_BGR:
+    default:
+      return RAW_SLICE_SIZE;
+  }
+}
+
+// Returns the payload for one slice of RAW_SLICE_SIZE raw pixels in the
+// given wire format. Raw slices point at the pixels; other formats are
+// encoded into buf, which must outlive the returned buffer.
+inline boost::asio::const_buffer encode_slice(const uint8_t* slice,
+                                              WireFormat format,
+                                              std::vector<uint8_t>& buf) {
+  switch (format) {
+    case WireFormat::APA102: {
+      buf.resize(slice_size(format));
+      for (int x = 0; x < Config::W; ++x) {
+        SliceColumn::encode(slice + x * Config::STRIP_H * sizeof(RGB),
+                            buf.data() + x * SliceColumn::SIZE);
+      }
+      return boost::asio::buffer(buf);
+    }
+    case WireFormat::RGB565:
+      buf.resize(slice_size(format));
+      pack_rgb565(slice, buf.data(), SLICE_PIXELS);
+      return boost::asio::buffer(buf);
+    case WireFormat::PALETTE8:
+      buf.resize(slice_size(format));
+      encode_palette8(slice, SLICE_PIXELS, buf.data());
+      return boost::asio::buffer(buf);
+    case WireFormat::RAW_BGR:
+    default:
+      return boost::asio::buffer(slice, RAW_SLICE_SIZE);
+  }
+}
+
+inline boost::asio::const_buffer encode_slice(RGBFrame& frame, int slice_idx,
+                                              WireFormat format,
+                                              std::vector<uint8_t>& buf) {
+  return encode_slice(
+      static_cast<const uint8_t*>(frame.slice_data(slice_idx).data()), format,
+      buf);
+}
@@ -0,0 +1,198 @@
+#include "Trace.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/log/trivial.hpp>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#define LOG(X) BOOST_LOG_TRIVIAL(X)
+
+std::atomic<bool> Trace::enabled_(false);
+
+namespace {
+
+struct Event {
+  const char* name;
+  const char* effect;
+  uint64_t start_ns;
+  uint64_t end_ns;  // equal to start_ns for instants
+  uint64_t frame;
+  uint64_t count;
+  int32_t slice;
+  bool instant;
+};
+
+// One thread's events. Only the owning thread appends to it; it publishes
+// each event through count, so a session can be written while threads are
+// still recording and only events published by then are read.
+struct Ring {
+  Ring() : tid(syscall(SYS_gettid)), session(0), count(0), dropped(0) {}
+
+  const int tid;
+  std::string name;
+  std::unique_ptr<Event[]> events;
+  // Session the events belong to; the owner resets the ring when it sees a
+  // new one
+  std::atomic<uint32_t> session;
+  std::atomic<size_t> count;
+  std::atomic<uint64_t> dropped;
+};
+
+std::mutex rings_lock;
+// Rings live as long as the process, as do the threads that trace
+std::vector<std::unique_ptr<Ring>> rings;
+std::set<std::string> interned;
+std::atomic<uint32_t> session(0);
+
+thread_local Ring* thread_ring = nullptr;
+
+Ring& ring() {
+  if (!thread_ring) {
+    auto r = std::make_unique<Ring>();
+    thread_ring = r.get();
+    std::scoped_lock _(rings_lock);
+    rings.push_back(std::move(r));
+  }
+  return *thread_ring;
+}
+
+void append(const Event& e) {
+  auto& r = ring();
+  auto s = session.load(std::memory_order_acquire);
+  if (r.session.load(std::memory_order_relaxed) != s) {
+    r.count.store(0, std::memory_order_relaxed);
+    r.dropped.store(0, std::memory_order_relaxed);
+    r.session.store(s, std::memory_order_release);
+  }
+  auto n = r.count.load(std::memory_order_relaxed);
+  if (n == Trace::MAX_EVENTS) {
+    r.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (!r.events) {
+    r.events.reset(new Event[Trace::MAX_EVENTS]);
+  }
+  r.events[n] = e;
+  r.count.store(n + 1, std::memory_order_release);
+}
+
+void write_string(FILE* f, const char* s) {
+  fputc('"', f);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+    }
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+void write_event(FILE* f, int tid, const Event& e) {
+  fprintf(f, ",\n{\"name\":");
+  write_string(f, e.name);
+  fprintf(f, ",\"cat\":\"ledserve\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", tid,
+          e.start_ns / 1000.0);
+  if (e.instant) {
+    fprintf(f, ",\"ph\":\"i\",\"s\":\"t\"");
+  } else {
+    fprintf(f, ",\"ph\":\"X\",\"dur\":%.3f", (e.end_ns - e.start_ns) / 1000.0);
+  }
+  fprintf(f, ",\"args\":{");
+  const char* sep = "";
+  if (e.frame != Trace::NO_FRAME) {
+    fprintf(f, "\"frame\":%" PRIu64, e.frame);
+    sep = ",";
+  }
+  if (e.slice >= 0) {
+    fprintf(f, "%s\"slice\":%d", sep, e.slice);
+    sep = ",";
+  }
+  if (e.count) {
+    fprintf(f, "%s\"count\":%" PRIu64, sep, e.count);
+    sep = ",";
+  }
+  if (e.effect) {
+    fprintf(f, "%s\"effect\":", sep);
+    write_string(f, e.effect);
+  }
+  fprintf(f, "}}");
+}
+
+}  // namespace
+
+void Trace::start() {
+  session.fetch_add(1, std::memory_order_release);
+  enabled_.store(true);
+}
+
+bool Trace::stop(const std::string& path) {
+  enabled_.store(false);
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) {
+    return false;
+  }
+  auto s = session.load(std::memory_order_acquire);
+  size_t events = 0;
+  uint64_t dropped = 0;
+  int threads = 0;
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+             "\"args\":{\"name\":\"ledserve\"}}");
+  std::scoped_lock _(rings_lock);
+  for (auto& r : rings) {
+    if (!r->name.empty()) {
+      fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                 "\"tid\":%d,\"args\":{\"name\":",
+              r->tid);
+      write_string(f, r->name.c_str());
+      fprintf(f, "}}");
+    }
+    if (r->session.load(std::memory_order_acquire) != s) {
+      continue;
+    }
+    auto n = r->count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+      write_event(f, r->tid, r->events[i]);
+    }
+    events += n;
+    dropped += r->dropped.load(std::memory_order_relaxed);
+    threads += n > 0;
+  }
+  fprintf(f, "\n]}\n");
+  bool ok = fclose(f) == 0;
+  LOG(info) << "Trace: " << events << " events from " << threads
+            << " threads written to " << path << ", " << dropped
+            << " dropped";
+  return ok;
+}
+
+void Trace::set_thread_name(const std::string& name) {
+  auto& r = ring();
+  std::scoped_lock _(rings_lock);
+  r.name = name;
+}
+
+const char* Trace::intern(const std::string& s) {
+  std::scoped_lock _(rings_lock);
+  return interned.insert(s).first->c_str();
+}
+
+void Trace::complete(const char* name, uint64_t start_ns, uint64_t end_ns,
+                     uint64_t frame, int slice, const char* effect) {
+  append(Event{name, effect, start_ns, end_ns, frame, 0, slice, false});
+}
+
+void Trace::instant(const char* name, uint64_t frame, int slice,
+                    uint64_t count) {
+  if (!enabled()) {
+    return;
+  }
+  auto now = now_ns();
+  append(Event{name, nullptr, now, now, frame, count, slice, true});
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Opt-in tracing of individual frames through the pipeline, written as
+// Chrome trace-event JSON for chrome://tracing or ui.perfetto.dev.
+//
+// While a session runs, each thread appends events to its own buffer of
+// MAX_EVENTS; events past that are dropped and counted. Outside a session a
+// trace point costs one relaxed load and a branch. Names and effect names
+// must outlive the session: pass string literals, or intern() others.
+//
+// Events are complete events, a span on one thread, or instants, and carry
+// the global frame number and slice they concern when there is one.
+class Trace {
+ public:
+  static const uint64_t NO_FRAME = ~0ULL;
+  static const size_t MAX_EVENTS = 1 << 16;
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Starts a session, discarding events from the last one
+  static void start();
+  // Ends the session and writes its events to path. Returns false if the
+  // file could not be written.
+  static bool stop(const std::string& path);
+
+  // Names the calling thread in traces
+  static void set_thread_name(const std::string& name);
+  static const char* intern(const std::string& s);
+
+  static void complete(const char* name, uint64_t start_ns, uint64_t end_ns,
+                       uint64_t frame = NO_FRAME, int slice = -1,
+                       const char* effect = nullptr);
+  static void instant(const char* name, uint64_t frame = NO_FRAME,
+                      int slice = -1, uint64_t count = 0);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+// Records the enclosing scope as a complete event, if a session was running
+// when it began
+class TraceScope {
+ public:
+  TraceScope(const char* name, uint64_t frame = Trace::NO_FRAME,
+             int slice = -1, const char* effect = nullptr)
+      : name_(name),
+        frame_(frame),
+        slice_(slice),
+        effect_(effect),
+        start_(Trace::enabled() ? Trace::now_ns() : 0) {}
+  ~TraceScope() {
+    if (start_) {
+      Trace::complete(name_, start_, Trace::now_ns(), frame_, slice_, effect_);
+    }
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* name_;
+  uint64_t frame_;
+  int slice_;
+  const char* effect_;
+  uint64_t start_;
+};
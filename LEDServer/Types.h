@@ -1,15 +1,41 @@
 #pragma once
 
+#include <array>
+#include <boost/asio/buffer.hpp>
+#include <cstdint>
 #include <unordered_map>
 #include "ColorSpace.h"
+#include "SliceCache.h"
+
+// What the frame buffer does when a slice's client falls behind: hold up
+// rendering until it catches up, overwrite its oldest unsent frames, or jump
+// it straight to the newest frame
+enum class LagPolicy : uint8_t { BLOCK, DROP_OLDEST, SKIP_TO_LATEST };
+
+// A client shown the same slice as the slice's own client, such as a second
+// display or a preview. It never holds up rendering, its telemetry does not
+// steer the frame clock, and its payloads are shared with the slice's client
+// when they want the same format.
+struct Mirror {
+  const char* id;
+  int slice;
+};
 
 struct Config {
   static const int W = 288;
   static const int H = 144;
   static const int STRIP_H = 48;
   static const int SLICE_COUNT = 1;
+  // The display shows one frame per revolution. Clients report the measured
+  // speed and the server follows it; this is the clients' generated clock.
+  static const int RPM = 960;
+  static const int MIRROR_COUNT = 0;
+  // Frame buffer consumers: the slices, then the mirrors
+  static const int CLIENT_COUNT = SLICE_COUNT + MIRROR_COUNT;
 
   static const char* _slices[SLICE_COUNT];
+  static const LagPolicy _lag_policies[SLICE_COUNT];
+  static const std::array<Mirror, MIRROR_COUNT> _mirrors;
 };
 
 struct __attribute__((__packed__)) RGB {
@@ -28,15 +54,101 @@ struct __attribute__((__packed__)) RGB {
   uint8_t r_;
 };
 
-class RGBFrame {
+// Pixels [x0, x1) x [y0, y1) of a frame
+struct Tile {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+};
+
+// Layout policies map pixel coordinates to buffer offsets, and split a frame
+// into TILE_COUNT tiles that are contiguous in memory and start on a cache
+// line boundary, so render threads never share a line.
+
+// Pixels in rows, left to right. Tiles are bands of 8 rows.
+struct RowMajor {
+  static const bool SLICE_CONTIGUOUS = false;
+  static const int TILE_ROWS = 8;
+  static const int TILE_COUNT = Config::H / TILE_ROWS;
+  static_assert(Config::H % TILE_ROWS == 0);
+  static_assert(TILE_ROWS * Config::W * sizeof(RGB) % 64 == 0);
+
+  static int index(int x, int y) { return x + y * Config::W; }
+  static Tile tile(int i) {
+    return Tile{0, i * TILE_ROWS, Config::W, (i + 1) * TILE_ROWS};
+  }
+};
+
+// Pixels in the order clients scan them: slice by slice, each slice column
+// by column, each column top to bottom. Every slice is one contiguous block.
+// Tiles are bands of 32 columns of one slice.
+struct SliceMajor {
+  static const bool SLICE_CONTIGUOUS = true;
+  static const int TILE_COLUMNS = 32;
+  static const int TILES_PER_SLICE = Config::W / TILE_COLUMNS;
+  static const int TILE_COUNT =
+      TILES_PER_SLICE * (Config::H / Config::STRIP_H);
+  static_assert(Config::W % TILE_COLUMNS == 0);
+  static_assert(Config::H % Config::STRIP_H == 0);
+  static_assert(TILE_COLUMNS * Config::STRIP_H * sizeof(RGB) % 64 == 0);
+
+  static int index(int x, int y) {
+    return (y / Config::STRIP_H) * Config::W * Config::STRIP_H +
+           x * Config::STRIP_H + y % Config::STRIP_H;
+  }
+  static Tile tile(int i) {
+    int x = (i % TILES_PER_SLICE) * TILE_COLUMNS;
+    int y = (i / TILES_PER_SLICE) * Config::STRIP_H;
+    return Tile{x, y, x + TILE_COLUMNS, y + Config::STRIP_H};
+  }
+};
+
+class ShowFile;
+
+template <typename L>
+class BasicRGBFrame {
  public:
-  RGB& pixel(int x, int y) { return buf_[x + y * Config::W]; }
+  typedef L Layout;
+
+  RGB& pixel(int x, int y) { return buf_[Layout::index(x, y)]; }
+
+  // Presentation time, steady clock nanoseconds
+  uint64_t pts() const { return pts_; }
+  void set_pts(uint64_t pts) { pts_ = pts; }
+
+  // Frames played from a show file carry their place in it instead of
+  // pixels, and their slices are sent from the file. Null for rendered
+  // frames.
+  const ShowFile* show() const { return show_; }
+  uint64_t show_frame() const { return show_frame_; }
+  void set_show(const ShowFile* show, uint64_t frame) {
+    show_ = show;
+    show_frame_ = frame;
+  }
+
+  // Slices encoded for clients so far
+  SliceCache<Config::SLICE_COUNT>& encoded() { return encoded_; }
+  // Called by the frame pool as the frame comes back to it
+  void recycle() {
+    pts_ = 0;
+    encoded_.clear();
+  }
+
+  // Slice pixels in client scan order
   boost::asio::const_buffer slice_data(int slice_idx) {
-    return boost::asio::buffer(buf_ + slice_idx * Config::STRIP_H,
+    static_assert(Layout::SLICE_CONTIGUOUS);
+    return boost::asio::buffer(&pixel(0, slice_idx * Config::STRIP_H),
                                Config::W * Config::STRIP_H * sizeof(RGB));
   }
 
  private:
-  RGB buf_[Config::W * Config::H];
+  alignas(64) RGB buf_[Config::W * Config::H];
+  uint64_t pts_ = 0;
+  const ShowFile* show_ = nullptr;
+  uint64_t show_frame_ = 0;
+  SliceCache<Config::SLICE_COUNT> encoded_;
 };
 
+typedef BasicRGBFrame<SliceMajor> RGBFrame;
+
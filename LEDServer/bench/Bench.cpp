@@ -0,0 +1,150 @@
+#include "Bench.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "Types.h"
+
+// Usage: ledserve_bench [--baseline FILE] [FILTER]
+//
+// Runs every benchmark whose name contains FILTER (all by default) and
+// prints the results to stdout as JSON: the machine and build in "context",
+// then one object per benchmark in "benchmarks". Given the output of an
+// earlier run as a baseline, also prints each benchmark's change against it
+// to stderr. Exits 1 if any benchmark failed the checks it makes of its own
+// work, such as a stress test finding data out of order.
+//
+// bench/baseline.json is the reference run for the current release. Keep
+// comparisons on the machine recorded in its context, with nothing else
+// running, and refresh it when a release changes the numbers on purpose.
+
+std::vector<Benchmark>& benchmarks() {
+  static std::vector<Benchmark> all;
+  return all;
+}
+
+namespace {
+
+std::string cpu_model() {
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      auto colon = line.find(':');
+      return colon == std::string::npos ? "" : line.substr(colon + 2);
+    }
+  }
+  return "unknown";
+}
+
+void print_context() {
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  char date[32];
+  auto now = time(nullptr);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  std::cout << "{\n  \"context\": {\"date\": \"" << date << "\", \"host\": \""
+            << host << "\", \"cpu\": \"" << cpu_model()
+            << "\", \"cpus\": " << std::thread::hardware_concurrency()
+            << ", \"compiler\": \"" << __VERSION__ << "\", \"build\": \""
+#ifdef NDEBUG
+            << "release"
+#else
+            << "debug"
+#endif
+            << "\", \"frame\": \"" << Config::W << "x" << Config::H
+            << "\"},\n  \"benchmarks\": [\n";
+}
+
+// Reads ns_per_iter by name from our own output, one benchmark per line
+std::map<std::string, double> read_baseline(const char* path) {
+  std::map<std::string, double> baseline;
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Can't read baseline " << path << std::endl;
+    exit(1);
+  }
+  const std::string NAME = "\"name\": \"";
+  const std::string NS = "\"ns_per_iter\": ";
+  std::string line;
+  while (std::getline(in, line)) {
+    auto name = line.find(NAME);
+    auto ns = line.find(NS);
+    if (name == std::string::npos || ns == std::string::npos) {
+      continue;
+    }
+    name += NAME.size();
+    baseline[line.substr(name, line.find('"', name) - name)] =
+        atof(line.c_str() + ns + NS.size());
+  }
+  return baseline;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* baseline_path = nullptr;
+  const char* filter = "";
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--baseline") && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else {
+      filter = argv[i];
+    }
+  }
+  std::map<std::string, double> baseline;
+  if (baseline_path) {
+    baseline = read_baseline(baseline_path);
+  }
+
+  bool first = true;
+  bool failed = false;
+  print_context();
+  for (auto& b : benchmarks()) {
+    if (!strstr(b.name.c_str(), filter)) {
+      continue;
+    }
+    BenchState state;
+    b.run(state);
+    double secs = state.ns_per_iter() / 1e9;
+    std::cout << (first ? "" : ",\n") << "    {\"name\": \"" << b.name
+              << "\", \"iterations\": " << state.iterations()
+              << ", \"ns_per_iter\": " << state.ns_per_iter();
+    if (state.items_per_iter()) {
+      std::cout << ", \"items_per_sec\": " << state.items_per_iter() / secs;
+    }
+    if (state.bytes_per_iter()) {
+      std::cout << ", \"bytes_per_sec\": " << state.bytes_per_iter() / secs;
+    }
+    for (auto& c : state.counters()) {
+      std::cout << ", \"" << c.first << "\": " << c.second;
+    }
+    std::cout << "}" << std::flush;
+    first = false;
+    for (auto& why : state.failures()) {
+      fprintf(stderr, "%s FAILED: %s\n", b.name.c_str(), why.c_str());
+      failed = true;
+    }
+
+    if (baseline_path) {
+      auto base = baseline.find(b.name);
+      if (base == baseline.end()) {
+        fprintf(stderr, "%-44s %12.1f ns          (new)\n", b.name.c_str(),
+                state.ns_per_iter());
+      } else {
+        fprintf(stderr, "%-44s %12.1f ns  %+7.1f%%\n", b.name.c_str(),
+                state.ns_per_iter(),
+                (state.ns_per_iter() / base->second - 1) * 100);
+      }
+    }
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+  return failed ? 1 : 0;
+}
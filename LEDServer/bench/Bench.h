@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal microbenchmark harness. A benchmark does its setup, then hands the
+// code to time to BenchState::measure(), which repeats it until the run is
+// long enough to trust and records the time per iteration.
+class BenchState {
+ public:
+  BenchState() : iterations_(0), ns_per_iter_(0), items_(0), bytes_(0) {}
+
+  // Work done by one iteration, for throughput figures
+  void set_items_per_iter(uint64_t items) { items_ = items; }
+  void set_bytes_per_iter(uint64_t bytes) { bytes_ = bytes; }
+  // Extra figures reported alongside the timing, such as frames dropped
+  void set_counter(const std::string& name, double value) {
+    counters_.emplace_back(name, value);
+  }
+  // Fails the run, for benchmarks that also check the work they time
+  void fail(const std::string& why) { failures_.push_back(why); }
+
+  template <typename F>
+  void measure(F&& body) {
+    using clock = std::chrono::steady_clock;
+    uint64_t n = 1;
+    while (true) {
+      auto start = clock::now();
+      for (uint64_t i = 0; i < n; ++i) {
+        body();
+      }
+      std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+      if (elapsed.count() >= MIN_RUN_NS || n >= MAX_ITERATIONS) {
+        iterations_ = n;
+        ns_per_iter_ = elapsed.count() / n;
+        return;
+      }
+      n *= 2;
+    }
+  }
+
+  uint64_t iterations() const { return iterations_; }
+  double ns_per_iter() const { return ns_per_iter_; }
+  uint64_t items_per_iter() const { return items_; }
+  uint64_t bytes_per_iter() const { return bytes_; }
+  const std::vector<std::pair<std::string, double>>& counters() const {
+    return counters_;
+  }
+  const std::vector<std::string>& failures() const { return failures_; }
+
+ private:
+  static constexpr double MIN_RUN_NS = 2e8;
+  static const uint64_t MAX_ITERATIONS = 1ULL << 30;
+
+  uint64_t iterations_;
+  double ns_per_iter_;
+  uint64_t items_;
+  uint64_t bytes_;
+  std::vector<std::pair<std::string, double>> counters_;
+  std::vector<std::string> failures_;
+};
+
+struct Benchmark {
+  std::string name;
+  std::function<void(BenchState&)> run;
+};
+
+std::vector<Benchmark>& benchmarks();
+
+struct BenchmarkRegistrar {
+  BenchmarkRegistrar(const char* name, std::function<void(BenchState&)> run) {
+    benchmarks().push_back(Benchmark{name, std::move(run)});
+  }
+};
+
+#define BENCHMARK(fn) static BenchmarkRegistrar fn##_registrar(#fn, fn)
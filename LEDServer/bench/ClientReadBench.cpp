@@ -0,0 +1,245 @@
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "LEDClient/main/FrameReader.h"
+#include "LEDCommon/SliceCodec.h"
+#include "SliceEncoder.h"
+#include "Types.h"
+
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+namespace {
+
+// The client's jitter buffer, holding APA102 slices
+struct Slot {
+  FrameHeader header;
+  uint8_t payload[Config::W * SliceColumn::SIZE];
+};
+
+const int DEPTH = 16;
+typedef RingBuffer<Slot, DEPTH> Ring;
+
+// Counts what the reader publishes, and stops the run on errors
+struct Counter {
+  bool on_frame(Slot&, size_t) { return true; }
+  void on_primed() {}
+  void on_error(const std::string&) { failed = true; }
+  std::atomic<bool> failed{false};
+};
+
+typedef FrameReader<tcp::socket, Slot, DEPTH, Counter> Reader;
+
+// The receive path FrameReader replaced: an exact read for each header and
+// each payload, and a hop to the frame loop to start the next
+class PerFrameReader {
+ public:
+  PerFrameReader(tcp::socket& sock, Counter& counter, WireFormat,
+                 WireCodec codec)
+      : sock_(sock),
+        counter_(counter),
+        coded_(codec == WireCodec::NONE
+                   ? nullptr
+                   : new uint8_t[max_coded_size(sizeof(Slot::payload))]),
+        ref_(nullptr),
+        parked_(false),
+        reads_(0) {}
+
+  void start(Ring& ring, size_t) {
+    ring_ = &ring;
+    read_header();
+  }
+
+  void wake() {
+    if (parked_.exchange(false)) {
+      post(sock_.get_executor(), [this]() { read_header(); });
+    }
+  }
+
+  uint64_t reads() const { return reads_; }
+
+ private:
+  void read_header() {
+    auto slot = ring_->reserve();
+    if (!slot) {
+      parked_ = true;
+      if (!ring_->reserve() || !parked_.exchange(false)) {
+        return;
+      }
+      slot = ring_->reserve();
+    }
+    async_read(sock_, buffer(&slot->header, sizeof(slot->header)),
+               [this, slot](const boost::system::error_code& ec, size_t) {
+                 ++reads_;
+                 if (ec) {
+                   counter_.failed = true;
+                   return;
+                 }
+                 read_payload(slot);
+               });
+  }
+
+  void read_payload(Slot* slot) {
+    auto in = coded_ ? coded_.get() : slot->payload;
+    async_read(sock_, buffer(in, slot->header.length),
+               [this, slot, in](const boost::system::error_code& ec,
+                                size_t bytes) {
+                 ++reads_;
+                 if (ec || !check_payload(slot->header, in) ||
+                     (coded_ && !slice_decode(in, bytes, ref_, slot->payload,
+                                              sizeof(slot->payload)))) {
+                   counter_.failed = true;
+                   return;
+                 }
+                 ref_ = slot->payload;
+                 ring_->push();
+                 // The firmware posts an event here, and the frame loop
+                 // starts the next read
+                 post(sock_.get_executor(), [this]() { read_header(); });
+               });
+  }
+
+  tcp::socket& sock_;
+  Counter& counter_;
+  Ring* ring_;
+  std::unique_ptr<uint8_t[]> coded_;
+  const uint8_t* ref_;
+  std::atomic<bool> parked_;
+  uint64_t reads_;
+};
+
+std::vector<uint8_t> apa102_slice(std::mt19937& rng, int changes_in) {
+  auto frame = std::make_unique<RGBFrame>();
+  for (int x = 0; x < Config::W; ++x) {
+    for (int y = 0; y < Config::H; ++y) {
+      frame->pixel(x, y) = rng() % changes_in
+                               ? RGB(x % 256, y * 5, (x + y) % 256)
+                               : RGB(rng(), rng(), rng());
+    }
+  }
+  std::vector<uint8_t> buf;
+  encode_slice(*frame, 0, WireFormat::APA102, buf);
+  return buf;
+}
+
+void append_frame(std::vector<uint8_t>& stream, uint64_t num,
+                  const std::vector<uint8_t>& payload) {
+  auto h = make_frame_header(num, 0, 0, WireFormat::APA102, payload.data(),
+                             payload.size());
+  auto p = reinterpret_cast<const uint8_t*>(&h);
+  stream.insert(stream.end(), p, p + sizeof(h));
+  stream.insert(stream.end(), payload.begin(), payload.end());
+}
+
+// A local server writing APA102 frames over loopback as fast as the client
+// takes them, and the client's IO thread reading them into its jitter
+// buffer. The timed loop is the client's frame loop, releasing each frame
+// as it arrives and waking the reader. Uncoded frames are full slices;
+// coded ones are deltas changing one pixel in 20, after a key frame.
+template <typename R, WireCodec CODEC>
+void client_read(BenchState& state) {
+  io_context ctx;
+  tcp::acceptor acceptor(ctx, tcp::endpoint(address_v4::loopback(), 0));
+  tcp::socket tx(ctx);
+  tcp::socket rx(ctx);
+  tx.connect(acceptor.local_endpoint());
+  acceptor.accept(rx);
+  tx.set_option(tcp::no_delay(true));
+
+  std::mt19937 rng(1);
+  auto ref = apa102_slice(rng, 20);
+  std::vector<uint8_t> key, stream;
+  int frames_in_stream = 1;
+  if (CODEC == WireCodec::NONE) {
+    append_frame(stream, 0, ref);
+  } else {
+    frames_in_stream = 8;
+    key.resize(max_coded_size(ref.size()));
+    key.resize(slice_encode(ref.data(), nullptr, ref.size(), key.data()));
+    // Deltas against whatever the client decoded last, so any number of
+    // them may follow the key frame
+    std::vector<uint8_t> delta;
+    for (int i = 0; i < frames_in_stream; ++i) {
+      auto cur = apa102_slice(rng, 20);
+      delta.resize(max_coded_size(ref.size()));
+      delta.resize(
+          slice_encode(cur.data(), ref.data(), ref.size(), delta.data()));
+      append_frame(stream, i, delta);
+    }
+  }
+
+  std::atomic<bool> stop(false);
+  std::thread server([&]() {
+    boost::system::error_code ec;
+    if (!key.empty()) {
+      std::vector<uint8_t> first;
+      append_frame(first, 0, key);
+      write(tx, buffer(first), ec);
+    }
+    while (!ec && !stop) {
+      write(tx, buffer(stream), ec);
+    }
+  });
+
+  auto ring = std::make_unique<Ring>();
+  Counter counter;
+  R reader(rx, counter, WireFormat::APA102, CODEC);
+  std::thread io([&]() {
+    reader.start(*ring, 1);
+    auto work = make_work_guard(ctx);
+    ctx.run();
+  });
+
+  uint64_t frames = 0;
+  state.set_items_per_iter(1);
+  state.set_bytes_per_iter(stream.size() / frames_in_stream);
+  state.measure([&]() {
+    while (!ring->level()) {
+      if (counter.failed) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+    ring->pop();
+    reader.wake();
+    ++frames;
+  });
+  stop = true;
+  ctx.stop();
+  io.join();
+  boost::system::error_code ec;
+  rx.close(ec);
+  server.join();
+  state.set_counter("errors", counter.failed ? 1 : 0);
+  state.set_counter("frames_per_read",
+                    reader.reads() ? static_cast<double>(frames) /
+                                         reader.reads()
+                                   : 0);
+}
+
+void client_read_apa102_per_frame(BenchState& s) {
+  client_read<PerFrameReader, WireCodec::NONE>(s);
+}
+void client_read_apa102_batched(BenchState& s) {
+  client_read<Reader, WireCodec::NONE>(s);
+}
+void client_read_delta_per_frame(BenchState& s) {
+  client_read<PerFrameReader, WireCodec::DELTA_RLE>(s);
+}
+void client_read_delta_batched(BenchState& s) {
+  client_read<Reader, WireCodec::DELTA_RLE>(s);
+}
+
+BENCHMARK(client_read_apa102_per_frame);
+BENCHMARK(client_read_apa102_batched);
+BENCHMARK(client_read_delta_per_frame);
+BENCHMARK(client_read_delta_batched);
+
+}  // namespace
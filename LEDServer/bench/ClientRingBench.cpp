@@ -0,0 +1,100 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "Bench.h"
+#include "LEDClient/main/RingBuffer.h"
+
+namespace {
+
+// The client's jitter buffer ring, with slots numbered like frames
+struct Slot {
+  uint64_t num;
+  uint8_t payload[56];
+};
+
+typedef RingBuffer<Slot, 16> Ring;
+
+// Push and pop on one thread, the cost of the ring's bookkeeping alone
+void client_ring_push_pop(BenchState& state) {
+  auto ring = std::make_unique<Ring>();
+  uint64_t num = 0;
+  state.set_items_per_iter(1);
+  state.measure([&]() {
+    ring->reserve()->num = num++;
+    ring->push();
+    auto n = ring->front().num;
+    asm volatile("" : : "r"(n));
+    ring->pop();
+  });
+}
+
+// A producer thread filling the ring as fast as it drains, and a consumer
+// thread checking that slots arrive complete and in order. With SKIP the
+// consumer releases all but the newest slot in bulk each time, as a client
+// catching up does. Slots out of order, or read before the producer
+// finished writing them, are errors and fail the run.
+template <bool SKIP>
+void spsc(BenchState& state) {
+  auto ring = std::make_unique<Ring>();
+  std::atomic<bool> stop(false);
+  uint64_t errors = 0;
+  uint64_t skipped = 0;
+  std::thread consumer([&]() {
+    uint64_t expected = 0;
+    while (true) {
+      auto level = ring->level();
+      if (!level) {
+        if (stop.load()) {
+          return;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+      if (SKIP) {
+        skipped += ring->skip(level);
+      }
+      auto& slot = ring->front();
+      bool in_order = SKIP ? slot.num >= expected : slot.num == expected;
+      bool whole = true;
+      for (auto b : slot.payload) {
+        whole &= b == (slot.num & 0xff);
+      }
+      if (!in_order || !whole) {
+        ++errors;
+      }
+      expected = slot.num + 1;
+      ring->pop();
+    }
+  });
+  uint64_t num = 0;
+  state.set_items_per_iter(1);
+  state.measure([&]() {
+    Slot* slot;
+    while (!(slot = ring->reserve())) {
+      std::this_thread::yield();
+    }
+    slot->num = num;
+    memset(slot->payload, num++ & 0xff, sizeof(slot->payload));
+    ring->push();
+  });
+  stop = true;
+  consumer.join();
+  state.set_counter("errors", errors);
+  state.set_counter("skipped_per_slot", static_cast<double>(skipped) / num);
+  if (errors) {
+    state.fail(std::to_string(errors) + " slots out of order or torn");
+  }
+}
+
+void client_ring_spsc(BenchState& s) { spsc<false>(s); }
+void client_ring_spsc_skip(BenchState& s) { spsc<true>(s); }
+
+BENCHMARK(client_ring_push_pop);
+BENCHMARK(client_ring_spsc);
+BENCHMARK(client_ring_spsc_skip);
+
+}  // namespace
@@ -0,0 +1,114 @@
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Bench.h"
+#include "LEDCommon/SliceCodec.h"
+#include "SliceEncoder.h"
+#include "Types.h"
+
+namespace {
+
+// Pairs of consecutive APA102 slices, as the firmware receives them:
+// the previous one and the one coded against it
+enum Scene {
+  STILL,   // nothing changes, as in Test
+  KEY,     // a gradient with nothing to code against
+  SCROLL,  // a gradient moving a column per frame
+  SPARSE,  // one pixel in 20 changes at random
+};
+
+std::vector<uint8_t> apa102_slice(const std::function<RGB(int, int)>& color) {
+  auto frame = std::make_unique<RGBFrame>();
+  for (int x = 0; x < Config::W; ++x) {
+    for (int y = 0; y < Config::H; ++y) {
+      frame->pixel(x, y) = color(x, y);
+    }
+  }
+  std::vector<uint8_t> buf;
+  encode_slice(*frame, 0, WireFormat::APA102, buf);
+  return buf;
+}
+
+RGB gradient(int x, int y) { return RGB(x % 256, y * 5, (x + y) % 256); }
+
+void scene(Scene s, std::vector<uint8_t>& ref, std::vector<uint8_t>& cur) {
+  std::mt19937 rng(1);
+  switch (s) {
+    case STILL:
+      ref = apa102_slice([](int x, int y) {
+        return x % 8 == 0 || y % 8 == 6 ? RGB(0, 0xff, 0) : RGB(0, 0, 0);
+      });
+      cur = ref;
+      break;
+    case KEY:
+      ref.clear();
+      cur = apa102_slice(gradient);
+      break;
+    case SCROLL:
+      ref = apa102_slice(gradient);
+      cur = apa102_slice([](int x, int y) { return gradient(x + 1, y); });
+      break;
+    case SPARSE:
+      ref = apa102_slice(gradient);
+      cur = apa102_slice([&](int x, int y) {
+        return rng() % 20 ? gradient(x, y) : RGB(rng(), rng(), rng());
+      });
+      break;
+  }
+}
+
+// Bytes per iteration are the decoded payload's, so MB/s compare with raw
+template <Scene S>
+void encode(BenchState& state) {
+  std::vector<uint8_t> ref, cur;
+  scene(S, ref, cur);
+  std::vector<uint8_t> out(max_coded_size(cur.size()));
+  auto r = ref.empty() ? nullptr : ref.data();
+  size_t size = slice_encode(cur.data(), r, cur.size(), out.data());
+  state.set_bytes_per_iter(cur.size());
+  state.set_counter("ratio", static_cast<double>(cur.size()) / size);
+  state.set_counter("coded_bytes", size);
+  state.measure([&]() {
+    auto n = slice_encode(cur.data(), r, cur.size(), out.data());
+    asm volatile("" : : "r"(n), "r"(out.data()) : "memory");
+  });
+}
+
+// Into a separate slot, as when the buffer has moved on to the next one
+template <Scene S>
+void decode(BenchState& state) {
+  std::vector<uint8_t> ref, cur;
+  scene(S, ref, cur);
+  std::vector<uint8_t> coded(max_coded_size(cur.size()));
+  auto r = ref.empty() ? nullptr : ref.data();
+  coded.resize(slice_encode(cur.data(), r, cur.size(), coded.data()));
+  std::vector<uint8_t> out(cur.size());
+  state.set_bytes_per_iter(out.size());
+  state.measure([&]() {
+    bool ok = slice_decode(coded.data(), coded.size(), r, out.data(),
+                           out.size());
+    asm volatile("" : : "r"(ok), "r"(out.data()) : "memory");
+  });
+}
+
+void codec_encode_still(BenchState& s) { encode<STILL>(s); }
+void codec_encode_key(BenchState& s) { encode<KEY>(s); }
+void codec_encode_scroll(BenchState& s) { encode<SCROLL>(s); }
+void codec_encode_sparse(BenchState& s) { encode<SPARSE>(s); }
+void codec_decode_still(BenchState& s) { decode<STILL>(s); }
+void codec_decode_key(BenchState& s) { decode<KEY>(s); }
+void codec_decode_scroll(BenchState& s) { decode<SCROLL>(s); }
+void codec_decode_sparse(BenchState& s) { decode<SPARSE>(s); }
+
+BENCHMARK(codec_encode_still);
+BENCHMARK(codec_encode_key);
+BENCHMARK(codec_encode_scroll);
+BENCHMARK(codec_encode_sparse);
+BENCHMARK(codec_decode_still);
+BENCHMARK(codec_decode_key);
+BENCHMARK(codec_decode_scroll);
+BENCHMARK(codec_decode_sparse);
+
+}  // namespace
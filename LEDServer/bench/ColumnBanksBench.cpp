@@ -0,0 +1,93 @@
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "Bench.h"
+#include "LEDClient/main/ColumnBanks.h"
+
+namespace {
+
+const int W = 288;
+
+// A column buffer, every word stamped with the number of the frame loaded
+// into it. Relaxed atomics, so the ISR can read one mid-load without the
+// race being undefined; ColumnBanks alone orders the loads.
+struct Column {
+  std::atomic<uint32_t> words[50];
+
+  void load(uint32_t frame) {
+    for (auto& w : words) {
+      w.store(frame, std::memory_order_relaxed);
+    }
+  }
+};
+
+// A thread standing in for the column ISR sends revolution after
+// revolution from the front bank, flipping between them, and counts those
+// that mixed frames, within a column or between columns. The timed loop is
+// the frame loop, loading each frame into the back bank as soon as the
+// last one is on display. With BANKS false it loads into the only bank
+// while it is being sent, as the client did, for comparison: torn
+// revolutions are expected without banks, and fail the run with them.
+template <bool BANKS>
+void column_load(BenchState& state) {
+  auto a = std::make_unique<Column[]>(W);
+  auto b = std::make_unique<Column[]>(W);
+  ColumnBanks<Column> banks(a.get(), b.get());
+  std::atomic<bool> stop(false);
+  uint64_t revolutions = 0;
+  uint64_t torn = 0;
+  std::thread isr([&]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      auto bank = banks.front();
+      auto frame = bank[0].words[0].load(std::memory_order_relaxed);
+      bool mixed = false;
+      for (int x = 0; x < W; ++x) {
+        auto& words = bank[x].words;
+        mixed |= words[0].load(std::memory_order_relaxed) != frame ||
+                 words[49].load(std::memory_order_relaxed) != frame;
+      }
+      ++revolutions;
+      torn += mixed;
+      banks.flip();
+    }
+  });
+
+  uint32_t frame = 0;
+  state.set_items_per_iter(1);
+  state.measure([&]() {
+    ++frame;
+    if (BANKS) {
+      while (banks.staged()) {
+        std::this_thread::yield();
+      }
+      auto bank = banks.back();
+      for (int x = 0; x < W; ++x) {
+        bank[x].load(frame);
+      }
+      banks.stage();
+    } else {
+      auto bank = banks.front();
+      for (int x = 0; x < W; ++x) {
+        bank[x].load(frame);
+      }
+    }
+  });
+  stop = true;
+  isr.join();
+  state.set_counter("revolutions", revolutions);
+  state.set_counter("torn_revolutions", torn);
+  if (BANKS && torn) {
+    state.fail(std::to_string(torn) + " revolutions mixed frames");
+  }
+}
+
+void column_load_single_bank(BenchState& s) { column_load<false>(s); }
+void column_load_banks(BenchState& s) { column_load<true>(s); }
+
+BENCHMARK(column_load_single_bank);
+BENCHMARK(column_load_banks);
+
+}  // namespace
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "LEDClient/main/ColumnBanks.h"
+#include "LEDClient/main/ColumnOutput.h"
+#include "LEDCommon/APA102.h"
+#include "Types.h"
+
+namespace {
+
+const int W = Config::W;
+typedef APA102Column<Config::STRIP_H> Column;
+// The column clock, 16 columns a revolution per second of W
+const uint64_t EDGE_NS = 1000000000ull / (W * 16);
+
+// A bus sending transfers back to back at a fixed bit rate, on a clock the
+// caller sets. Records when each transfer was queued, when it would start
+// and finish on the bus, and the first bytes it carried, and counts those
+// whose bytes changed before they were reaped, as DMA would have sent
+// whatever was written over them.
+class MockOutput : public ColumnOutput {
+ public:
+  struct Transfer {
+    uint64_t queued_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    const uint8_t* data;
+    size_t size;
+    uint8_t head[4];
+  };
+
+  MockOutput(size_t depth, uint64_t bits_per_s)
+      : depth_(depth),
+        bits_per_s_(bits_per_s),
+        now_ns_(0),
+        bus_free_ns_(0),
+        over_depth_(0),
+        overwritten_(0) {}
+
+  size_t depth() const override { return depth_; }
+
+  void queue(const uint8_t* data, size_t size) override {
+    if (in_flight_.size() == depth_) {
+      ++over_depth_;
+    }
+    Transfer t;
+    t.queued_ns = now_ns_;
+    t.start_ns = std::max(now_ns_, bus_free_ns_);
+    t.end_ns = t.start_ns + size * 8 * 1000000000ull / bits_per_s_;
+    t.data = data;
+    t.size = size;
+    memcpy(t.head, data, sizeof(t.head));
+    bus_free_ns_ = t.end_ns;
+    in_flight_.push_back(t);
+    log_.push_back(t);
+  }
+
+  size_t reap() override {
+    size_t n = 0;
+    while (!in_flight_.empty() && in_flight_.front().end_ns <= now_ns_) {
+      auto& t = in_flight_.front();
+      overwritten_ += memcmp(t.data, t.head, sizeof(t.head)) != 0;
+      in_flight_.pop_front();
+      ++n;
+    }
+    return n;
+  }
+
+  void set_now(uint64_t ns) { now_ns_ = ns; }
+  // Transfers queued beyond depth(), which the driver would refuse
+  uint64_t over_depth() const { return over_depth_; }
+  // Transfers whose bytes changed between being queued and reaped
+  uint64_t overwritten() const { return overwritten_; }
+  std::vector<Transfer>& log() { return log_; }
+
+ private:
+  size_t depth_;
+  uint64_t bits_per_s_;
+  uint64_t now_ns_;
+  uint64_t bus_free_ns_;
+  uint64_t over_depth_;
+  uint64_t overwritten_;
+  std::deque<Transfer> in_flight_;
+  std::vector<Transfer> log_;
+};
+
+// Two jitter buffer slots shown in place, each column's first bytes
+// stamped with its slot, x, and the frame loaded into the slot, so the
+// recording can be checked
+struct Banks {
+  Banks() : data{std::vector<uint8_t>(W * Column::SIZE),
+                 std::vector<uint8_t>(W * Column::SIZE)},
+            blank(Column::SIZE) {
+    for (int b = 0; b < 2; ++b) {
+      for (int x = 0; x < W; ++x) {
+        auto c = &data[b][x * Column::SIZE];
+        c[0] = b;
+        c[1] = x & 0xff;
+        c[2] = x >> 8;
+      }
+      load(b, 0);
+    }
+  }
+
+  // A frame received into slot b, once the slot was released
+  void load(int b, uint8_t frame) {
+    for (int x = 0; x < W; ++x) {
+      data[b][x * Column::SIZE + 3] = frame;
+    }
+  }
+
+  std::vector<uint8_t> data[2];
+  std::vector<uint8_t> blank;
+};
+
+// The client's LED task: each iteration is a wakeup by the column clock,
+// normally one edge after the last, and every MISS_EVERY wakeups two, as
+// when the task was held up past an edge. Each column is sent as slices
+// shown in place are, the column then a blank one, and the frame loop
+// releases the slot taken off display, receives the next frame into it and
+// stages it, so every revolution ends in a flip. It releases the slot once
+// the sender has drained it, or with EARLY_RELEASE at the flip, with the
+// last columns still queued, as the client once did.
+//
+// At the end of each revolution the recording is checked: its columns in
+// order, all from one frame in one slot, each followed by the blank, never
+// more queued than the output holds, and the next slot staged in time.
+// Anything else counts as an error, as does a transfer overwritten before it was reaped, and fails
+// the run. Releasing early must be caught as overwritten transfers. The
+// bus timing gives how long after its edge each column starts, and at
+// 24 MHz the bus keeps up with no overruns; at 12 MHz a column takes
+// longer than the clock period, and the sender drops columns rather than
+// falling further behind.
+template <uint64_t BITS_PER_S, int MISS_EVERY, bool EARLY_RELEASE = false>
+void column_send(BenchState& state) {
+  Banks banks;
+  ColumnBanks<const uint8_t> front(banks.data[0].data(),
+                                   banks.data[1].data());
+  MockOutput out(4, BITS_PER_S);
+  ColumnSender<W> sender(out);
+  uint64_t now = 0;
+  uint64_t wakeups = 0;
+  uint64_t revolutions = 0;
+  uint64_t errors = 0;
+  uint64_t columns = 0;
+  uint64_t latency_ns = 0;
+  uint64_t max_latency_ns = 0;
+
+  auto check = [&]() {
+    auto& log = out.log();
+    if (log.size() % 2) {
+      ++errors;
+    }
+    int last_x = -1;
+    int bank = -1;
+    int frame = -1;
+    for (size_t i = 0; i + 1 < log.size(); i += 2) {
+      auto c = log[i].head;
+      int x = c[1] | c[2] << 8;
+      if (x <= last_x || (bank >= 0 && (c[0] != bank || c[3] != frame)) ||
+          log[i].size != Column::SIZE ||
+          log[i + 1].data != banks.blank.data()) {
+        ++errors;
+      }
+      last_x = x;
+      bank = c[0];
+      frame = c[3];
+      auto late = log[i].start_ns - log[i].queued_ns;
+      latency_ns += late;
+      max_latency_ns = std::max<uint64_t>(max_latency_ns, late);
+      ++columns;
+    }
+    log.clear();
+  };
+
+  auto fill = [&](int x, ColumnTransfers& t) {
+    t.add(front.front() + x * Column::SIZE, Column::SIZE);
+    t.add(banks.blank.data(), Column::SIZE);
+  };
+  uint8_t frame = 0;
+  auto release = [&]() {
+    banks.load(front.back() == banks.data[0].data() ? 0 : 1, ++frame);
+    front.stage();
+  };
+  auto on_wrap = [&]() {
+    check();
+    // A slot released and staged by now, or the frame loop fell behind
+    if (!front.flip()) {
+      ++errors;
+    }
+    if (EARLY_RELEASE) {
+      release();
+    }
+    ++revolutions;
+  };
+  auto on_drained = [&]() {
+    if (!EARLY_RELEASE) {
+      release();
+    }
+  };
+  front.stage();
+
+  state.set_items_per_iter(1);
+  state.measure([&]() {
+    uint32_t edges = ++wakeups % MISS_EVERY ? 1 : 2;
+    now += edges * EDGE_NS;
+    out.set_now(now);
+    sender.on_edges(edges, fill, on_wrap, on_drained);
+  });
+  errors += out.over_depth();
+  state.set_counter("revolutions", revolutions);
+  state.set_counter("errors", errors);
+  state.set_counter("overwritten", out.overwritten());
+  state.set_counter("missed", sender.missed());
+  state.set_counter("overruns", sender.overruns());
+  state.set_counter("start_latency_us",
+                    columns ? latency_ns / 1000.0 / columns : 0);
+  state.set_counter("max_start_latency_us", max_latency_ns / 1000.0);
+  if (errors) {
+    state.fail(std::to_string(errors) + " errors in the columns sent");
+  }
+  if (EARLY_RELEASE != (out.overwritten() != 0)) {
+    state.fail(std::to_string(out.overwritten()) +
+               " transfers overwritten before they were reaped");
+  }
+}
+
+void column_send_24mhz(BenchState& s) {
+  column_send<24000000, 1 << 30>(s);
+}
+void column_send_24mhz_missed_edges(BenchState& s) {
+  column_send<24000000, 50>(s);
+}
+void column_send_12mhz(BenchState& s) {
+  column_send<12000000, 1 << 30>(s);
+}
+void column_send_24mhz_early_release(BenchState& s) {
+  column_send<24000000, 1 << 30, true>(s);
+}
+
+BENCHMARK(column_send_24mhz);
+BENCHMARK(column_send_24mhz_missed_edges);
+BENCHMARK(column_send_12mhz);
+BENCHMARK(column_send_24mhz_early_release);
+
+}  // namespace
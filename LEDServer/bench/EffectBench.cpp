@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "Effect.h"
+#include "Renderer.h"
+#include "Types.h"
+
+namespace {
+
+// One whole frame per iteration on the calling thread
+template <typename E>
+void draw(BenchState& state) {
+  auto frame = std::make_unique<RGBFrame>();
+  E effect;
+  uint64_t num = 0;
+  state.set_items_per_iter(Config::W * Config::H);
+  state.measure([&]() {
+    effect.draw_frame(*frame, FrameTime{num, std::chrono::nanoseconds(0)});
+    ++num;
+    asm volatile("" : : "r"(frame.get()) : "memory");
+  });
+}
+
+// Frames drawn through the Renderer pipeline, sized as the server sizes it:
+// a render thread per spare core and a frame in flight per core
+template <typename E>
+void render(BenchState& state) {
+  int threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  Renderer renderer(threads, threads + 1);
+  std::vector<Renderer::FramePtr> free;
+  for (int i = 0; i < renderer.depth(); ++i) {
+    free.push_back(std::make_shared<RGBFrame>());
+  }
+  E effect;
+  uint64_t num = 0;
+  state.set_items_per_iter(Config::W * Config::H);
+  state.measure([&]() {
+    if (renderer.in_flight() == renderer.depth()) {
+      free.push_back(renderer.collect());
+    }
+    renderer.submit(effect, std::move(free.back()),
+                    FrameTime{num, std::chrono::nanoseconds(0)}, num);
+    free.pop_back();
+    ++num;
+  });
+  while (renderer.in_flight()) {
+    renderer.collect();
+  }
+}
+
+void effect_test_draw(BenchState& s) { draw<Test>(s); }
+void effect_rainbow_hsv_draw(BenchState& s) { draw<RainbowHSV>(s); }
+void effect_rainbow_twist_hsv_draw(BenchState& s) {
+  draw<RainbowTwistHSV>(s);
+}
+void effect_rainbow_hsl_draw(BenchState& s) { draw<RainbowHSL>(s); }
+
+void effect_rainbow_hsv_render(BenchState& s) { render<RainbowHSV>(s); }
+void effect_rainbow_twist_hsv_render(BenchState& s) {
+  render<RainbowTwistHSV>(s);
+}
+void effect_rainbow_hsl_render(BenchState& s) { render<RainbowHSL>(s); }
+
+BENCHMARK(effect_test_draw);
+BENCHMARK(effect_rainbow_hsv_draw);
+BENCHMARK(effect_rainbow_twist_hsv_draw);
+BENCHMARK(effect_rainbow_hsl_draw);
+BENCHMARK(effect_rainbow_hsv_render);
+BENCHMARK(effect_rainbow_twist_hsv_render);
+BENCHMARK(effect_rainbow_hsl_render);
+
+}  // namespace
@@ -0,0 +1,78 @@
+#include <memory>
+#include <vector>
+
+#include "Bench.h"
+#include "LEDCommon/Protocol.h"
+#include "SliceEncoder.h"
+#include "Types.h"
+
+namespace {
+
+std::unique_ptr<RGBFrame> test_frame() {
+  auto frame = std::make_unique<RGBFrame>();
+  for (int x = 0; x < Config::W; ++x) {
+    for (int y = 0; y < Config::H; ++y) {
+      frame->pixel(x, y) = RGB(x, y, x ^ y);
+    }
+  }
+  return frame;
+}
+
+// Bands of 64 colors, few enough for an exact palette
+std::unique_ptr<RGBFrame> banded_frame() {
+  auto frame = std::make_unique<RGBFrame>();
+  for (int x = 0; x < Config::W; ++x) {
+    for (int y = 0; y < Config::H; ++y) {
+      int band = (x / 8 + y / 16) % 64;
+      frame->pixel(x, y) = RGB(band * 4, 255 - band * 4, band * 2);
+    }
+  }
+  return frame;
+}
+
+// What a connection does to each frame before writing it: pick out the
+// slice, encode it in the client's format and seal it under a header
+template <WireFormat FORMAT>
+void encode(BenchState& state,
+            std::unique_ptr<RGBFrame> frame = test_frame()) {
+  std::vector<uint8_t> buf;
+  uint64_t num = 0;
+  state.set_bytes_per_iter(encode_slice(*frame, 0, FORMAT, buf).size());
+  state.measure([&]() {
+    auto payload = encode_slice(*frame, 0, FORMAT, buf);
+    auto header = make_frame_header(
+        num++, 0, 0, FORMAT, static_cast<const uint8_t*>(payload.data()),
+        payload.size());
+    asm volatile("" : : "r"(&header), "r"(buf.data()) : "memory");
+  });
+}
+
+void slice_crc32(BenchState& state) {
+  auto frame = test_frame();
+  auto slice = frame->slice_data(0);
+  state.set_bytes_per_iter(slice.size());
+  state.measure([&]() {
+    auto crc = crc32(static_cast<const uint8_t*>(slice.data()), slice.size());
+    asm volatile("" : : "r"(crc));
+  });
+}
+
+void slice_encode_raw_bgr(BenchState& s) { encode<WireFormat::RAW_BGR>(s); }
+void slice_encode_apa102(BenchState& s) { encode<WireFormat::APA102>(s); }
+void slice_encode_rgb565(BenchState& s) { encode<WireFormat::RGB565>(s); }
+// More than 256 colors, so quantized to the fixed cube
+void slice_encode_palette8(BenchState& s) {
+  encode<WireFormat::PALETTE8>(s);
+}
+void slice_encode_palette8_exact(BenchState& s) {
+  encode<WireFormat::PALETTE8>(s, banded_frame());
+}
+
+BENCHMARK(slice_crc32);
+BENCHMARK(slice_encode_raw_bgr);
+BENCHMARK(slice_encode_apa102);
+BENCHMARK(slice_encode_rgb565);
+BENCHMARK(slice_encode_palette8);
+BENCHMARK(slice_encode_palette8_exact);
+
+}  // namespace
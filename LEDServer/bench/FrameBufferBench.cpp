@@ -0,0 +1,80 @@
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "FrameBuffer.h"
+#include "FramePool.h"
+#include "Types.h"
+
+namespace {
+
+// One producer pushing pooled frames to CONSUMERS threads popping every one
+// they can, timed per frame pushed. With BLOCK the producer runs at the pace
+// of the slowest consumer; with DROP_OLDEST it never waits, and the frames
+// consumers lost are reported as skipped_per_frame.
+template <size_t CONSUMERS, LagPolicy POLICY>
+void push_pop(BenchState& state) {
+  typedef FrameBuffer<RGBFrame, 16, CONSUMERS> Buffer;
+  // Frames in the ring, one held by each consumer, and the one being pushed
+  RGBFramePool pool(Buffer::max_frames() + CONSUMERS + 1, false, false);
+  auto frames = std::make_unique<Buffer>();
+  std::vector<std::thread> consumers;
+  for (size_t i = 0; i < CONSUMERS; ++i) {
+    frames->set_policy(i, POLICY);
+    consumers.emplace_back([&frames, i]() {
+      uint64_t num;
+      while (frames->pop(i, num)) {
+      }
+    });
+  }
+  uint64_t num = 0;
+  state.set_items_per_iter(1);
+  state.measure([&]() { frames->push(num++, pool.acquire()); });
+  frames->cancel();
+  for (auto& t : consumers) {
+    t.join();
+  }
+  uint64_t skipped = 0;
+  for (size_t i = 0; i < CONSUMERS; ++i) {
+    skipped += frames->stats(i).skipped;
+  }
+  state.set_counter("skipped_per_frame",
+                    static_cast<double>(skipped) / CONSUMERS / num);
+}
+
+void framebuffer_push_pop_block_1(BenchState& s) {
+  push_pop<1, LagPolicy::BLOCK>(s);
+}
+void framebuffer_push_pop_block_2(BenchState& s) {
+  push_pop<2, LagPolicy::BLOCK>(s);
+}
+void framebuffer_push_pop_block_4(BenchState& s) {
+  push_pop<4, LagPolicy::BLOCK>(s);
+}
+void framebuffer_push_pop_block_8(BenchState& s) {
+  push_pop<8, LagPolicy::BLOCK>(s);
+}
+void framebuffer_push_pop_drop_oldest_1(BenchState& s) {
+  push_pop<1, LagPolicy::DROP_OLDEST>(s);
+}
+void framebuffer_push_pop_drop_oldest_2(BenchState& s) {
+  push_pop<2, LagPolicy::DROP_OLDEST>(s);
+}
+void framebuffer_push_pop_drop_oldest_4(BenchState& s) {
+  push_pop<4, LagPolicy::DROP_OLDEST>(s);
+}
+void framebuffer_push_pop_drop_oldest_8(BenchState& s) {
+  push_pop<8, LagPolicy::DROP_OLDEST>(s);
+}
+
+BENCHMARK(framebuffer_push_pop_block_1);
+BENCHMARK(framebuffer_push_pop_block_2);
+BENCHMARK(framebuffer_push_pop_block_4);
+BENCHMARK(framebuffer_push_pop_block_8);
+BENCHMARK(framebuffer_push_pop_drop_oldest_1);
+BENCHMARK(framebuffer_push_pop_drop_oldest_2);
+BENCHMARK(framebuffer_push_pop_drop_oldest_4);
+BENCHMARK(framebuffer_push_pop_drop_oldest_8);
+
+}  // namespace
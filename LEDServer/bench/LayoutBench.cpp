@@ -0,0 +1,77 @@
+#include <cstring>
+#include <memory>
+
+#include "Bench.h"
+#include "Types.h"
+
+namespace {
+
+// Writes every pixel, visiting them row by row or column by column
+template <typename Layout, bool BY_ROWS>
+void fill(BenchState& state) {
+  auto frame = std::make_unique<BasicRGBFrame<Layout>>();
+  uint8_t v = 0;
+  state.set_items_per_iter(Config::W * Config::H);
+  state.measure([&]() {
+    ++v;
+    if (BY_ROWS) {
+      for (int y = 0; y < Config::H; ++y) {
+        for (int x = 0; x < Config::W; ++x) {
+          frame->pixel(x, y) = RGB(v, x, y);
+        }
+      }
+    } else {
+      for (int x = 0; x < Config::W; ++x) {
+        for (int y = 0; y < Config::H; ++y) {
+          frame->pixel(x, y) = RGB(v, x, y);
+        }
+      }
+    }
+    asm volatile("" : : "r"(frame.get()) : "memory");
+  });
+}
+
+// Copies slice 0 into a buffer in client scan order (column by column)
+template <typename Layout>
+void extract_slice(BenchState& state) {
+  auto frame = std::make_unique<BasicRGBFrame<Layout>>();
+  auto out = std::make_unique<RGB[]>(Config::W * Config::STRIP_H);
+  state.set_bytes_per_iter(Config::W * Config::STRIP_H * sizeof(RGB));
+  state.measure([&]() {
+    if (Layout::SLICE_CONTIGUOUS) {
+      memcpy(out.get(), &frame->pixel(0, 0),
+             Config::W * Config::STRIP_H * sizeof(RGB));
+    } else {
+      RGB* w = out.get();
+      for (int x = 0; x < Config::W; ++x) {
+        for (int y = 0; y < Config::STRIP_H; ++y) {
+          *w++ = frame->pixel(x, y);
+        }
+      }
+    }
+    asm volatile("" : : "r"(out.get()) : "memory");
+  });
+}
+
+void layout_row_major_fill_rows(BenchState& s) { fill<RowMajor, true>(s); }
+void layout_row_major_fill_columns(BenchState& s) { fill<RowMajor, false>(s); }
+void layout_slice_major_fill_rows(BenchState& s) { fill<SliceMajor, true>(s); }
+void layout_slice_major_fill_columns(BenchState& s) {
+  fill<SliceMajor, false>(s);
+}
+
+void layout_row_major_extract_slice(BenchState& s) {
+  extract_slice<RowMajor>(s);
+}
+void layout_slice_major_extract_slice(BenchState& s) {
+  extract_slice<SliceMajor>(s);
+}
+
+BENCHMARK(layout_row_major_fill_rows);
+BENCHMARK(layout_row_major_fill_columns);
+BENCHMARK(layout_slice_major_fill_rows);
+BENCHMARK(layout_slice_major_fill_columns);
+BENCHMARK(layout_row_major_extract_slice);
+BENCHMARK(layout_slice_major_extract_slice);
+
+}  // namespace
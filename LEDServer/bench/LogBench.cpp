@@ -0,0 +1,75 @@
+#include <boost/log/core.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/sinks/sync_frontend.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/make_shared.hpp>
+#include <iomanip>
+#include <sstream>
+
+#include "AsyncLog.h"
+#include "Bench.h"
+
+namespace {
+
+// Accepts every record and throws it away, so records are fully formatted
+// but nothing is written
+class NullBackend : public boost::log::sinks::basic_sink_backend<
+                        boost::log::sinks::synchronized_feeding> {
+ public:
+  void consume(const boost::log::record_view&) {}
+};
+
+void use_null_sink() {
+  static bool added = false;
+  if (!added) {
+    boost::log::core::get()->add_sink(boost::make_shared<
+        boost::log::sinks::synchronous_sink<NullBackend>>());
+    added = true;
+  }
+}
+
+// The per-frame send log as it was: Boost.Log with the id formatted by a
+// stringstream, as Connection::id_str() does
+void log_boost_frame_sent(BenchState& state) {
+  use_null_sink();
+  uint8_t id[6] = {0x24, 0x0a, 0xc4, 0xc0, 0x6b, 0xf0};
+  uint64_t num = 0;
+  state.measure([&]() {
+    std::stringstream ss;
+    ss << std::setfill('0') << std::hex;
+    for (int i = 0; i < 6; ++i) {
+      ss << (i ? "-" : "") << std::setw(2) << static_cast<int>(id[i]);
+    }
+    BOOST_LOG_TRIVIAL(info) << "Frame " << num++ << " sent to client ID "
+                            << ss.str() << " [" << 6944 << " bytes]";
+  });
+}
+
+// The same record through ALOG. Records the log thread could not keep up
+// with are dropped, which is cheaper still, so the drop rate is reported.
+void log_async_frame_sent(BenchState& state) {
+  use_null_sink();
+  uint8_t id[6] = {0x24, 0x0a, 0xc4, 0xc0, 0x6b, 0xf0};
+  uint64_t num = 0;
+  auto before = AsyncLog::get().stats();
+  state.measure([&]() {
+    ALOG(info, "Frame {} sent to client ID {} [{} bytes]", num++, LogId{id},
+         6944);
+  });
+  auto after = AsyncLog::get().stats();
+  state.set_counter("dropped_per_record",
+                    static_cast<double>(after.dropped - before.dropped) / num);
+}
+
+// A call site limited to one record a second
+void log_async_rate_limited(BenchState& state) {
+  uint64_t num = 0;
+  state.measure(
+      [&]() { ALOG_RATE(info, 1, "Frame {} sent to client", num++); });
+}
+
+BENCHMARK(log_boost_frame_sent);
+BENCHMARK(log_async_frame_sent);
+BENCHMARK(log_async_rate_limited);
+
+}  // namespace
@@ -0,0 +1,71 @@
+#include <array>
+#include <boost/asio.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "LEDCommon/Protocol.h"
+#include "SliceEncoder.h"
+#include "Types.h"
+
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+namespace {
+
+// Frames encoded and written as a connection writes them, header and payload
+// in one gathered write, to a TCP socket over loopback. A thread on the other
+// end reads them as a client would, without checking the payload, so the
+// figure is the server's cost plus the kernel's.
+template <WireFormat FORMAT>
+void loopback_send(BenchState& state) {
+  io_context ctx;
+  tcp::acceptor acceptor(ctx, tcp::endpoint(address_v4::loopback(), 0));
+  tcp::socket tx(ctx);
+  tcp::socket rx(ctx);
+  tx.connect(acceptor.local_endpoint());
+  acceptor.accept(rx);
+  tx.set_option(tcp::no_delay(true));
+
+  auto frame = std::make_unique<RGBFrame>();
+  std::vector<uint8_t> buf;
+  auto size = encode_slice(*frame, 0, FORMAT, buf).size();
+  std::thread receiver([&rx, size]() {
+    FrameHeader header;
+    std::vector<uint8_t> payload(size);
+    boost::system::error_code ec;
+    while (!ec) {
+      read(rx, buffer(&header, sizeof(header)), ec);
+      if (!ec) {
+        read(rx, buffer(payload.data(), header.length), ec);
+      }
+    }
+  });
+
+  uint64_t num = 0;
+  state.set_bytes_per_iter(sizeof(FrameHeader) + size);
+  state.measure([&]() {
+    auto payload = encode_slice(*frame, 0, FORMAT, buf);
+    auto header = make_frame_header(
+        num++, 0, 0, FORMAT, static_cast<const uint8_t*>(payload.data()),
+        payload.size());
+    std::array<const_buffer, 2> out = {buffer(&header, sizeof(header)),
+                                       payload};
+    write(tx, out);
+  });
+  tx.shutdown(tcp::socket::shutdown_send);
+  receiver.join();
+}
+
+void loopback_send_raw_bgr(BenchState& s) {
+  loopback_send<WireFormat::RAW_BGR>(s);
+}
+void loopback_send_apa102(BenchState& s) {
+  loopback_send<WireFormat::APA102>(s);
+}
+
+BENCHMARK(loopback_send_raw_bgr);
+BENCHMARK(loopback_send_apa102);
+
+}  // namespace
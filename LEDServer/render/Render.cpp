@@ -0,0 +1,161 @@
+// ledrender: renders the show offline into a show file, for ledserve to play
+// back with next to no CPU.
+//
+//   ledrender [--format raw|apa102|rgb565|palette8] SHOW_FILE
+//
+// Frames are rendered at the nominal frame rate on every core. Tiled effects
+// depend only on the frame time and stateful ones are drawn in order, so the
+// same show always renders to the same bytes.
+
+#include <boost/core/demangle.hpp>
+#include <boost/log/trivial.hpp>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+
+#include "Renderer.h"
+#include "Show.h"
+#include "ShowFile.h"
+
+#define LOG(X) BOOST_LOG_TRIVIAL(X)
+
+namespace {
+
+// Renders each effect of a Sequence into a ShowWriter, once
+class ShowRender {
+ public:
+  explicit ShowRender(ShowWriter& out)
+      : out_(out),
+        rate_(FrameRate::per_revolution(Config::RPM)),
+        // Twice the frames in flight as the server keeps, so the render
+        // threads stay busy while this thread encodes and writes
+        renderer_(std::max(1u, std::thread::hardware_concurrency()) - 1,
+                  2 * std::max(1u, std::thread::hardware_concurrency())),
+        ok_(true) {
+    for (int i = 0; i < renderer_.depth(); ++i) {
+      free_.push_back(std::make_shared<RGBFrame>());
+    }
+  }
+
+  template <typename Effect, size_t secs>
+  std::function<void()> play_secs() {
+    return play_effect<Effect>(rate_.frames_in(std::chrono::seconds(secs)));
+  }
+
+  template <typename Effect, uint64_t frames>
+  std::function<void()> play_frames() {
+    return play_effect<Effect>(frames);
+  }
+
+  FrameRate rate() const { return rate_; }
+  bool ok() const { return ok_; }
+
+ private:
+  template <typename EffectDerived>
+  std::function<void()> play_effect(uint64_t frames) {
+    return [this, frames] {
+      EffectDerived effect;
+      auto start = std::chrono::steady_clock::now();
+      render(effect, frames);
+      std::chrono::duration<double> secs =
+          std::chrono::steady_clock::now() - start;
+      LOG(info) << "Rendered " << frames << " frames of "
+                << boost::core::demangle(typeid(EffectDerived).name())
+                << " in " << secs.count() << "s ("
+                << frames / secs.count() << " fps)";
+    };
+  }
+
+  void render(Effect& effect, uint64_t frames) {
+    if (!effect.tiled()) {
+      auto& frame = *free_.back();
+      for (uint64_t num = 0; num < frames && ok_; ++num) {
+        renderer_.draw(effect, frame, FrameTime{num, rate_.time(num)});
+        ok_ = out_.append(frame);
+      }
+      return;
+    }
+    uint64_t num = 0;
+    while (ok_) {
+      while (num < frames && renderer_.in_flight() < renderer_.depth()) {
+        renderer_.submit(effect, std::move(free_.back()),
+                         FrameTime{num, rate_.time(num)},
+                         out_.frames() + renderer_.in_flight());
+        free_.pop_back();
+        ++num;
+      }
+      if (!renderer_.in_flight()) {
+        break;
+      }
+      auto frame = renderer_.collect();
+      ok_ = out_.append(*frame);
+      free_.push_back(std::move(frame));
+    }
+    while (renderer_.in_flight()) {
+      free_.push_back(renderer_.collect());
+    }
+  }
+
+  ShowWriter& out_;
+  FrameRate rate_;
+  Renderer renderer_;
+  std::vector<Renderer::FramePtr> free_;
+  bool ok_;
+};
+
+int usage() {
+  std::cerr << "Usage: ledrender [--format raw|apa102|rgb565|palette8] "
+               "SHOW_FILE\n";
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  auto format = WireFormat::RAW_BGR;
+  std::string path;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+      ++i;
+      if (!strcmp(argv[i], "raw")) {
+        format = WireFormat::RAW_BGR;
+      } else if (!strcmp(argv[i], "apa102")) {
+        format = WireFormat::APA102;
+      } else if (!strcmp(argv[i], "rgb565")) {
+        format = WireFormat::RGB565;
+      } else if (!strcmp(argv[i], "palette8")) {
+        format = WireFormat::PALETTE8;
+      } else {
+        return usage();
+      }
+    } else if (argv[i][0] != '-' && path.empty()) {
+      path = argv[i];
+    } else {
+      return usage();
+    }
+  }
+  if (path.empty()) {
+    return usage();
+  }
+
+  auto rate = FrameRate::per_revolution(Config::RPM);
+  ShowWriter out(format, rate);
+  if (!out.open(path)) {
+    return 1;
+  }
+  ShowRender render(out);
+  for (auto& play_effect : make_show(render)) {
+    play_effect();
+  }
+  if (!render.ok() || !out.close()) {
+    return 1;
+  }
+  LOG(info) << "Wrote " << out.frames() << " frames to " << path;
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "LEDClient/main/APA102Frame.h"
+#include "LEDCommon/APA102.h"
+#include "Test.h"
+
+namespace {
+
+// The client's column loader is the reference: each encoder must produce
+// the bytes it does, with the header byte carrying the brightness asked
+// for. Column lengths cover one LED, lengths that are not a multiple of
+// the SSSE3 step (4) or the NEON one (16), and the strip's own 48.
+template <size_t S>
+void check_encoders(std::mt19937& rng) {
+  typedef APA102Column<S> Column;
+  std::vector<uint8_t> bgr(S * 3);
+  for (auto& b : bgr) {
+    b = rng();
+  }
+  APA102Frame<S> frame;
+  frame.load(reinterpret_cast<const RGB*>(bgr.data()));
+  // The reference is a whole column with its end frame, then a black copy
+  CHECK(frame.size() == 2 * Column::FRAME_SIZE);
+
+  for (int brightness : {0, 1, 17, 31, 0xff}) {
+    uint8_t header = 0xe0 | (brightness & 0x1f);
+    std::vector<uint8_t> want(frame.data(),
+                              frame.data() + Column::FRAME_SIZE);
+    for (size_t i = 0; i < S; ++i) {
+      want[Column::START_SIZE + i * Column::LED_SIZE] = header;
+    }
+
+    // Fill with a pattern so bytes left unwritten show up
+    std::vector<uint8_t> column(Column::SIZE, 0xa5);
+    Column::encode(bgr.data(), column.data(), brightness);
+    CHECK(!memcmp(column.data(), want.data(), Column::FRAME_SIZE));
+    for (size_t i = Column::FRAME_SIZE; i < Column::SIZE; ++i) {
+      CHECK(column[i] == 0);
+    }
+
+    // Each path writes exactly the LED frames, and nothing past them
+    std::vector<uint8_t> leds(S * Column::LED_SIZE + 16, 0xa5);
+    auto want_leds = want.data() + Column::START_SIZE;
+    auto check_leds = [&]() {
+      CHECK(!memcmp(leds.data(), want_leds, S * Column::LED_SIZE));
+      for (size_t i = S * Column::LED_SIZE; i < leds.size(); ++i) {
+        CHECK(leds[i] == 0xa5);
+      }
+      std::fill(leds.begin(), leds.end(), 0xa5);
+    };
+    Column::encode_leds_scalar(bgr.data(), leds.data(), S, header);
+    check_leds();
+#if defined(__ARM_NEON)
+    Column::encode_leds_neon(bgr.data(), leds.data(), header);
+    check_leds();
+#elif defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("ssse3")) {
+      Column::encode_leds_ssse3(bgr.data(), leds.data(), header);
+      check_leds();
+    }
+#endif
+  }
+}
+
+void apa102_encoders_match_frame_load() {
+  std::mt19937 rng(1);
+  for (int i = 0; i < 20; ++i) {
+    check_encoders<1>(rng);
+    check_encoders<3>(rng);
+    check_encoders<5>(rng);
+    check_encoders<7>(rng);
+    check_encoders<15>(rng);
+    check_encoders<17>(rng);
+    check_encoders<33>(rng);
+    check_encoders<47>(rng);
+    check_encoders<48>(rng);
+    check_encoders<144>(rng);
+  }
+}
+
+TEST(apa102_encoders_match_frame_load);
+
+}  // namespace
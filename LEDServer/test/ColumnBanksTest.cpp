@@ -0,0 +1,145 @@
+#include <cstdint>
+#include <vector>
+
+#include "FakeColumnOutput.h"
+#include "LEDClient/main/ColumnBanks.h"
+#include "LEDClient/main/ColumnOutput.h"
+#include "Test.h"
+
+namespace {
+
+const int W = 8;
+
+// Two slots of W one-byte columns, shown in place as APA102 slices are
+struct Slots {
+  Slots() : data{std::vector<uint8_t>(W), std::vector<uint8_t>(W)} {}
+
+  const uint8_t* begin(int i) const { return data[i].data(); }
+  const uint8_t* end(int i) const { return data[i].data() + W; }
+  // Which slot the column at p is in
+  int of(const uint8_t* p) const { return p >= begin(1) && p < end(1); }
+
+  std::vector<uint8_t> data[2];
+};
+
+void column_banks_stage_keeps_front() {
+  Slots slots;
+  ColumnBanks<const uint8_t> banks(slots.begin(0), slots.begin(1));
+  CHECK(banks.front() == slots.begin(0));
+  CHECK(banks.back() == slots.begin(1));
+  CHECK(!banks.staged());
+  // Nothing staged, nothing to flip to
+  CHECK(!banks.flip());
+  CHECK(banks.front() == slots.begin(0));
+
+  // Staged, the back bank waits for the sender, and the front one stays
+  // on display until it flips
+  banks.back() = slots.end(1);
+  banks.stage();
+  CHECK(banks.staged());
+  CHECK(banks.front() == slots.begin(0));
+  CHECK(banks.flip());
+  CHECK(banks.front() == slots.end(1));
+  CHECK(!banks.staged());
+  CHECK(banks.back() == slots.begin(0));
+  CHECK(!banks.flip());
+  CHECK(banks.front() == slots.end(1));
+}
+
+// A frame staged mid-revolution goes on display at the next one, whole
+void column_banks_flip_at_revolution() {
+  Slots slots;
+  ColumnBanks<const uint8_t> banks(slots.begin(0), slots.begin(1));
+  FakeColumnOutput out(4);
+  ColumnSender<W> sender(out);
+  int revolutions = 0;
+  auto fill = [&](int x, ColumnTransfers& t) {
+    t.add(banks.front() + x, 1);
+  };
+  auto on_wrap = [&]() {
+    banks.flip();
+    ++revolutions;
+  };
+  auto on_drained = []() {};
+
+  for (int x = 0; x < 2 * W; ++x) {
+    if (x == W / 2 - 1) {
+      banks.stage();
+    }
+    out.finish_all();
+    sender.on_edges(1, fill, on_wrap, on_drained);
+  }
+  CHECK(revolutions == 2);
+  auto& log = out.log();
+  if (CHECK(log.size() == 2 * W)) {
+    for (int x = 0; x < W; ++x) {
+      CHECK(log[x] == slots.begin(0) + x);
+      CHECK(log[W + x] == slots.begin(1) + x);
+    }
+  }
+  CHECK(out.over_depth() == 0);
+}
+
+// The client releases the slot taken off display, and receives the next
+// frame into it, on on_drained(). That comes only once the bus has
+// finished with every column sent from the slot, after the flip.
+void column_banks_release_after_reaped() {
+  Slots slots;
+  ColumnBanks<const uint8_t> banks(slots.begin(0), slots.begin(1));
+  FakeColumnOutput out(4);
+  ColumnSender<W> sender(out);
+  int released = 0;
+  bool flipped = false;
+  auto fill = [&](int x, ColumnTransfers& t) {
+    t.add(banks.front() + x, 1);
+  };
+  auto on_wrap = [&]() { flipped = banks.flip(); };
+  auto on_drained = [&]() {
+    // The slot just taken off display, whose transfers are all reaped
+    int old = slots.of(banks.front()) ^ 1;
+    CHECK(!out.reading(slots.begin(old), slots.end(old)));
+    ++released;
+    banks.stage();
+  };
+  banks.stage();
+
+  // The bus keeps up until the last two columns of the revolution
+  for (int x = 0; x < W; ++x) {
+    if (x < W - 1) {
+      out.finish_all();
+    }
+    sender.on_edges(1, fill, on_wrap, on_drained);
+  }
+  CHECK(flipped);
+  CHECK(banks.front() == slots.begin(1));
+  CHECK(out.in_flight() == 2);
+  CHECK(out.reading(slots.begin(0), slots.end(0)));
+  CHECK(released == 0);
+
+  // One of them done, one still on the bus
+  out.finish(1);
+  sender.on_edges(1, fill, on_wrap, on_drained);
+  CHECK(released == 0);
+  CHECK(out.reading(slots.begin(0), slots.end(0)));
+
+  // The last column from the old slot done, though the new one's are not
+  out.finish(1);
+  sender.on_edges(1, fill, on_wrap, on_drained);
+  CHECK(released == 1);
+  CHECK(!out.reading(slots.begin(0), slots.end(0)));
+  CHECK(out.reading(slots.begin(1), slots.end(1)));
+
+  // Released once per revolution
+  for (int x = 2; x < 2 * W; ++x) {
+    out.finish_all();
+    sender.on_edges(1, fill, on_wrap, on_drained);
+  }
+  CHECK(released == 2);
+  CHECK(flipped);
+}
+
+TEST(column_banks_stage_keeps_front);
+TEST(column_banks_flip_at_revolution);
+TEST(column_banks_release_after_reaped);
+
+}  // namespace
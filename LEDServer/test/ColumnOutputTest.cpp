@@ -0,0 +1,173 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "FakeColumnOutput.h"
+#include "LEDClient/main/ColumnOutput.h"
+#include "Test.h"
+
+namespace {
+
+const int W = 8;
+
+// A sender of W one-byte columns, each sent as the column then a blank, as
+// APA102 slices are, recording the order of fills, wraps and drains as
+// "f<x>", "w" and "d"
+struct Sender {
+  explicit Sender(size_t depth)
+      : columns(W), blank(1), out(depth), sender(out) {}
+
+  void edges(uint32_t n) {
+    sender.on_edges(
+        n,
+        [this](int x, ColumnTransfers& t) {
+          events += "f" + std::to_string(x);
+          t.add(&columns[x], 1);
+          t.add(&blank[0], 1);
+        },
+        [this]() { events += "w"; },
+        [this]() { events += "d"; });
+  }
+
+  // The columns queued, in order, each checked to be followed by the blank
+  std::vector<int> sent() {
+    std::vector<int> xs;
+    auto& log = out.log();
+    CHECK(log.size() % 2 == 0);
+    for (size_t i = 0; i + 1 < log.size(); i += 2) {
+      xs.push_back(log[i] - columns.data());
+      CHECK(log[i + 1] == blank.data());
+    }
+    return xs;
+  }
+
+  std::vector<uint8_t> columns;
+  std::vector<uint8_t> blank;
+  FakeColumnOutput out;
+  ColumnSender<W> sender;
+  std::string events;
+};
+
+void column_sender_sends_in_order() {
+  Sender s(4);
+  for (int i = 0; i < 2 * W; ++i) {
+    s.out.finish_all();
+    s.edges(1);
+  }
+  CHECK(s.sender.sent() == 2 * W);
+  CHECK(s.sender.missed() == 0);
+  CHECK(s.sender.overruns() == 0);
+  CHECK(s.sender.x() == 0);
+  auto sent = s.sent();
+  if (CHECK(sent.size() == 2 * W)) {
+    for (int i = 0; i < 2 * W; ++i) {
+      CHECK(sent[i] == i % W);
+    }
+  }
+  CHECK(s.out.over_depth() == 0);
+  // No edges, nothing to do
+  s.edges(0);
+  CHECK(s.sender.sent() == 2 * W);
+  CHECK(s.sender.x() == 0);
+}
+
+// With the bus behind, a column that does not fit whole is dropped, and
+// the next one due goes out once there is room
+void column_sender_overruns() {
+  Sender s(4);
+  s.edges(1);
+  s.edges(1);
+  CHECK(s.sender.in_flight() == 4);
+  s.edges(1);
+  CHECK(s.sender.overruns() == 1);
+  CHECK(s.sender.in_flight() == 4);
+  // Room for one transfer is not room for a column
+  s.out.finish(1);
+  s.edges(1);
+  CHECK(s.sender.overruns() == 2);
+  CHECK(s.sender.in_flight() == 3);
+  s.out.finish(1);
+  s.edges(1);
+  CHECK(s.sender.overruns() == 2);
+  CHECK(s.sender.in_flight() == 4);
+  CHECK(s.sender.sent() == 3);
+  CHECK(s.sender.missed() == 0);
+  CHECK(s.sender.x() == 5);
+  CHECK(s.sent() == std::vector<int>({0, 1, 4}));
+  CHECK(s.out.over_depth() == 0);
+}
+
+// Edges that passed before a wakeup are skipped, wrapping if they cross
+// the end of the revolution, so the column sent is the one due now
+void column_sender_missed_edges() {
+  Sender s(4);
+  s.edges(3);
+  CHECK(s.sender.missed() == 2);
+  CHECK(s.sender.x() == 3);
+  s.out.finish_all();
+  s.edges(W);
+  CHECK(s.sender.missed() == 2 + W - 1);
+  CHECK(s.sender.x() == 3);
+  CHECK(s.sender.sent() == 2);
+  CHECK(s.sent() == std::vector<int>({2, 2}));
+  CHECK(s.events == "f2wdf2");
+}
+
+// on_wrap() comes after the last column of a revolution is queued, and
+// on_drained() once every transfer queued before it is reaped, before the
+// column of the edge that reaped them is filled
+void column_sender_drains_after_wrap() {
+  // Nothing in flight at the wrap, with a bus too shallow for any column:
+  // drained at once
+  Sender none(1);
+  for (int i = 0; i < W; ++i) {
+    none.edges(1);
+  }
+  CHECK(none.events == "f0f1f2f3f4f5f6f7wd");
+  CHECK(none.sender.overruns() == W);
+
+  // The last column's transfers are reaped at the next edge
+  Sender s(4);
+  for (int i = 0; i < W; ++i) {
+    s.out.finish_all();
+    s.edges(1);
+  }
+  s.out.finish_all();
+  s.edges(1);
+  CHECK(s.events == "f0f1f2f3f4f5f6f7wdf0");
+  s.events.clear();
+
+  // The last column's two transfers finishing an edge apart, drained once
+  // the second is reaped
+  for (int i = 1; i < W; ++i) {
+    s.out.finish_all();
+    s.edges(1);
+  }
+  CHECK(s.events == "f1f2f3f4f5f6f7w");
+  CHECK(s.sender.in_flight() == 2);
+  s.events.clear();
+  s.out.finish(1);
+  s.edges(1);
+  CHECK(s.events == "f0");
+  s.events.clear();
+  s.out.finish(1);
+  s.edges(1);
+  CHECK(s.events == "df1");
+  s.events.clear();
+
+  // Wraps closer together than the transfers before them take share one
+  // on_drained()
+  s.edges(2 * W - 2);
+  CHECK(s.events == "wf7w");
+  s.events.clear();
+  s.out.finish_all();
+  s.edges(1);
+  CHECK(s.events == "df0");
+}
+
+TEST(column_sender_sends_in_order);
+TEST(column_sender_overruns);
+TEST(column_sender_missed_edges);
+TEST(column_sender_drains_after_wrap);
+
+}  // namespace
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "LEDClient/main/ColumnOutput.h"
+
+// A bus whose transfers finish only when a test says so, recording the
+// data of each transfer queued
+class FakeColumnOutput : public ColumnOutput {
+ public:
+  explicit FakeColumnOutput(size_t depth)
+      : depth_(depth), finished_(0), over_depth_(0) {}
+
+  size_t depth() const override { return depth_; }
+
+  void queue(const uint8_t* data, [[maybe_unused]] size_t size) override {
+    if (in_flight_.size() == depth_) {
+      ++over_depth_;
+    }
+    in_flight_.push_back(data);
+    log_.push_back(data);
+  }
+
+  size_t reap() override {
+    auto n = finished_;
+    in_flight_.erase(in_flight_.begin(), in_flight_.begin() + n);
+    finished_ = 0;
+    return n;
+  }
+
+  // Finishes the n oldest transfers not finished yet, to be reaped next
+  void finish(size_t n) {
+    finished_ = std::min(finished_ + n, in_flight_.size());
+  }
+  void finish_all() { finished_ = in_flight_.size(); }
+
+  // Whether a transfer not reaped yet reads from [begin, end)
+  bool reading(const uint8_t* begin, const uint8_t* end) const {
+    return std::any_of(in_flight_.begin(), in_flight_.end(),
+                       [&](const uint8_t* d) { return d >= begin && d < end; });
+  }
+
+  size_t in_flight() const { return in_flight_.size(); }
+  // Transfers queued beyond depth(), which the driver would refuse
+  uint64_t over_depth() const { return over_depth_; }
+  std::vector<const uint8_t*>& log() { return log_; }
+
+ private:
+  size_t depth_;
+  size_t finished_;
+  uint64_t over_depth_;
+  std::deque<const uint8_t*> in_flight_;
+  std::vector<const uint8_t*> log_;
+};
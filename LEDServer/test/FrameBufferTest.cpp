@@ -0,0 +1,64 @@
+#include <cstdint>
+#include <memory>
+
+#include "FrameBuffer.h"
+#include "Test.h"
+
+namespace {
+
+typedef FrameBuffer<int, 4, 2> Buffer;
+
+struct Waiter : FrameWaiter {
+  Waiter() : ready(0) {}
+  void frame_ready() override { ++ready; }
+  int ready;
+};
+
+void framebuffer_notifies_waiters() {
+  auto frames = std::make_unique<Buffer>();
+  Waiter a, b;
+  frames->notify_when_ready(0, &a);
+  frames->notify_when_ready(1, &b);
+  CHECK(a.ready == 0 && b.ready == 0);
+  frames->push(0, std::make_shared<int>(0));
+  CHECK(a.ready == 1 && b.ready == 1);
+  // Already there, told at once
+  frames->notify_when_ready(0, &a);
+  CHECK(a.ready == 2);
+  uint64_t num;
+  CHECK(frames->try_pop(0, num) && num == 0);
+  frames->notify_when_ready(0, &a);
+  frames->cancel();
+  CHECK(a.ready == 3);
+  CHECK(b.ready == 1);
+}
+
+// Clients of one consumer replacing each other while no frame comes, as a
+// client reconnecting does while the producer is held up, each displace the
+// waiter before, which is told so it can let go. Only the last is told of
+// the frame.
+void framebuffer_replaces_waiters() {
+  auto frames = std::make_unique<Buffer>();
+  const int CLIENTS = 10;
+  Waiter clients[CLIENTS];
+  Waiter other;
+  frames->notify_when_ready(1, &other);
+  for (auto& c : clients) {
+    frames->notify_when_ready(0, &c);
+  }
+  for (int i = 0; i < CLIENTS - 1; ++i) {
+    CHECK(clients[i].ready == 1);
+  }
+  CHECK(clients[CLIENTS - 1].ready == 0);
+  CHECK(other.ready == 0);
+  frames->push(0, std::make_shared<int>(0));
+  for (auto& c : clients) {
+    CHECK(c.ready == 1);
+  }
+  CHECK(other.ready == 1);
+}
+
+TEST(framebuffer_notifies_waiters);
+TEST(framebuffer_replaces_waiters);
+
+}  // namespace
@@ -0,0 +1,174 @@
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "LEDCommon/Protocol.h"
+#include "Test.h"
+
+namespace {
+
+const size_t MAX_LENGTH = 1024;
+
+// A received header and payload, checked as the client checks them
+bool accepted(const FrameHeader& h, const uint8_t* payload) {
+  return check_header(h, WireFormat::APA102, MAX_LENGTH) &&
+         check_payload(h, payload);
+}
+
+void crc32_known_vectors() {
+  auto digits = reinterpret_cast<const uint8_t*>("123456789");
+  CHECK(crc32(digits, 9) == 0xcbf43926);
+  CHECK(crc32(digits, 0) == 0);
+  // Continuing a CRC is the same as taking it over both pieces at once
+  CHECK(crc32(digits + 4, 5, crc32(digits, 4)) == 0xcbf43926);
+}
+
+void frame_header_round_trip() {
+  std::mt19937 rng(1);
+  // Room for a corrupted length to read past the payload
+  std::vector<uint8_t> payload(MAX_LENGTH);
+  for (auto& b : payload) {
+    b = rng();
+  }
+  auto h = make_frame_header(0x123456789a, 0xfedcba98765, 3,
+                             WireFormat::APA102, payload.data(), 600);
+  CHECK(h.magic == FRAME_MAGIC);
+  CHECK(h.version == PROTOCOL_VERSION);
+  CHECK(h.format == WireFormat::APA102);
+  CHECK(h.slice == 3);
+  CHECK(h.frame_num == 0x123456789a);
+  CHECK(h.pts_ns == 0xfedcba98765);
+  CHECK(h.length == 600);
+  CHECK(accepted(h, payload.data()));
+
+  // Built from a payload CRC known beforehand, as for cached slices
+  auto known = make_frame_header(h.frame_num, h.pts_ns, h.slice, h.format,
+                                 h.length, crc32(payload.data(), h.length));
+  CHECK(!memcmp(&known, &h, sizeof(h)));
+
+  // Through the wire as bytes
+  uint8_t wire[sizeof(FrameHeader)];
+  memcpy(wire, &h, sizeof(h));
+  FrameHeader got;
+  memcpy(&got, wire, sizeof(got));
+  CHECK(accepted(got, payload.data()));
+
+  // An empty payload
+  auto empty = make_frame_header(1, 2, 0, WireFormat::APA102, nullptr, 0);
+  CHECK(accepted(empty, payload.data()));
+}
+
+void frame_header_rejects_bit_flips() {
+  std::mt19937 rng(2);
+  std::vector<uint8_t> payload(MAX_LENGTH);
+  for (auto& b : payload) {
+    b = rng();
+  }
+  const uint32_t length = 500;
+  auto h = make_frame_header(77, 123456789, 1, WireFormat::APA102,
+                             payload.data(), length);
+  for (size_t bit = 0; bit < sizeof(h) * 8; ++bit) {
+    auto bad = h;
+    reinterpret_cast<uint8_t*>(&bad)[bit / 8] ^= 1 << bit % 8;
+    CHECK(!accepted(bad, payload.data()));
+  }
+  for (size_t bit = 0; bit < length * 8; ++bit) {
+    payload[bit / 8] ^= 1 << bit % 8;
+    CHECK(!accepted(h, payload.data()));
+    payload[bit / 8] ^= 1 << bit % 8;
+  }
+  CHECK(accepted(h, payload.data()));
+}
+
+void frame_header_rejects_mismatches() {
+  std::vector<uint8_t> payload(MAX_LENGTH, 0x5a);
+  auto h = make_frame_header(5, 6, 0, WireFormat::APA102, payload.data(), 64);
+  CHECK(accepted(h, payload.data()));
+
+  auto bad = h;
+  bad.magic = TELEMETRY_MAGIC;
+  CHECK(!check_header(bad, WireFormat::APA102, MAX_LENGTH));
+  bad = h;
+  bad.version = PROTOCOL_VERSION + 1;
+  CHECK(!check_header(bad, WireFormat::APA102, MAX_LENGTH));
+  bad = h;
+  bad.version = PROTOCOL_VERSION - 1;
+  CHECK(!check_header(bad, WireFormat::APA102, MAX_LENGTH));
+  // Another format than the client asked for
+  CHECK(!check_header(h, WireFormat::RGB565, MAX_LENGTH));
+  // Longer than the client can hold
+  CHECK(!check_header(h, WireFormat::APA102, 63));
+
+  // A length cut short, or run long, no longer matches the CRC even with
+  // the header otherwise intact
+  bad = h;
+  bad.length = 63;
+  CHECK(check_header(bad, WireFormat::APA102, MAX_LENGTH));
+  CHECK(!check_payload(bad, payload.data()));
+  bad.length = 0;
+  CHECK(!check_payload(bad, payload.data()));
+  bad.length = 65;
+  CHECK(!check_payload(bad, payload.data()));
+}
+
+Telemetry sample_telemetry() {
+  Telemetry t = {};
+  t.buffer_level = 5;
+  t.buffer_depth = 6;
+  t.shown_frame = 0x1122334455;
+  t.rotation_us = 62500;
+  t.dropped_frames = 2;
+  t.underruns = 3;
+  t.skipped_frames = 4;
+  seal(t);
+  return t;
+}
+
+void telemetry_round_trip() {
+  auto t = sample_telemetry();
+  CHECK(t.magic == TELEMETRY_MAGIC);
+  CHECK(t.version == PROTOCOL_VERSION);
+  CHECK(check_telemetry(t));
+  uint8_t wire[sizeof(Telemetry)];
+  memcpy(wire, &t, sizeof(t));
+  Telemetry got;
+  memcpy(&got, wire, sizeof(got));
+  CHECK(check_telemetry(got));
+  CHECK(got.buffer_level == 5);
+  CHECK(got.buffer_depth == 6);
+  CHECK(got.shown_frame == 0x1122334455);
+  CHECK(got.rotation_us == 62500);
+  CHECK(got.dropped_frames == 2);
+  CHECK(got.underruns == 3);
+  CHECK(got.skipped_frames == 4);
+}
+
+void telemetry_rejects_corruption() {
+  auto t = sample_telemetry();
+  for (size_t bit = 0; bit < sizeof(t) * 8; ++bit) {
+    auto bad = t;
+    reinterpret_cast<uint8_t*>(&bad)[bit / 8] ^= 1 << bit % 8;
+    CHECK(!check_telemetry(bad));
+  }
+  // A frame header's magic, or another version, even with a matching CRC
+  auto bad = t;
+  bad.magic = FRAME_MAGIC;
+  bad.crc = crc32(reinterpret_cast<const uint8_t*>(&bad),
+                  offsetof(Telemetry, crc));
+  CHECK(!check_telemetry(bad));
+  bad = t;
+  bad.version = PROTOCOL_VERSION + 1;
+  bad.crc = crc32(reinterpret_cast<const uint8_t*>(&bad),
+                  offsetof(Telemetry, crc));
+  CHECK(!check_telemetry(bad));
+}
+
+TEST(crc32_known_vectors);
+TEST(frame_header_round_trip);
+TEST(frame_header_rejects_bit_flips);
+TEST(frame_header_rejects_mismatches);
+TEST(telemetry_round_trip);
+TEST(telemetry_rejects_corruption);
+
+}  // namespace
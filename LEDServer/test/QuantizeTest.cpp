@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "Quantize.h"
+#include "Test.h"
+
+namespace {
+
+const size_t GUARD = 16;
+const uint8_t GUARD_BYTE = 0xa5;
+
+std::vector<uint8_t> random_bgr(std::mt19937& rng, size_t n) {
+  std::vector<uint8_t> bgr(n * 3);
+  for (auto& b : bgr) {
+    b = rng();
+  }
+  return bgr;
+}
+
+// Each path packs exactly what the scalar one does, for lengths on either
+// side of the SSSE3 step (4) and the NEON one (8), from input sized exactly
+// so the tail reading past it shows up under a sanitizer, and writes
+// nothing past the output
+void pack_rgb565_matches_scalar() {
+  std::mt19937 rng(1);
+  for (size_t n : {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 11, 15, 16, 17, 31, 33, 47,
+                   48, 1001}) {
+    auto bgr = random_bgr(rng, n);
+    std::vector<uint8_t> want(n * 2);
+    pack_rgb565_scalar(bgr.data(), want.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+      auto v = to_rgb565(&bgr[i * 3]);
+      CHECK(want[i * 2] == (v & 0xff));
+      CHECK(want[i * 2 + 1] == v >> 8);
+    }
+
+    std::vector<uint8_t> out(n * 2 + GUARD, GUARD_BYTE);
+    auto check_out = [&]() {
+      CHECK(std::equal(want.begin(), want.end(), out.begin()));
+      for (size_t i = n * 2; i < out.size(); ++i) {
+        CHECK(out[i] == GUARD_BYTE);
+      }
+      std::fill(out.begin(), out.end(), GUARD_BYTE);
+    };
+    pack_rgb565(bgr.data(), out.data(), n);
+    check_out();
+#if !defined(__ARM_NEON) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("ssse3")) {
+      pack_rgb565_ssse3(bgr.data(), out.data(), n);
+      check_out();
+    }
+#endif
+  }
+}
+
+void pack_rgb565_extremes() {
+  const uint8_t white[] = {0xff, 0xff, 0xff};
+  const uint8_t black[] = {0, 0, 0};
+  // Blue, green and red alone, with the bits each drops set
+  const uint8_t b[] = {0xff, 0x03, 0x07};
+  const uint8_t g[] = {0x07, 0xff, 0x07};
+  const uint8_t r[] = {0x07, 0x03, 0xff};
+  CHECK(to_rgb565(white) == 0xffff);
+  CHECK(to_rgb565(black) == 0);
+  CHECK(to_rgb565(b) == 0x001f);
+  CHECK(to_rgb565(g) == 0x07e0);
+  CHECK(to_rgb565(r) == 0xf800);
+}
+
+size_t palette8_size(size_t n) { return 1 + PALETTE_SIZE * 3 + n; }
+
+// Encodes into a buffer of the given fill, so bytes left unwritten differ
+// between two encodings of the same pixels
+std::vector<uint8_t> palette8(const std::vector<uint8_t>& bgr, uint8_t fill) {
+  size_t n = bgr.size() / 3;
+  std::vector<uint8_t> out(palette8_size(n) + GUARD, fill);
+  encode_palette8(bgr.data(), n, out.data());
+  for (size_t i = palette8_size(n); i < out.size(); ++i) {
+    CHECK(out[i] == fill);
+  }
+  out.resize(palette8_size(n));
+  return out;
+}
+
+// colors distinct colors, each used by a run of pixels, in a shuffled order
+std::vector<uint8_t> palette_pixels(std::mt19937& rng, size_t colors,
+                                    size_t n) {
+  std::vector<uint32_t> pick(colors);
+  for (size_t i = 0; i < colors; ++i) {
+    // Spread over the cube, distinct by their low bits
+    pick[i] = (rng() & 0xffe000) | i;
+  }
+  std::vector<uint8_t> bgr;
+  for (size_t i = 0; bgr.size() < n * 3; ++i) {
+    // Every color at least once, then any
+    uint32_t c = i < colors ? pick[i] : pick[rng() % colors];
+    for (int k = 1 + rng() % 4; k && bgr.size() < n * 3; --k) {
+      bgr.push_back(c);
+      bgr.push_back(c >> 8);
+      bgr.push_back(c >> 16);
+    }
+  }
+  return bgr;
+}
+
+// Up to PALETTE_SIZE colors decode exactly, with the palette in order of
+// first use and unused entries zero
+void encode_palette8_exact() {
+  std::mt19937 rng(2);
+  for (size_t colors : {1, 2, 17, 255, 256}) {
+    auto bgr = palette_pixels(rng, colors, 2000);
+    size_t n = bgr.size() / 3;
+    auto out = palette8(bgr, 0);
+    CHECK(out[0] == colors - 1);
+    auto palette = &out[1];
+    auto indices = &out[1 + PALETTE_SIZE * 3];
+    size_t next = 0;
+    for (size_t i = 0; i < n; ++i) {
+      auto e = palette + indices[i] * 3;
+      CHECK(indices[i] < colors);
+      CHECK(std::equal(e, e + 3, &bgr[i * 3]));
+      // A new color takes the next entry
+      if (indices[i] == next) {
+        ++next;
+      } else {
+        CHECK(indices[i] < next);
+      }
+    }
+    CHECK(next == colors);
+    for (size_t i = colors * 3; i < PALETTE_SIZE * 3; ++i) {
+      CHECK(palette[i] == 0);
+    }
+    // The same pixels give the same bytes
+    CHECK(palette8(bgr, 0xff) == out);
+  }
+}
+
+// One color more than the palette holds falls back to the 6x7x6 cube, each
+// pixel rounded to the nearest level of each channel
+void encode_palette8_cube() {
+  std::mt19937 rng(3);
+  const int levels[] = {6, 7, 6};
+  for (size_t colors : {257, 300, 5000}) {
+    auto bgr = palette_pixels(rng, colors, 6000);
+    size_t n = bgr.size() / 3;
+    auto out = palette8(bgr, 0);
+    CHECK(out[0] == 6 * 7 * 6 - 1);
+    auto palette = &out[1];
+    auto indices = &out[1 + PALETTE_SIZE * 3];
+    for (size_t i = 0; i < n; ++i) {
+      CHECK(indices[i] < 6 * 7 * 6);
+      for (int c = 0; c < 3; ++c) {
+        int step = 255 / (levels[c] - 1);
+        int error = palette[indices[i] * 3 + c] - bgr[i * 3 + c];
+        CHECK(abs(error) <= step / 2 + 1);
+      }
+    }
+    for (size_t i = 6 * 7 * 6 * 3; i < PALETTE_SIZE * 3; ++i) {
+      CHECK(palette[i] == 0);
+    }
+    CHECK(palette8(bgr, 0xff) == out);
+  }
+}
+
+void encode_palette8_empty() {
+  std::vector<uint8_t> none;
+  auto out = palette8(none, 0xff);
+  CHECK(out[0] == 0);
+  for (size_t i = 1; i < out.size(); ++i) {
+    CHECK(out[i] == 0);
+  }
+}
+
+TEST(pack_rgb565_matches_scalar);
+TEST(pack_rgb565_extremes);
+TEST(encode_palette8_exact);
+TEST(encode_palette8_cube);
+TEST(encode_palette8_empty);
+
+}  // namespace
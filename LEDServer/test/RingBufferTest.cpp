@@ -0,0 +1,152 @@
+#include <cstdint>
+#include <stdexcept>
+
+#include "LEDClient/main/RingBuffer.h"
+#include "Test.h"
+
+namespace {
+
+const int D = 4;
+typedef RingBuffer<uint32_t, D> Ring;
+
+void push(Ring& ring, uint32_t v) {
+  auto slot = ring.reserve();
+  if (CHECK(slot)) {
+    *slot = v;
+    ring.push();
+  }
+}
+
+bool pop_throws(Ring& ring) {
+  try {
+    ring.pop();
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+void ring_buffer_empty() {
+  Ring ring;
+  CHECK(ring.depth() == D);
+  CHECK(ring.level() == 0);
+  CHECK(ring.reserve());
+  size_t count = 0;
+  CHECK(ring.reserve(count) == ring.reserve());
+  CHECK(count == D);
+  CHECK(ring.skip(3) == 0);
+  CHECK(pop_throws(ring));
+  CHECK(ring.level() == 0);
+}
+
+void ring_buffer_full() {
+  Ring ring;
+  for (uint32_t i = 0; i < D; ++i) {
+    push(ring, i);
+  }
+  CHECK(ring.level() == D);
+  CHECK(!ring.reserve());
+  size_t count = 1;
+  CHECK(!ring.reserve(count));
+  CHECK(count == 0);
+  for (uint32_t i = 0; i < D; ++i) {
+    CHECK(ring.at(i) == i);
+  }
+  // One slot freed is one slot to fill, the one just released
+  ring.pop();
+  CHECK(ring.level() == D - 1);
+  CHECK(ring.reserve() == &ring.front() - 1);
+  CHECK(ring.reserve(count));
+  CHECK(count == 1);
+  push(ring, D);
+  CHECK(!ring.reserve());
+}
+
+// Slots pushed come out in order lap after lap, whatever the level when
+// the ring wraps
+void ring_buffer_wraps() {
+  Ring ring;
+  uint32_t pushed = 0;
+  uint32_t popped = 0;
+  for (int lap = 0; lap < 10 * D; ++lap) {
+    for (int i = 0; i < 1 + lap % D; ++i) {
+      push(ring, pushed++);
+    }
+    CHECK(ring.level() == pushed - popped);
+    for (size_t i = 0; i < ring.level(); ++i) {
+      CHECK(ring.at(i) == popped + i);
+    }
+    while (ring.level()) {
+      CHECK(ring.front() == popped++);
+      ring.pop();
+    }
+  }
+  CHECK(pushed == popped);
+  CHECK(pop_throws(ring));
+}
+
+// The slots free from the one reserved to the end of the storage, so a
+// producer filling several at once stops where the ring wraps
+void ring_buffer_reserve_count() {
+  Ring ring;
+  size_t count;
+  push(ring, 0);
+  push(ring, 1);
+  push(ring, 2);
+  ring.pop();
+  ring.pop();
+  // Written up to the last slot, with two free before it
+  auto slot = ring.reserve(count);
+  CHECK(count == 1);
+  CHECK(slot == ring.reserve());
+  *slot = 3;
+  ring.push();
+  // Wrapped to the first slot, free up to the one still held
+  slot = ring.reserve(count);
+  CHECK(count == 2);
+  CHECK(slot == &ring.front() - 2);
+  slot[0] = 4;
+  ring.push();
+  slot[1] = 5;
+  ring.push();
+  CHECK(!ring.reserve(count));
+  CHECK(count == 0);
+  for (uint32_t i = 0; i < D; ++i) {
+    CHECK(ring.at(i) == 2 + i);
+  }
+}
+
+// Skipping releases the oldest slots in one step, but never the newest
+void ring_buffer_skip() {
+  Ring ring;
+  for (uint32_t i = 0; i < 3; ++i) {
+    push(ring, i);
+  }
+  CHECK(ring.skip(1) == 1);
+  CHECK(ring.front() == 1);
+  CHECK(ring.skip(10) == 1);
+  CHECK(ring.level() == 1);
+  CHECK(ring.front() == 2);
+  CHECK(ring.skip(1) == 0);
+  CHECK(ring.front() == 2);
+  CHECK(ring.skip(0) == 0);
+  // Across the wrap, from a full ring
+  push(ring, 3);
+  push(ring, 4);
+  push(ring, 5);
+  CHECK(ring.level() == D);
+  CHECK(ring.skip(D) == D - 1);
+  CHECK(ring.front() == 5);
+  CHECK(ring.reserve());
+  ring.pop();
+  CHECK(ring.skip(1) == 0);
+  CHECK(ring.level() == 0);
+}
+
+TEST(ring_buffer_empty);
+TEST(ring_buffer_full);
+TEST(ring_buffer_wraps);
+TEST(ring_buffer_reserve_count);
+TEST(ring_buffer_skip);
+
+}  // namespace
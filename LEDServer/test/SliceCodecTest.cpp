@@ -0,0 +1,215 @@
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "LEDCommon/SliceCodec.h"
+#include "Test.h"
+
+namespace {
+
+// Bytes after the output that the decoder must never touch
+const size_t GUARD = 64;
+const uint8_t GUARD_BYTE = 0xa5;
+
+// A payload like the one before it but for changed bytes, one in
+// changes_in, some in runs, as effects change a frame's pixels
+std::vector<uint8_t> next_payload(std::mt19937& rng,
+                                  const std::vector<uint8_t>& prev,
+                                  int changes_in) {
+  auto cur = prev;
+  for (size_t i = 0; i < cur.size(); ++i) {
+    if (rng() % changes_in == 0) {
+      auto run = std::min<size_t>(1 + rng() % 8, cur.size() - i);
+      for (size_t k = 0; k < run; ++k) {
+        cur[i + k] = rng();
+      }
+      i += run;
+    }
+  }
+  return cur;
+}
+
+std::vector<uint8_t> encode(const std::vector<uint8_t>& cur,
+                            const std::vector<uint8_t>* ref) {
+  std::vector<uint8_t> coded(max_coded_size(cur.size()) + GUARD, GUARD_BYTE);
+  auto size = slice_encode(cur.data(), ref ? ref->data() : nullptr,
+                           cur.size(), coded.data());
+  CHECK(size <= max_coded_size(cur.size()));
+  for (size_t i = max_coded_size(cur.size()); i < coded.size(); ++i) {
+    CHECK(coded[i] == GUARD_BYTE);
+  }
+  coded.resize(size);
+  return coded;
+}
+
+// Decodes into a fresh buffer of n bytes followed by a guard, checking the
+// guard, and returns whether the decoder accepted the input
+bool decode(const std::vector<uint8_t>& coded, size_t len,
+            const std::vector<uint8_t>* ref, size_t n,
+            std::vector<uint8_t>* out = nullptr) {
+  std::vector<uint8_t> buf(n + GUARD, GUARD_BYTE);
+  // Exactly len bytes, so reading past them is reading past the input
+  std::vector<uint8_t> in(coded.begin(), coded.begin() + len);
+  bool ok = slice_decode(in.data(), in.size(), ref ? ref->data() : nullptr,
+                         buf.data(), n);
+  for (size_t i = n; i < buf.size(); ++i) {
+    if (!CHECK(buf[i] == GUARD_BYTE)) {
+      break;
+    }
+  }
+  if (out) {
+    out->assign(buf.begin(), buf.begin() + n);
+  }
+  return ok;
+}
+
+void slice_codec_round_trip() {
+  std::mt19937 rng(1);
+  for (size_t n : {0, 1, 2, 3, 127, 128, 129, 1000, 14400, 70000, 200000}) {
+    for (int changes_in : {1, 2, 20, 500, 1 << 30}) {
+      std::vector<uint8_t> prev(n);
+      for (auto& b : prev) {
+        b = rng() % 4 ? rng() : 0;
+      }
+      auto cur = next_payload(rng, prev, changes_in);
+      std::vector<uint8_t> got;
+
+      auto key = encode(cur, nullptr);
+      CHECK(key[0] == SLICE_KEY);
+      CHECK(decode(key, key.size(), nullptr, n, &got));
+      CHECK(got == cur);
+      // A key frame ignores any reference it is given
+      CHECK(decode(key, key.size(), &prev, n, &got));
+      CHECK(got == cur);
+      // An empty payload has no reference to code a delta against
+      if (!n) {
+        continue;
+      }
+
+      auto delta = encode(cur, &prev);
+      CHECK(delta[0] == SLICE_DELTA);
+      CHECK(decode(delta, delta.size(), &prev, n, &got));
+      CHECK(got == cur);
+      // Nothing changed codes to runs alone
+      if (changes_in == 1 << 30) {
+        CHECK(delta.size() <= 1 + 3 * (n / 65535 + 1));
+      }
+
+      // Decoded to any other size is rejected
+      CHECK(!decode(delta, delta.size(), &prev, n + 1));
+      CHECK(!decode(delta, delta.size(), &prev, n - 1));
+      // A delta needs its reference
+      CHECK(!decode(delta, delta.size(), nullptr, n));
+    }
+  }
+}
+
+void slice_codec_all_zero_and_long_runs() {
+  // Runs longer than a long run token holds, against zeros and a reference
+  std::vector<uint8_t> zeros(3 * 65535 + 10);
+  auto key = encode(zeros, nullptr);
+  std::vector<uint8_t> got;
+  CHECK(decode(key, key.size(), nullptr, zeros.size(), &got));
+  CHECK(got == zeros);
+  auto cur = zeros;
+  cur[65535] = 1;
+  cur.back() = 2;
+  auto delta = encode(cur, &zeros);
+  CHECK(decode(delta, delta.size(), &zeros, cur.size(), &got));
+  CHECK(got == cur);
+}
+
+void slice_codec_rejects_truncation() {
+  std::mt19937 rng(2);
+  const size_t n = 2000;
+  std::vector<uint8_t> prev(n);
+  for (auto& b : prev) {
+    b = rng();
+  }
+  for (int changes_in : {1, 5, 50}) {
+    auto cur = next_payload(rng, prev, changes_in);
+    for (auto ref : {static_cast<std::vector<uint8_t>*>(nullptr), &prev}) {
+      auto coded = encode(cur, ref);
+      for (size_t len = 0; len < coded.size(); ++len) {
+        CHECK(!decode(coded, len, ref, n));
+      }
+      CHECK(decode(coded, coded.size(), ref, n));
+    }
+  }
+}
+
+void slice_codec_survives_corruption() {
+  std::mt19937 rng(3);
+  const size_t n = 1500;
+  std::vector<uint8_t> prev(n);
+  for (auto& b : prev) {
+    b = rng();
+  }
+  for (int trial = 0; trial < 20000; ++trial) {
+    auto cur = next_payload(rng, prev, 1 + rng() % 100);
+    auto ref = rng() % 2 ? &prev : nullptr;
+    auto coded = encode(cur, ref);
+    // Flipped bits, replaced bytes, or a random stream altogether. Whether
+    // the result is accepted or not, nothing past the output is written.
+    switch (rng() % 3) {
+      case 0:
+        for (int k = 1 + rng() % 4; k; --k) {
+          coded[rng() % coded.size()] ^= 1 << rng() % 8;
+        }
+        break;
+      case 1:
+        for (int k = 1 + rng() % 4; k; --k) {
+          coded[rng() % coded.size()] = rng();
+        }
+        break;
+      case 2:
+        coded.resize(1 + rng() % 64);
+        for (auto& b : coded) {
+          b = rng();
+        }
+        coded[0] = rng() % 2;
+        break;
+    }
+    decode(coded, coded.size(), ref, n);
+    decode(coded, coded.size(), &prev, n);
+  }
+  // The first byte must name a known coding
+  std::vector<uint8_t> bad = {2, 0x80};
+  CHECK(!decode(bad, bad.size(), &prev, 1));
+  bad = {};
+  CHECK(!decode(bad, 0, &prev, 0));
+}
+
+// The client decodes each delta into the slot holding the payload before
+void slice_codec_decodes_in_place() {
+  std::mt19937 rng(4);
+  for (size_t n : {1, 100, 14400}) {
+    std::vector<uint8_t> slot(n);
+    for (auto& b : slot) {
+      b = rng();
+    }
+    auto first = slot;
+    auto key = encode(first, nullptr);
+    auto prev = first;
+    for (int frame = 0; frame < 50; ++frame) {
+      auto cur = next_payload(rng, prev, 1 + frame % 30);
+      auto delta = encode(cur, &prev);
+      CHECK(slice_decode(delta.data(), delta.size(), slot.data(), slot.data(),
+                         n));
+      CHECK(slot == cur);
+      prev = cur;
+    }
+    // A key frame in place overwrites the reference with no regard for it
+    CHECK(slice_decode(key.data(), key.size(), slot.data(), slot.data(), n));
+    CHECK(slot == first);
+  }
+}
+
+TEST(slice_codec_round_trip);
+TEST(slice_codec_all_zero_and_long_runs);
+TEST(slice_codec_rejects_truncation);
+TEST(slice_codec_survives_corruption);
+TEST(slice_codec_decodes_in_place);
+
+}  // namespace
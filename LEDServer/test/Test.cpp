@@ -0,0 +1,45 @@
+#include "Test.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Usage: ledserve_test [FILTER]
+//
+// Runs every test whose name contains FILTER (all by default), printing a
+// line for each failed check and one per test, and exits 1 if any failed.
+
+std::vector<Test>& tests() {
+  static std::vector<Test> all;
+  return all;
+}
+
+namespace {
+int failures = 0;
+}  // namespace
+
+bool check(bool ok, const char* what, const char* file, int line) {
+  if (!ok) {
+    ++failures;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  const char* filter = argc > 1 ? argv[1] : "";
+  int failed_tests = 0;
+  int run = 0;
+  for (auto& t : tests()) {
+    if (!strstr(t.name.c_str(), filter)) {
+      continue;
+    }
+    int before = failures;
+    t.run();
+    ++run;
+    bool ok = failures == before;
+    failed_tests += !ok;
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", t.name.c_str());
+  }
+  printf("%d of %d tests passed\n", run - failed_tests, run);
+  return failed_tests ? 1 : 0;
+}
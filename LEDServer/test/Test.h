@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal test harness. A test is a function registered with TEST() that
+// checks what it computes with CHECK(), which reports each failure with its
+// location and lets the test carry on. ledserve_test runs them all and exits
+// non-zero if any check failed.
+
+struct Test {
+  std::string name;
+  std::function<void()> run;
+};
+
+std::vector<Test>& tests();
+
+// Records a failed check, returning ok so callers can stop early on it
+bool check(bool ok, const char* what, const char* file, int line);
+
+struct TestRegistrar {
+  TestRegistrar(const char* name, std::function<void()> run) {
+    tests().push_back(Test{name, std::move(run)});
+  }
+};
+
+#define TEST(fn) static TestRegistrar fn##_registrar(#fn, fn)
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
@@ -0,0 +1,273 @@
+#include <getopt.h>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Replay.h"
+#include "SimClient.h"
+
+// Runs many simulated LEDClients against a server and reports what they
+// received and showed. Only clients whose MAC addresses are configured as
+// slices on the server are streamed to.
+
+namespace {
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n, --clients N        simulated clients (1)\n"
+          "  -j, --threads N        IO threads (1)\n"
+          "  -H, --host ADDR        server address (127.0.0.1)\n"
+          "  -p, --port PORT        server port (5050)\n"
+          "  -t, --time SECS        run time (10)\n"
+          "  -m, --mac MAC          first client MAC (24-0a-c4-c0-6b-f0)\n"
+          "  -c, --column-hz HZ     column clock (W * 16)\n"
+          "  -l, --latency MS       delay before frames reach the buffer (0)\n"
+          "  -J, --jitter MS        random extra delay, up to MS (0)\n"
+          "  -L, --loss FRACTION    frames discarded on arrival (0)\n"
+          "  -s, --stall-every SECS stop reading periodically (off)\n"
+          "  -S, --stall-for MS     length of each stall (0)\n"
+          "  -z, --codec none|delta payload compression (delta)\n"
+          "  -w, --start-level N    frames buffered before playback (%d)\n"
+          "  -R, --record FILE      write each frame's arrival to FILE\n"
+          "  -P, --replay FILE      play back a recording offline\n"
+          "  -v, --verbose          log connection events\n",
+          prog, JITTER_START_LEVEL);
+  exit(1);
+}
+
+bool parse_mac(const char* s, uint8_t* mac) {
+  unsigned b[6];
+  if (sscanf(s, "%x-%x-%x-%x-%x-%x", &b[0], &b[1], &b[2], &b[3], &b[4],
+             &b[5]) != 6) {
+    return false;
+  }
+  std::copy(b, b + 6, mac);
+  return true;
+}
+
+SimOptions parse_options(int argc, char* argv[], const char*& replay_path) {
+  static const option long_opts[] = {
+      {"clients", required_argument, nullptr, 'n'},
+      {"threads", required_argument, nullptr, 'j'},
+      {"host", required_argument, nullptr, 'H'},
+      {"port", required_argument, nullptr, 'p'},
+      {"time", required_argument, nullptr, 't'},
+      {"mac", required_argument, nullptr, 'm'},
+      {"column-hz", required_argument, nullptr, 'c'},
+      {"latency", required_argument, nullptr, 'l'},
+      {"jitter", required_argument, nullptr, 'J'},
+      {"loss", required_argument, nullptr, 'L'},
+      {"stall-every", required_argument, nullptr, 's'},
+      {"stall-for", required_argument, nullptr, 'S'},
+      {"codec", required_argument, nullptr, 'z'},
+      {"start-level", required_argument, nullptr, 'w'},
+      {"record", required_argument, nullptr, 'R'},
+      {"replay", required_argument, nullptr, 'P'},
+      {"verbose", no_argument, nullptr, 'v'},
+      {nullptr, 0, nullptr, 0}};
+  SimOptions opts;
+  bool verbose = false;
+  int c;
+  while ((c = getopt_long(argc, argv, "n:j:H:p:t:m:c:l:J:L:s:S:z:w:R:P:v", long_opts,
+                          nullptr)) != -1) {
+    switch (c) {
+      case 'n':
+        opts.clients = atoi(optarg);
+        break;
+      case 'j':
+        opts.threads = atoi(optarg);
+        break;
+      case 'H':
+        opts.host = optarg;
+        break;
+      case 'p':
+        opts.port = atoi(optarg);
+        break;
+      case 't':
+        opts.duration = std::chrono::seconds(atoi(optarg));
+        break;
+      case 'm':
+        if (!parse_mac(optarg, opts.mac)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'c':
+        opts.column_hz = atof(optarg);
+        break;
+      case 'l':
+        opts.latency = std::chrono::milliseconds(atoi(optarg));
+        break;
+      case 'J':
+        opts.jitter = std::chrono::milliseconds(atoi(optarg));
+        break;
+      case 'L':
+        opts.loss = atof(optarg);
+        break;
+      case 's':
+        opts.stall_every = std::chrono::seconds(atoi(optarg));
+        break;
+      case 'S':
+        opts.stall_for = std::chrono::milliseconds(atoi(optarg));
+        break;
+      case 'z':
+        if (!strcmp(optarg, "none")) {
+          opts.codec = WireCodec::NONE;
+        } else if (!strcmp(optarg, "delta")) {
+          opts.codec = WireCodec::DELTA_RLE;
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      case 'w':
+        opts.start_level = atoi(optarg);
+        break;
+      case 'R':
+        opts.record = fopen(optarg, "w");
+        if (!opts.record) {
+          perror(optarg);
+          exit(1);
+        }
+        break;
+      case 'P':
+        replay_path = optarg;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (opts.clients < 1 || opts.threads < 1 || opts.column_hz <= 0 ||
+      opts.start_level < 1 || opts.start_level > JITTER_MAX_DEPTH) {
+    usage(argv[0]);
+  }
+  boost::log::core::get()->set_filter(
+      boost::log::trivial::severity >=
+      (verbose ? boost::log::trivial::info : boost::log::trivial::warning));
+  return opts;
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1,
+                         static_cast<size_t>(p * sorted.size()))];
+}
+
+void print_latency(const char* name, std::vector<uint32_t>& us) {
+  std::sort(us.begin(), us.end());
+  printf("%-8s p50 %7.2f  p90 %7.2f  p99 %7.2f  p99.9 %7.2f  max %7.2f ms\n",
+         name, percentile(us, 0.5) / 1000.0, percentile(us, 0.9) / 1000.0,
+         percentile(us, 0.99) / 1000.0, percentile(us, 0.999) / 1000.0,
+         (us.empty() ? 0 : us.back()) / 1000.0);
+}
+
+void report(const SimOptions& opts,
+            const std::vector<std::shared_ptr<SimClient>>& clients,
+            double secs) {
+  printf("%-17s %8s %8s %9s %8s %6s %6s %6s %6s\n", "client", "received",
+         "shown", "underruns", "skipped", "lost", "gaps", "resets", "errors");
+  SimStats total;
+  for (auto& c : clients) {
+    auto& s = c->stats();
+    printf("%-17s %8lu %8lu %9lu %8lu %6lu %6lu %6lu %6lu\n",
+           c->id_str().c_str(), s.received, s.shown, s.underruns, s.skipped,
+           s.lost, s.gaps, s.resets, s.errors);
+    total.received += s.received;
+    total.bytes += s.bytes;
+    total.reads += s.reads;
+    total.shown += s.shown;
+    total.underruns += s.underruns;
+    total.skipped += s.skipped;
+    total.lost += s.lost;
+    total.gaps += s.gaps;
+    total.stalls += s.stalls;
+    total.resets += s.resets;
+    total.errors += s.errors;
+    total.transit_us.insert(total.transit_us.end(), s.transit_us.begin(),
+                            s.transit_us.end());
+    total.show_us.insert(total.show_us.end(), s.show_us.begin(),
+                         s.show_us.end());
+  }
+  printf("\n%d clients, %.1f s: received %.1f frames/s (%.2f MB/s, "
+         "%.2f frames per read), shown %.1f frames/s\n",
+         opts.clients, secs, total.received / secs,
+         total.bytes / secs / (1 << 20),
+         total.reads ? static_cast<double>(total.received) / total.reads : 0,
+         total.shown / secs);
+  printf("drops: %lu underruns, %lu skipped, %lu lost, %lu gaps, %lu stalls, "
+         "%lu resets, %lu errors\n",
+         total.underruns, total.skipped, total.lost, total.gaps, total.stalls,
+         total.resets, total.errors);
+  // From the frame's presentation time on the server
+  print_latency("arrival", total.transit_us);
+  print_latency("shown", total.show_us);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* replay_path = nullptr;
+  auto opts = parse_options(argc, argv, replay_path);
+  if (replay_path) {
+    return replay(opts, replay_path) ? 0 : 1;
+  }
+
+  std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+  for (int i = 0; i < opts.threads; ++i) {
+    contexts.emplace_back(new boost::asio::io_context());
+  }
+  std::vector<std::shared_ptr<SimClient>> clients;
+  for (int i = 0; i < opts.clients; ++i) {
+    clients.push_back(std::make_shared<SimClient>(
+        *contexts[i % opts.threads], opts, i));
+    clients.back()->start();
+  }
+  std::vector<std::thread> threads;
+  for (auto& ctx : contexts) {
+    threads.emplace_back([&ctx]() { ctx->run(); });
+  }
+
+  boost::asio::io_context main_io;
+  boost::asio::signal_set signals(main_io, SIGINT, SIGTERM);
+  boost::asio::steady_timer end(main_io, opts.duration);
+  auto stop = [&]() {
+    signals.cancel();
+    end.cancel();
+    for (auto& c : clients) {
+      c->post_stop();
+    }
+  };
+  signals.async_wait([&](const boost::system::error_code& ec, int) {
+    if (!ec) {
+      stop();
+    }
+  });
+  end.async_wait([&](const boost::system::error_code& ec) {
+    if (!ec) {
+      stop();
+    }
+  });
+  auto start = std::chrono::steady_clock::now();
+  main_io.run();
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+  for (auto& t : threads) {
+    t.join();
+  }
+  report(opts, clients, secs.count());
+  if (opts.record) {
+    fclose(opts.record);
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "Replay.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Arrival {
+  uint64_t frame_num;
+  int64_t pts_us;
+  int64_t arrival_us;
+};
+
+struct ReplayStats {
+  uint64_t shown = 0;
+  uint64_t underruns = 0;
+  uint64_t skipped = 0;
+  uint64_t target_sum = 0;
+  size_t max_target = 0;
+  // From presentation time to being shown
+  std::vector<int64_t> show_us;
+};
+
+// The frame on display holds a slot, as on the firmware
+const size_t CAPACITY = JITTER_BUFFER_DEPTH - 1;
+
+ReplayStats run(const SimOptions& opts, const std::vector<Arrival>& arrivals) {
+  ReplayStats stats;
+  Playout playout(opts.start_level, JITTER_MIN_DEPTH, JITTER_MAX_DEPTH);
+  std::deque<Arrival> bufs;
+  auto period_us = static_cast<int64_t>(W / opts.column_hz * 1e6);
+  size_t next = 0;
+  // Reads stop while the buffer is full, so a frame held up by that is taken
+  // at the tick that made room for it, the one before now
+  auto receive = [&](int64_t now) {
+    while (next < arrivals.size() && bufs.size() < CAPACITY &&
+           arrivals[next].arrival_us <= now) {
+      auto a = arrivals[next++];
+      a.arrival_us = std::max(a.arrival_us, now - period_us);
+      playout.on_arrival(a.frame_num, a.pts_us, a.arrival_us);
+      bufs.push_back(a);
+    }
+  };
+  // Prefetch
+  int64_t now = 0;
+  while (next < arrivals.size() && !playout.can_start(bufs.size())) {
+    now = arrivals[next].arrival_us;
+    receive(now);
+  }
+  uint64_t shown_frame = 0;
+  uint64_t dropped = 0;
+  bool synced = false;
+  while (next < arrivals.size() || !bufs.empty()) {
+    receive(now);
+    if (bufs.empty()) {
+      ++dropped;
+      ++stats.underruns;
+      playout.on_underrun();
+    } else {
+      uint64_t due = shown_frame + 1 + dropped;
+      size_t skip = 0;
+      if (synced) {
+        skip = playout.skip_count(bufs.size(), shown_frame, due,
+                                  [&](size_t i) { return bufs[i].frame_num; });
+      }
+      bufs.erase(bufs.begin(), bufs.begin() + skip);
+      stats.skipped += skip;
+      shown_frame = bufs.front().frame_num;
+      stats.show_us.push_back(now - bufs.front().pts_us);
+      bufs.pop_front();
+      dropped = 0;
+      synced = true;
+      ++stats.shown;
+    }
+    stats.target_sum += playout.target();
+    stats.max_target = std::max(stats.max_target, playout.target());
+    now += period_us;
+  }
+  return stats;
+}
+
+}  // namespace
+
+bool replay(const SimOptions& opts, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  std::map<std::string, std::vector<Arrival>> clients;
+  char id[32];
+  unsigned long long num, pts;
+  long long arrival;
+  while (fscanf(f, "%31s %llu %llu %lld", id, &num, &pts, &arrival) == 4) {
+    clients[id].push_back(Arrival{num, static_cast<int64_t>(pts), arrival});
+  }
+  fclose(f);
+  printf("%-17s %8s %9s %8s %11s %10s %10s\n", "client", "shown",
+         "underruns", "skipped", "target avg", "target max", "shown p50");
+  for (auto& c : clients) {
+    auto s = run(opts, c.second);
+    std::sort(s.show_us.begin(), s.show_us.end());
+    auto ticks = s.shown + s.underruns;
+    printf("%-17s %8lu %9lu %8lu %11.2f %10zu %8.2fms\n", c.first.c_str(),
+           s.shown, s.underruns, s.skipped,
+           ticks ? static_cast<double>(s.target_sum) / ticks : 0.0,
+           s.max_target,
+           s.show_us.empty() ? 0.0 : s.show_us[s.show_us.size() / 2] / 1e3);
+  }
+  return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "SimClient.h"
+
+// Plays back arrivals recorded with --record through the playout logic
+// alone, with no server or sockets, showing a frame every W column ticks as
+// ledsim does. Prints what each recorded client would have shown. Returns
+// false if the recording can't be read.
+bool replay(const SimOptions& opts, const char* path);
@@ -0,0 +1,343 @@
+#include "SimClient.h"
+
+#include <boost/log/trivial.hpp>
+#include <cstdio>
+
+#define LOG(X) BOOST_LOG_TRIVIAL(X)
+
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+namespace {
+const auto TELEMETRY_PERIOD = std::chrono::milliseconds(250);
+const auto RECONNECT_DELAY = std::chrono::seconds(1);
+
+uint32_t to_us(SimClient::Clock::duration d) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  return us < 0 ? 0 : static_cast<uint32_t>(us);
+}
+
+// Time since the server's steady clock epoch, which is ours on one host
+SimClient::Clock::duration since_pts(SimClient::Clock::time_point t,
+                                     uint64_t pts_ns) {
+  return t.time_since_epoch() - std::chrono::nanoseconds(pts_ns);
+}
+}  // namespace
+
+SimClient::SimClient(io_context& ctx, const SimOptions& opts, int index)
+    : ctx_(ctx),
+      opts_(opts),
+      sock_(ctx),
+      tick_timer_(ctx),
+      telemetry_timer_(ctx),
+      stall_timer_(ctx),
+      reconnect_timer_(ctx),
+      rng_(index),
+      state_(STOPPED),
+      playout_(opts.start_level, JITTER_MIN_DEPTH, JITTER_MAX_DEPTH),
+      reader_(sock_, *this, WIRE_FORMAT, opts.codec),
+      period_(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(W / opts.column_hz))),
+      writing_(false),
+      stalled_(false),
+      showing_(false),
+      dropped_frames_(0),
+      shown_frame_(0),
+      synced_(false),
+      last_received_(0),
+      received_any_(false),
+      underruns_(0),
+      skipped_frames_(0) {
+  std::copy(opts.mac, opts.mac + sizeof(hello_.id), hello_.id);
+  hello_.id[5] += index & 0xff;
+  hello_.id[4] += index >> 8;
+  hello_.version = PROTOCOL_VERSION;
+  hello_.format = WIRE_FORMAT;
+  hello_.codec = opts.codec;
+}
+
+std::string SimClient::id_str() const {
+  char s[18];
+  snprintf(s, sizeof(s), "%02x-%02x-%02x-%02x-%02x-%02x", hello_.id[0],
+           hello_.id[1], hello_.id[2], hello_.id[3], hello_.id[4],
+           hello_.id[5]);
+  return s;
+}
+
+void SimClient::start() {
+  post(ctx_, [self = shared_from_this()]() {
+    self->connect();
+    self->schedule_stall();
+  });
+}
+
+void SimClient::post_stop() {
+  post(ctx_, [self = shared_from_this()]() { self->stop(); });
+}
+
+void SimClient::stop() {
+  state_ = STOPPED;
+  reader_.stop();
+  boost::system::error_code ec;
+  sock_.close(ec);
+  tick_timer_.cancel();
+  telemetry_timer_.cancel();
+  stall_timer_.cancel();
+  reconnect_timer_.cancel();
+}
+
+void SimClient::connect() {
+  state_ = READY;
+  bufs_.reset(new JitterBuffer());
+  playout_.reset();
+  arrivals_.clear();
+  writing_ = false;
+  showing_ = false;
+  dropped_frames_ = 0;
+  synced_ = false;
+  received_any_ = false;
+  underruns_ = 0;
+  skipped_frames_ = 0;
+  tcp::endpoint ep(make_address(opts_.host), opts_.port);
+  sock_.async_connect(ep, [this, self = shared_from_this()](
+                              const boost::system::error_code& ec) {
+    if (state_ == STOPPED || ec == error::operation_aborted) {
+      return;
+    }
+    if (ec) {
+      LOG(error) << id_str() << ": connect error: " << ec.message();
+      on_conn_err(false);
+      return;
+    }
+    sock_.set_option(tcp::no_delay(true));
+    async_write(sock_, buffer(&hello_, sizeof(hello_)),
+                [this, self](const boost::system::error_code& ec, size_t) {
+                  if (state_ == STOPPED || ec == error::operation_aborted) {
+                    return;
+                  }
+                  if (ec) {
+                    LOG(error) << id_str() << ": write error: " << ec.message();
+                    on_conn_err(false);
+                    return;
+                  }
+                  LOG(info) << id_str() << ": connected";
+                  state_ = PREFETCH;
+                  reader_.start(*bufs_, opts_.start_level);
+                  send_telemetry();
+                });
+  });
+}
+
+bool SimClient::on_frame(JitterSlot& slot, size_t wire_bytes) {
+  auto now = Clock::now();
+  auto& h = slot.header;
+  ++stats_.received;
+  stats_.bytes += wire_bytes;
+  stats_.reads = reader_.reads();
+  stats_.transit_us.push_back(to_us(since_pts(now, h.pts_ns)));
+  if (received_any_ && h.frame_num > last_received_ + 1) {
+    stats_.gaps += h.frame_num - last_received_ - 1;
+  }
+  received_any_ = true;
+  last_received_ = h.frame_num;
+  if (std::uniform_real_distribution<>()(rng_) < opts_.loss) {
+    ++stats_.lost;
+    return false;
+  }
+  auto arrival = now;
+  if (opts_.latency.count() || opts_.jitter.count()) {
+    auto delay = opts_.latency + std::chrono::milliseconds(
+                                     std::uniform_int_distribution<>(
+                                         0, opts_.jitter.count())(rng_));
+    // A TCP stream delivers in order, however late
+    arrival = now + delay;
+    if (!arrivals_.empty()) {
+      arrival = std::max(arrival, arrivals_.back());
+    }
+    arrivals_.push_back(arrival);
+  }
+  last_arrival_ = arrival;
+  auto arrival_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        arrival.time_since_epoch())
+                        .count();
+  playout_.on_arrival(h.frame_num, h.pts_ns / 1000, arrival_us);
+  if (opts_.record) {
+    fprintf(opts_.record, "%s %llu %llu %lld\n", id_str().c_str(),
+            static_cast<unsigned long long>(h.frame_num),
+            static_cast<unsigned long long>(h.pts_ns / 1000),
+            static_cast<long long>(arrival_us));
+  }
+  return true;
+}
+
+// Frames held back by injected latency count once they would arrive, so
+// playback starts when the last one does
+void SimClient::on_primed() {
+  if (state_ == PREFETCH) {
+    LOG(info) << id_str() << ": prefetch complete";
+    state_ = ACTIVE;
+    start_ticks(last_arrival_);
+  }
+}
+
+void SimClient::on_error(const std::string& what) {
+  LOG(error) << id_str() << ": " << what;
+  on_conn_err(false);
+}
+
+void SimClient::start_ticks(Clock::time_point at) {
+  next_tick_ = at;
+  tick_timer_.expires_at(next_tick_);
+  tick_timer_.async_wait(
+      [this, self = shared_from_this()](const boost::system::error_code& ec) {
+        if (!ec && state_ == ACTIVE) {
+          tick();
+        }
+      });
+}
+
+void SimClient::tick() {
+  advance_frame(Clock::now());
+  if (state_ != ACTIVE) {
+    return;
+  }
+  // Absolute deadlines, so the column clock does not drift
+  next_tick_ += period_;
+  tick_timer_.expires_at(next_tick_);
+  tick_timer_.async_wait(
+      [this, self = shared_from_this()](const boost::system::error_code& ec) {
+        if (!ec && state_ == ACTIVE) {
+          tick();
+        }
+      });
+}
+
+size_t SimClient::visible_level(Clock::time_point now) {
+  while (!arrivals_.empty() && arrivals_.front() <= now) {
+    arrivals_.pop_front();
+  }
+  return bufs_->level() - arrivals_.size();
+}
+
+// Same catch-up rules as LEDClient::advance_frame
+void SimClient::advance_frame(Clock::time_point now) {
+  auto level = visible_level(now);
+  if (level > (showing_ ? 1u : 0u)) {
+    if (showing_) {
+      bufs_->pop();
+      --level;
+    }
+    uint64_t due = shown_frame_ + 1 + dropped_frames_;
+    int skipped = 0;
+    if (synced_) {
+      skipped = playout_.skip_count(
+          level, shown_frame_, due,
+          [this](size_t i) { return bufs_->at(i).header.frame_num; });
+    }
+    bufs_->skip(skipped);
+    level -= skipped;
+    skipped_frames_ += skipped;
+    stats_.skipped += skipped;
+    auto& h = bufs_->front().header;
+    auto num = h.frame_num;
+    // As on the firmware, a late frame left in the buffer is shown late
+    dropped_frames_ = 0;
+    shown_frame_ = num;
+    synced_ = true;
+    showing_ = true;
+    ++stats_.shown;
+    // On the firmware it goes on display when the column banks next flip,
+    // a revolution from now
+    stats_.show_us.push_back(to_us(since_pts(now + period_, h.pts_ns)));
+    reader_.wake();
+  } else {
+    ++dropped_frames_;
+    ++underruns_;
+    ++stats_.underruns;
+    playout_.on_underrun();
+    if (dropped_frames_ > MAX_DROPPED_FRAMES) {
+      // The firmware asserts here and reboots
+      LOG(warning) << id_str() << ": " << dropped_frames_
+                   << " frames behind, resetting";
+      on_conn_err(true);
+    }
+  }
+}
+
+void SimClient::send_telemetry() {
+  if (state_ != PREFETCH && state_ != ACTIVE) {
+    return;
+  }
+  if (!writing_) {
+    auto& t = telemetry_;
+    t.buffer_level = bufs_->level();
+    t.buffer_depth = playout_.target();
+    t.shown_frame = shown_frame_;
+    t.rotation_us = to_us(period_);
+    t.dropped_frames = dropped_frames_;
+    t.underruns = underruns_;
+    t.skipped_frames = skipped_frames_;
+    seal(t);
+    writing_ = true;
+    async_write(sock_, buffer(&telemetry_, sizeof(telemetry_)),
+                [this, self = shared_from_this()](
+                    const boost::system::error_code& ec, size_t) {
+                  writing_ = false;
+                  if (state_ == STOPPED || ec == error::operation_aborted) {
+                    return;
+                  }
+                  if (ec) {
+                    LOG(error) << id_str() << ": write error: " << ec.message();
+                    on_conn_err(false);
+                  }
+                });
+  }
+  telemetry_timer_.expires_after(TELEMETRY_PERIOD);
+  telemetry_timer_.async_wait(
+      [this, self = shared_from_this()](const boost::system::error_code& ec) {
+        if (!ec) {
+          send_telemetry();
+        }
+      });
+}
+
+void SimClient::schedule_stall() {
+  if (!opts_.stall_every.count() || !opts_.stall_for.count()) {
+    return;
+  }
+  stall_timer_.expires_after(stalled_ ? Clock::duration(opts_.stall_for)
+                                      : Clock::duration(opts_.stall_every));
+  stall_timer_.async_wait(
+      [this, self = shared_from_this()](const boost::system::error_code& ec) {
+        if (ec || state_ == STOPPED) {
+          return;
+        }
+        stalled_ = !stalled_;
+        if (stalled_) {
+          ++stats_.stalls;
+        }
+        reader_.set_paused(stalled_);
+        schedule_stall();
+      });
+}
+
+void SimClient::on_conn_err(bool reset) {
+  if (reset) {
+    ++stats_.resets;
+  } else {
+    ++stats_.errors;
+  }
+  state_ = READY;
+  reader_.stop();
+  boost::system::error_code ec;
+  sock_.close(ec);
+  tick_timer_.cancel();
+  telemetry_timer_.cancel();
+  reconnect_timer_.expires_after(RECONNECT_DELAY);
+  reconnect_timer_.async_wait(
+      [this, self = shared_from_this()](const boost::system::error_code& ec) {
+        if (!ec && state_ != STOPPED) {
+          connect();
+        }
+      });
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FrameReader.h"
+#include "JitterBuffer.h"
+#include "Playout.h"
+
+struct SimOptions {
+  std::string host = "127.0.0.1";
+  uint16_t port = 5050;
+  int clients = 1;
+  int threads = 1;
+  // Client i identifies as this MAC address plus i
+  uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0xc0, 0x6b, 0xf0};
+  // Column clock; a frame is shown every W ticks
+  double column_hz = W * 16;
+  std::chrono::seconds duration{10};
+  // Added between a frame arriving and it reaching the jitter buffer
+  std::chrono::milliseconds latency{0};
+  std::chrono::milliseconds jitter{0};
+  // Fraction of frames discarded on arrival
+  double loss = 0;
+  // Every stall_every, stop reading the socket for stall_for
+  std::chrono::seconds stall_every{0};
+  std::chrono::milliseconds stall_for{0};
+  // Payload compression to ask for, as the firmware does by default
+  WireCodec codec = WIRE_CODEC;
+  // Frames buffered before playback starts
+  int start_level = JITTER_START_LEVEL;
+  // If set, each frame's arrival is written here as "ID FRAME PTS_US
+  // ARRIVAL_US", for replaying with --replay
+  FILE* record = nullptr;
+};
+
+struct SimStats {
+  uint64_t received = 0;
+  uint64_t bytes = 0;
+  uint64_t reads = 0;     // socket reads that returned frames
+  uint64_t shown = 0;
+  uint64_t underruns = 0;
+  uint64_t skipped = 0;   // frames skipped on the client to catch up
+  uint64_t lost = 0;      // frames discarded by injected loss
+  uint64_t gaps = 0;      // frames the server never sent
+  uint64_t stalls = 0;
+  uint64_t resets = 0;    // times the client fell MAX_DROPPED_FRAMES behind
+  uint64_t errors = 0;    // connections lost or out of sync
+  // Microseconds from a frame's presentation time to it arriving, and to it
+  // being shown
+  std::vector<uint32_t> transit_us;
+  std::vector<uint32_t> show_us;
+};
+
+// One simulated LEDClient. Follows the firmware's protocol and state
+// machine: connect and send a Hello, prefetch until the playout lets it
+// start, then show one frame per W column ticks, keeping the buffer at the
+// playout's target depth and reporting Telemetry every 250ms. Frames are
+// read, checked and decoded into the jitter buffer by the firmware's
+// FrameReader.
+//
+// All of a client's work runs on the io_context it was created with, which
+// must be run by a single thread.
+class SimClient : public std::enable_shared_from_this<SimClient> {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  SimClient(boost::asio::io_context& ctx, const SimOptions& opts, int index);
+  SimClient(const SimClient&) = delete;
+  SimClient& operator=(const SimClient&) = delete;
+
+  void start();
+  void post_stop();
+  const SimStats& stats() const { return stats_; }
+  std::string id_str() const;
+
+ private:
+  enum State {
+    STOPPED,
+    READY,
+    PREFETCH,
+    ACTIVE,
+  };
+
+  typedef FrameReader<boost::asio::ip::tcp::socket, JitterSlot,
+                      JITTER_BUFFER_DEPTH, SimClient>
+      Reader;
+  friend Reader;
+
+  void connect();
+  bool on_frame(JitterSlot& slot, size_t wire_bytes);
+  void on_primed();
+  void on_error(const std::string& what);
+  void start_ticks(Clock::time_point at);
+  void tick();
+  void advance_frame(Clock::time_point now);
+  size_t visible_level(Clock::time_point now);
+  void send_telemetry();
+  void schedule_stall();
+  void on_conn_err(bool reset);
+  void stop();
+
+  boost::asio::io_context& ctx_;
+  const SimOptions& opts_;
+  boost::asio::ip::tcp::socket sock_;
+  boost::asio::steady_timer tick_timer_;
+  boost::asio::steady_timer telemetry_timer_;
+  boost::asio::steady_timer stall_timer_;
+  boost::asio::steady_timer reconnect_timer_;
+  std::mt19937 rng_;
+  Hello hello_;
+  Telemetry telemetry_;
+  State state_;
+  std::unique_ptr<JitterBuffer> bufs_;
+  Playout playout_;
+  Reader reader_;
+  // When each frame at the back of the buffer becomes visible, for frames
+  // held back by injected latency
+  std::deque<Clock::time_point> arrivals_;
+  Clock::time_point last_arrival_;
+  Clock::duration period_;
+  Clock::time_point next_tick_;
+  bool writing_;
+  bool stalled_;
+  bool showing_;
+  uint32_t dropped_frames_;
+  uint64_t shown_frame_;
+  bool synced_;
+  uint64_t last_received_;
+  bool received_any_;
+  uint32_t underruns_;
+  uint32_t skipped_frames_;
+  SimStats stats_;
+};